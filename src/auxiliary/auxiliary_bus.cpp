@@ -0,0 +1,227 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <generic_listener.h>
+#include <sched.h>
+#include "auxiliary_bus.h"
+#include "logger.h"
+#include "time_utils.h"
+#include "motor_controller/bus_supervisor.h"
+
+/** The window over which the budget is enforced in nanoseconds, i.e. the longest burst is budget times the window. */
+static constexpr int64_t BUDGET_WINDOW = 10000000LL;
+
+/** How long the motor controllers must be quiet before a transaction of an auxiliary device in nanoseconds. */
+static constexpr int64_t QUIET_TIME = 1000000LL;
+
+
+AuxiliaryBus::AuxiliaryBus(const I2C* bus, const BusSupervisor* supervisor)
+: mI2C(bus),
+  mSupervisor(supervisor),
+  mDevices(),
+  mDeviceCount(0),
+  mNextDevice(0),
+  mBudget(0.0f),
+  mTransactions(0),
+  mFailures(0),
+  mDeferrals(0),
+  mBusyTime(0),
+  mStartTime(0),
+  mNotified(false),
+  mWorker()
+{
+}
+
+AuxiliaryBus::~AuxiliaryBus()
+{
+    stop();
+    for (size_t i = 0; i < mDeviceCount; ++i)
+    {
+        mDevices[i]->mBus.store(nullptr);
+    }
+}
+
+bool AuxiliaryBus::addDevice(AAuxiliaryDevice* device)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (nullptr == device || mDeviceCount >= MAX_DEVICES || nullptr != device->mBus.load())
+    {
+        return false;
+    }
+    mDevices[mDeviceCount++] = device;
+    device->mBus.store(this);
+    mNotified = true;
+    mWorker.notify();
+    return true;
+}
+
+bool AuxiliaryBus::start(const float budget)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (budget <= 0.0f)
+    {
+        return false;
+    }
+    mBudget = std::min(budget, 1.0f);
+    if (!mWorker.isRunning())
+    {
+        mStartTime.store(getMonotonicTime(), std::memory_order_relaxed);
+    }
+    mNotified = true;
+    mWorker.notify();
+    return mWorker.start(threadBody, this);
+}
+
+void AuxiliaryBus::stop()
+{
+    mWorker.stop();
+    ScopedLock lock(mWorker.getMutex());
+    mBudget = 0.0f;
+}
+
+void AuxiliaryBus::notify()
+{
+    ScopedLock lock(mWorker.getMutex());
+    mNotified = true;
+    mWorker.notify();
+}
+
+float AuxiliaryBus::getBudget() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    return mBudget;
+}
+
+AuxiliaryStatistics AuxiliaryBus::getStatistics() const
+{
+    AuxiliaryStatistics statistics;
+    int64_t startTime = mStartTime.load(std::memory_order_relaxed);
+    int64_t elapsed = getMonotonicTime() - startTime;
+    statistics.mTransactions = mTransactions.load(std::memory_order_relaxed);
+    statistics.mFailures     = mFailures.load(std::memory_order_relaxed);
+    statistics.mDeferrals    = mDeferrals.load(std::memory_order_relaxed);
+    statistics.mBusyTime     = mBusyTime.load(std::memory_order_relaxed);
+    statistics.mUtilisation  = (0 == startTime || elapsed <= 0) ? 0.0f :
+            static_cast<float>(static_cast<double>(statistics.mBusyTime) / elapsed);
+    return statistics;
+}
+
+void AuxiliaryBus::threadBody(void* bus)
+{
+    static_cast<AuxiliaryBus*>(bus)->run();
+}
+
+void AuxiliaryBus::waitUntil(const int64_t deadline)
+{
+    if (mNotified)
+    {
+        return;
+    }
+    if (AAuxiliaryDevice::NEVER == deadline)
+    {
+        mWorker.wait();
+        return;
+    }
+    mWorker.waitUntil(deadline);
+}
+
+void AuxiliaryBus::run()
+{
+    sched_param param;
+    AAuxiliaryDevice* device;
+    size_t index;
+    int64_t now;
+    int64_t last = getMonotonicTime();
+    int64_t due;
+    int64_t nextDue;
+    int64_t duration;
+    double credit = 0.0;
+    uint32_t frames = mSupervisor->getFrameCount();
+    timespec time = toTimespec(QUIET_TIME);
+    bool flag;
+
+    // auxiliary devices only get the CPU when nothing else needs it, and never preempt the control path
+    param.sched_priority = 0;
+    if (0 != pthread_setschedparam(pthread_self(), SCHED_IDLE, &param))
+    {
+        LOG_WARNING("auxiliary bus: failed to lower the thread priority");
+    }
+
+    while (mWorker.isRunning())
+    {
+        now = getMonotonicTime();
+        credit = std::min(credit + static_cast<double>(now - last) * mBudget, static_cast<double>(BUDGET_WINDOW) * mBudget);
+        last = now;
+        mNotified = false;
+
+        // devices get the bus in turn, so a busy display does not starve a power monitor
+        device = nullptr;
+        nextDue = AAuxiliaryDevice::NEVER;
+        for (size_t i = 0; i < mDeviceCount && nullptr == device; ++i)
+        {
+            index = (mNextDevice + i) % mDeviceCount;
+            due = mDevices[index]->getNextDue();
+            if (due <= now)
+            {
+                device = mDevices[index];
+                mNextDevice = (index + 1) % mDeviceCount;
+            }
+            nextDue = std::min(nextDue, due);
+        }
+        if (nullptr == device)
+        {
+            waitUntil(nextDue);
+            continue;
+        }
+        if (credit <= 0.0)
+        {
+            // the budget is spent, so wait until it refills
+            waitUntil(now + static_cast<int64_t>(-credit / mBudget) + 1);
+            continue;
+        }
+        if (mSupervisor->isWriting() || mSupervisor->getFrameCount() != frames)
+        {
+            // drive commands are being written, so wait until the motor controllers have been quiet for a while
+            frames = mSupervisor->getFrameCount();
+            mDeferrals.fetch_add(1, std::memory_order_relaxed);
+            pthread_mutex_unlock(&mWorker.getMutex());
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &time, nullptr);
+            pthread_mutex_lock(&mWorker.getMutex());
+            continue;
+        }
+
+        pthread_mutex_unlock(&mWorker.getMutex());
+        now = getMonotonicTime();
+        flag = device->transfer(*mI2C, now);
+        duration = getMonotonicTime() - now;
+        if (!flag)
+        {
+            mFailures.fetch_add(1, std::memory_order_relaxed);
+            LOG_DEBUG("auxiliary bus: a transaction of %s failed", device->getName());
+        }
+        mTransactions.fetch_add(1, std::memory_order_relaxed);
+        mBusyTime.fetch_add(duration, std::memory_order_relaxed);
+        pthread_mutex_lock(&mWorker.getMutex());
+        credit -= static_cast<double>(duration);
+    }
+}
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include "auxiliary_device.h"
+#include "worker_thread.h"
+
+class BusSupervisor;
+
+/**
+ * Statistics of an auxiliary bus. Time values are in nanoseconds.
+ */
+struct AuxiliaryStatistics
+{
+    /** The number of transactions of auxiliary devices. */
+    uint64_t mTransactions;
+    /** The number of failed transactions. */
+    uint64_t mFailures;
+    /** The number of times a transaction was postponed because drive commands were being written. */
+    uint64_t mDeferrals;
+    /** The bus time used by auxiliary devices. */
+    int64_t mBusyTime;
+    /** The fraction of time the bus was used by auxiliary devices since the bus started. */
+    float mUtilisation;
+};
+
+/**
+ * Schedules transactions of auxiliary devices on the bus of a robot, on a background thread at idle priority.
+ * Devices get the bus in turn, one transaction at a time, and only while the motor controllers have been quiet
+ * for a while, so that a drive command waits for at most a single auxiliary transaction. The bus time of the
+ * devices is limited to a fraction of the wall time, enforced over short windows by a budget of bus time which
+ * refills continuously.
+ */
+class AuxiliaryBus
+{
+public:
+    /** The maximum number of devices on a single auxiliary bus. */
+    static constexpr size_t MAX_DEVICES = 8;
+
+    /**
+     * Class constructor, only initialises variables.
+     *  @param bus the bus of the robot.
+     *  @param supervisor the supervisor of the motor controllers, whose writes take precedence.
+     */
+    AuxiliaryBus(const I2C* bus, const BusSupervisor* supervisor);
+
+    /**
+     * Class destructor, stops the auxiliary bus thread.
+     */
+    virtual ~AuxiliaryBus();
+
+    /**
+     * Adds a device to schedule. The device must outlive the bus.
+     *  @param device the device.
+     *  @return true if the device was added.
+     */
+    bool addDevice(AAuxiliaryDevice* device);
+
+    /**
+     * Starts the auxiliary bus thread, or changes its budget if already started.
+     *  @param budget the largest fraction of time the devices may use the bus, from 0 to 1.
+     *  @return true if the thread is running.
+     */
+    bool start(const float budget);
+
+    /**
+     * Stops the auxiliary bus thread. Devices stop between transactions.
+     */
+    void stop();
+
+    /**
+     * Wakes the auxiliary bus thread up, e.g. after a device got new work.
+     */
+    void notify();
+
+    /**
+     *  @return the budget of bus time, 0 if the thread is not running.
+     */
+    float getBudget() const;
+
+    /**
+     *  @return statistics of the auxiliary bus.
+     */
+    AuxiliaryStatistics getStatistics() const;
+
+private:
+    /**
+     * Body of the auxiliary bus thread.
+     *  @param bus pointer to this class.
+     */
+    static void threadBody(void* bus);
+
+    /**
+     * The main loop of the auxiliary bus thread, called with the mutex locked.
+     */
+    void run();
+
+    /**
+     * Waits until the given time, or until notified. Called with the mutex locked.
+     *  @param deadline the time until which to wait in nanoseconds, AAuxiliaryDevice::NEVER to wait until notified.
+     */
+    void waitUntil(const int64_t deadline);
+
+    /** The bus of the robot. */
+    const I2C* mI2C;
+    /** The supervisor of the motor controllers. */
+    const BusSupervisor* mSupervisor;
+    /** Scheduled devices. */
+    AAuxiliaryDevice* mDevices[MAX_DEVICES];
+    /** The number of scheduled devices. */
+    size_t mDeviceCount;
+    /** The device which gets the bus first in the next round. */
+    size_t mNextDevice;
+    /** The fraction of time the devices may use the bus. */
+    float mBudget;
+    /** Counters of the statistics. */
+    std::atomic<uint64_t> mTransactions;
+    std::atomic<uint64_t> mFailures;
+    std::atomic<uint64_t> mDeferrals;
+    std::atomic<int64_t> mBusyTime;
+    /** Time at which the thread started. */
+    std::atomic<int64_t> mStartTime;
+    /** Flag indicating if the thread was notified since it last looked at the devices. */
+    bool mNotified;
+    /** The auxiliary bus thread, whose mutex protects the devices and the budget. */
+    WorkerThread mWorker;
+};
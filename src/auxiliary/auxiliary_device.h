@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+class AuxiliaryBus;
+class I2C;
+
+/**
+ * Base of low-priority drivers of I2C peripherals which share the bus of a robot with its motor controllers,
+ * e.g. a power monitor or a small display. Drivers split their work into single transactions, so that the
+ * auxiliary bus can interleave them with drive traffic and stop between any two of them. Drivers guard their own
+ * state, because transfers run on the auxiliary bus thread while applications use the drivers on other threads.
+ */
+class AAuxiliaryDevice
+{
+public:
+    /** Returned by getNextDue when the device has nothing to transfer. */
+    static constexpr int64_t NEVER = std::numeric_limits<int64_t>::max();
+
+    /**
+     * Basic constructor.
+     *  @param name the name of the device, for logs.
+     *  @param address the address of the device on the bus.
+     */
+    AAuxiliaryDevice(const char* name, const uint8_t address);
+
+    /**
+     * Basic destructor.
+     */
+    virtual ~AAuxiliaryDevice();
+
+    /**
+     *  @return the name of the device.
+     */
+    inline const char* getName() const
+    {
+        return mName;
+    }
+
+    /**
+     *  @return the address of the device on the bus.
+     */
+    inline uint8_t getAddress() const
+    {
+        return mAddress;
+    }
+
+    /**
+     *  @return time at which the device needs the bus next in nanoseconds, NEVER if it has nothing to transfer.
+     */
+    virtual int64_t getNextDue() const = 0;
+
+    /**
+     * Performs the next single transaction of the device. Called on the auxiliary bus thread only.
+     *  @param bus the bus of the robot.
+     *  @param now the current time in nanoseconds.
+     *  @return true if the transaction succeeded, a failed transaction is repeated on the next call.
+     */
+    virtual bool transfer(const I2C& bus, const int64_t now) = 0;
+
+protected:
+    /**
+     * Wakes the auxiliary bus up after the device got new work, e.g. new display content.
+     */
+    void requestTransfer();
+
+private:
+    friend class AuxiliaryBus;
+
+    /** The name of the device. */
+    const char* mName;
+    /** The address of the device on the bus. */
+    const uint8_t mAddress;
+    /** The auxiliary bus which schedules the device, nullptr until it is added to one. */
+    std::atomic<AuxiliaryBus*> mBus;
+};
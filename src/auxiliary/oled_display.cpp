@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <generic_listener.h>
+#include <i2c.h>
+#include "oled_display.h"
+
+/** Commands which turn the display on with horizontal addressing and the charge pump enabled. */
+static const uint8_t INITIALISATION[] = {0xAE, 0x20, 0x00, 0x8D, 0x14, 0xAF};
+
+/** Commands which set the column and the page address ranges. */
+static constexpr uint8_t SET_COLUMN_ADDRESS = 0x21;
+static constexpr uint8_t SET_PAGE_ADDRESS   = 0x22;
+
+
+OledDisplay::OledDisplay(const uint8_t address)
+: AAuxiliaryDevice("SSD1306", address),
+  mFrame(),
+  mDirtyStart(),
+  mDirtyEnd(),
+  mPhase(INITIALISE),
+  mStep(0),
+  mPage(PAGES - 1),
+  mColumn(0),
+  mEnd(0)
+{
+    // the content of the display is undefined after power-up, so all of it is sent
+    memset(mDirtyEnd, WIDTH, sizeof(mDirtyEnd));
+    pthread_mutex_init(&mMutex, nullptr);
+}
+
+OledDisplay::~OledDisplay()
+{
+    pthread_mutex_destroy(&mMutex);
+}
+
+void OledDisplay::setPixel(const uint8_t x, const uint8_t y, const bool on)
+{
+    bool changed;
+    {
+        ScopedLock lock(mMutex);
+        changed = drawPixel(x, y, on);
+    }
+    // without the lock, the auxiliary bus locks its mutex first and then the one of the device
+    if (changed)
+    {
+        requestTransfer();
+    }
+}
+
+bool OledDisplay::getPixel(const uint8_t x, const uint8_t y) const
+{
+    ScopedLock lock(mMutex);
+    return x < WIDTH && y < HEIGHT && 0 != (mFrame[y / 8][x] & (1 << (y % 8)));
+}
+
+void OledDisplay::fill(const uint8_t x, const uint8_t y, const uint8_t width, const uint8_t height, const bool on)
+{
+    bool changed = false;
+    {
+        ScopedLock lock(mMutex);
+        for (uint16_t column = x; column < std::min<uint16_t>(x + width, WIDTH); ++column)
+        {
+            for (uint16_t row = y; row < std::min<uint16_t>(y + height, HEIGHT); ++row)
+            {
+                changed |= drawPixel(static_cast<uint8_t>(column), static_cast<uint8_t>(row), on);
+            }
+        }
+    }
+    if (changed)
+    {
+        requestTransfer();
+    }
+}
+
+bool OledDisplay::isSynchronised() const
+{
+    ScopedLock lock(mMutex);
+    if (IDLE != mPhase)
+    {
+        return false;
+    }
+    for (uint8_t page = 0; page < PAGES; ++page)
+    {
+        if (mDirtyStart[page] < mDirtyEnd[page])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int64_t OledDisplay::getNextDue() const
+{
+    return isSynchronised() ? NEVER : 0;
+}
+
+bool OledDisplay::transfer(const I2C& bus, const int64_t)
+{
+    ScopedLock lock(mMutex);
+    bool flag;
+    const uint8_t address = getAddress();
+    uint8_t addressing[6];
+
+    if (IDLE == mPhase && !startPage())
+    {
+        return true;
+    }
+    switch (mPhase)
+    {
+    case INITIALISE:
+        flag = bus.writeByte(address, CONTROL_COMMAND, INITIALISATION[mStep]);
+        if (flag && ++mStep == sizeof(INITIALISATION))
+        {
+            mPhase = IDLE;
+        }
+        return flag;
+    case ADDRESS:
+        addressing[0] = SET_COLUMN_ADDRESS;
+        addressing[1] = mColumn;
+        addressing[2] = static_cast<uint8_t>(mEnd - 1);
+        addressing[3] = SET_PAGE_ADDRESS;
+        addressing[4] = mPage;
+        addressing[5] = mPage;
+        flag = bus.writeByte(address, CONTROL_COMMAND, addressing[mStep]);
+        if (flag && ++mStep == sizeof(addressing))
+        {
+            mPhase = DATA;
+        }
+        return flag;
+    case DATA:
+        // the display advances its column with every byte, and the byte is read now, so later drawing is sent too
+        flag = bus.writeByte(address, CONTROL_DATA, mFrame[mPage][mColumn]);
+        if (flag && ++mColumn == mEnd)
+        {
+            mPhase = IDLE;
+        }
+        return flag;
+    case IDLE:
+        break;
+    }
+    return true;
+}
+
+bool OledDisplay::drawPixel(const uint8_t x, const uint8_t y, const bool on)
+{
+    if (x >= WIDTH || y >= HEIGHT)
+    {
+        return false;
+    }
+    const uint8_t page = y / 8;
+    const uint8_t mask = static_cast<uint8_t>(1 << (y % 8));
+    const uint8_t value = on ? (mFrame[page][x] | mask) : (mFrame[page][x] & ~mask);
+    if (value == mFrame[page][x])
+    {
+        return false;
+    }
+    mFrame[page][x] = value;
+    mDirtyStart[page] = std::min(mDirtyStart[page], x);
+    mDirtyEnd[page] = std::max(mDirtyEnd[page], static_cast<uint8_t>(x + 1));
+    return true;
+}
+
+bool OledDisplay::startPage()
+{
+    uint8_t page;
+    // pages are sent in turn, so that continuous drawing on one page does not starve the others
+    for (uint8_t i = 1; i <= PAGES; ++i)
+    {
+        page = static_cast<uint8_t>((mPage + i) % PAGES);
+        if (mDirtyStart[page] < mDirtyEnd[page])
+        {
+            mPage   = page;
+            mColumn = mDirtyStart[page];
+            mEnd    = mDirtyEnd[page];
+            mDirtyStart[page] = WIDTH;
+            mDirtyEnd[page]   = 0;
+            mPhase = ADDRESS;
+            mStep  = 0;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <pthread.h>
+#include "auxiliary_device.h"
+
+/**
+ * Driver of a 128x64 monochrome SSD1306 display on an auxiliary bus. Applications draw into a frame buffer, and the
+ * driver sends only the changed part of every page (a row of 8 pixels) to the display, one byte per transaction.
+ * Commands are written to the command control byte (0x00) and pixel data to the data control byte (0x40).
+ */
+class OledDisplay : public AAuxiliaryDevice
+{
+public:
+    /** The size of the display in pixels. */
+    static constexpr uint8_t WIDTH  = 128;
+    static constexpr uint8_t HEIGHT = 64;
+    /** The number of pages, i.e. rows of 8 pixels, each a byte per column. */
+    static constexpr uint8_t PAGES  = HEIGHT / 8;
+
+    /** Control bytes of the SSD1306, followed by a command or by pixel data. */
+    static constexpr uint8_t CONTROL_COMMAND = 0x00;
+    static constexpr uint8_t CONTROL_DATA    = 0x40;
+
+    /**
+     * Basic constructor, the whole display is sent with the first transfers.
+     *  @param address the address of the display.
+     */
+    OledDisplay(const uint8_t address = 0x3C);
+
+    /**
+     * Basic destructor.
+     */
+    virtual ~OledDisplay();
+
+    /**
+     * Turns a pixel on or off. Pixels outside of the display are ignored.
+     *  @param x the column of the pixel.
+     *  @param y the row of the pixel.
+     *  @param on true to turn the pixel on.
+     */
+    void setPixel(const uint8_t x, const uint8_t y, const bool on);
+
+    /**
+     *  @param x the column of the pixel.
+     *  @param y the row of the pixel.
+     *  @return true if the pixel is on in the frame buffer.
+     */
+    bool getPixel(const uint8_t x, const uint8_t y) const;
+
+    /**
+     * Turns all pixels of a rectangle on or off. The rectangle is clipped to the display.
+     *  @param x the left column of the rectangle.
+     *  @param y the top row of the rectangle.
+     *  @param width the width of the rectangle.
+     *  @param height the height of the rectangle.
+     *  @param on true to turn the pixels on.
+     */
+    void fill(const uint8_t x, const uint8_t y, const uint8_t width, const uint8_t height, const bool on);
+
+    /**
+     *  @return true if the display shows the frame buffer.
+     */
+    bool isSynchronised() const;
+
+    int64_t getNextDue() const override;
+
+    bool transfer(const I2C& bus, const int64_t now) override;
+
+private:
+    /** Phases of the transfer sequence. */
+    enum Phase : uint8_t
+    {
+        INITIALISE,
+        IDLE,
+        ADDRESS,
+        DATA
+    };
+
+    /**
+     * Sets a pixel in the frame buffer and extends the dirty range of its page. Called with mMutex locked.
+     *  @param x the column of the pixel.
+     *  @param y the row of the pixel.
+     *  @param on true to turn the pixel on.
+     *  @return true if the pixel changed.
+     */
+    bool drawPixel(const uint8_t x, const uint8_t y, const bool on);
+
+    /**
+     * Starts sending the dirty range of the next dirty page. Called with mMutex locked.
+     *  @return true if a page is dirty.
+     */
+    bool startPage();
+
+    /** The frame buffer, indexed by [page][column]. */
+    uint8_t mFrame[PAGES][WIDTH];
+    /** The first and one past the last column of every page which may differ from the display. */
+    uint8_t mDirtyStart[PAGES];
+    uint8_t mDirtyEnd[PAGES];
+    /** The phase of the transfer sequence, and the step within it. */
+    Phase mPhase;
+    uint8_t mStep;
+    /** The page being sent, and the current and one past the last column being sent. */
+    uint8_t mPage;
+    uint8_t mColumn;
+    uint8_t mEnd;
+    /** Mutex for accessing the frame buffer and the state of the sequence. */
+    mutable pthread_mutex_t mMutex;
+};
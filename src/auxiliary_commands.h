@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Commands for auxiliary outputs, e.g. gimbal servos on spare PCA9685 channels or gain presets.
+ */
+struct AuxiliaryCommands
+{
+    /** The auxiliary channel, its meaning is defined by the listener. */
+    uint8_t mChannel;
+    /** The value of the channel, typically from -1 to 1. */
+    float mValue;
+    /** Time of the input which produced these commands, in nanoseconds of CLOCK_MONOTONIC, 0 if unknown. */
+    int64_t mTimestamp;
+
+    /**
+     * Basic constructor that initialises all values with zeros.
+     *  @param channel the auxiliary channel.
+     *  @param value the value of the channel.
+     *  @param timestamp time of the input in nanoseconds of CLOCK_MONOTONIC, or 0 if unknown.
+     */
+    AuxiliaryCommands(const uint8_t channel = 0, const float value = 0.0f, const int64_t timestamp = 0)
+      : mChannel(channel), mValue(value), mTimestamp(timestamp) {};
+};
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include "command_mux.h"
+#include "metrics.h"
+#include "time_utils.h"
+
+/** Index of the "no source" state stored in the lower 8 bits of the mux state. */
+static constexpr uint64_t NO_SOURCE_INDEX = 0xFF;
+/** Commands with absolute values below this threshold are considered neutral. */
+static constexpr float NEUTRAL_THRESHOLD = 0.05f;
+
+namespace
+{
+
+/**
+ *  @return mux state composed of @p index and @p expiry.
+ */
+inline uint64_t packState(const uint64_t index, const int64_t expiry)
+{
+    return (static_cast<uint64_t>(expiry) << 8) | index;
+}
+
+/**
+ *  @return bit pattern of @p driveCommands values for comparison.
+ */
+inline uint64_t packCommand(const DriveCommands& driveCommands)
+{
+    uint32_t steering;
+    uint32_t throttle;
+    memcpy(&steering, &driveCommands.mSteering, sizeof(steering));
+    memcpy(&throttle, &driveCommands.mThrottle, sizeof(throttle));
+    return (static_cast<uint64_t>(steering) << 32) | throttle;
+}
+
+} // namespace
+
+
+void CommandMux::Source::update(const DriveCommands& driveCommands)
+{
+    mMux->publish(mIndex, driveCommands);
+}
+
+CommandMux::CommandMux(const uint32_t keepAlive)
+: mSourceCount(0),
+  mKeepAlive(static_cast<int64_t>(keepAlive) * 1000000),
+  mState(packState(NO_SOURCE_INDEX, 0)),
+  mLastCommand(0),
+  mLastForward(0),
+  mForwarded(0),
+  mRejected(0),
+  mSuppressed(0),
+  mSwitches(0),
+  mLastSwitchLatency(0),
+  mMaxSwitchLatency(0)
+{
+    pthread_mutex_init(&mForwardMutex, nullptr);
+}
+
+CommandMux::~CommandMux()
+{
+    pthread_mutex_destroy(&mForwardMutex);
+}
+
+CommandMux::Source* CommandMux::addSource(const int priority, const uint32_t lease, const TakeoverRule rule)
+{
+    if (mSourceCount >= MAX_SOURCES)
+    {
+        return nullptr;
+    }
+    Source& source = mSources[mSourceCount];
+    source.mMux      = this;
+    source.mIndex    = mSourceCount++;
+    source.mPriority = priority;
+    source.mLease    = static_cast<int64_t>(lease) * 1000000;
+    source.mRule     = rule;
+    source.mPendingSince.store(0);
+    return &source;
+}
+
+int CommandMux::getActiveSource() const
+{
+    uint64_t state = mState.load(std::memory_order_acquire);
+    uint8_t active = state & 0xFF;
+    return (NO_SOURCE_INDEX == active || static_cast<int64_t>(state >> 8) <= getMonotonicTime()) ? NO_SOURCE : active;
+}
+
+CommandMuxStatistics CommandMux::getStatistics() const
+{
+    CommandMuxStatistics statistics;
+    statistics.mForwarded         = mForwarded.load(std::memory_order_relaxed);
+    statistics.mRejected          = mRejected.load(std::memory_order_relaxed);
+    statistics.mSuppressed        = mSuppressed.load(std::memory_order_relaxed);
+    statistics.mSwitches          = mSwitches.load(std::memory_order_relaxed);
+    statistics.mLastSwitchLatency = mLastSwitchLatency.load(std::memory_order_relaxed);
+    statistics.mMaxSwitchLatency  = mMaxSwitchLatency.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+void CommandMux::publish(const uint8_t index, const DriveCommands& driveCommands)
+{
+    Source& source = mSources[index];
+    int64_t now = getMonotonicTime();
+    uint64_t renewed = packState(index, now + source.mLease);
+    uint64_t state = mState.load(std::memory_order_acquire);
+    uint64_t command = packCommand(driveCommands);
+    uint8_t active;
+    bool takeover;
+    int64_t pendingSince;
+    int64_t latency;
+    int64_t maxLatency;
+
+    do
+    {
+        active = state & 0xFF;
+        takeover = (active != index);
+        if (takeover && NO_SOURCE_INDEX != active && static_cast<int64_t>(state >> 8) > now)
+        {
+            // the active source still holds its lease, so only a higher priority source may preempt it
+            const Source& current = mSources[active];
+            if (source.mPriority <= current.mPriority || TAKEOVER_ON_EXPIRY == source.mRule ||
+               (TAKEOVER_ON_ACTIVITY == source.mRule && std::abs(driveCommands.mSteering) < NEUTRAL_THRESHOLD &&
+                                                        std::abs(driveCommands.mThrottle) < NEUTRAL_THRESHOLD))
+            {
+                pendingSince = 0;
+                source.mPendingSince.compare_exchange_strong(pendingSince, now, std::memory_order_relaxed);
+                mRejected.fetch_add(1, std::memory_order_relaxed);
+                Metrics::getInstance().commandDropped();
+                return;
+            }
+        }
+    } while (!mState.compare_exchange_weak(state, renewed, std::memory_order_acq_rel));
+
+    {
+        ScopedLock lock(mForwardMutex);
+        // a source which took over after this one won arbitration may have forwarded its command already
+        if ((mState.load(std::memory_order_acquire) & 0xFF) != index)
+        {
+            mRejected.fetch_add(1, std::memory_order_relaxed);
+            Metrics::getInstance().commandDropped();
+            return;
+        }
+        if (!takeover && command == mLastCommand.load(std::memory_order_relaxed) &&
+            now - mLastForward.load(std::memory_order_relaxed) < mKeepAlive)
+        {
+            mSuppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        mLastCommand.store(command, std::memory_order_relaxed);
+        mLastForward.store(now, std::memory_order_relaxed);
+        notifyListeners(driveCommands);
+        mForwarded.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (takeover)
+    {
+        pendingSince = source.mPendingSince.exchange(0, std::memory_order_relaxed);
+        latency = getMonotonicTime() - ((0 != pendingSince) ? pendingSince : now);
+        maxLatency = mMaxSwitchLatency.load(std::memory_order_relaxed);
+        mSwitches.fetch_add(1, std::memory_order_relaxed);
+        mLastSwitchLatency.store(latency, std::memory_order_relaxed);
+        while (latency > maxLatency && !mMaxSwitchLatency.compare_exchange_weak(maxLatency, latency, std::memory_order_relaxed))
+        {
+            ;
+        }
+    }
+    else
+    {
+        source.mPendingSince.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <generic_listener.h>
+#include <generic_talker.h>
+#include "drive_commands.h"
+
+
+/**
+ * Rules deciding when a source with higher priority takes control over the active source.
+ */
+enum TakeoverRule
+{
+    /** Any command of the source preempts sources with lower priority. */
+    TAKEOVER_ALWAYS,
+    /** Only commands away from neutral preempt sources with lower priority, e.g. a manual gamepad override. */
+    TAKEOVER_ON_ACTIVITY,
+    /** The source never preempts, it only takes over once the lease of the active source expires. */
+    TAKEOVER_ON_EXPIRY
+};
+
+/**
+ * Arbitration statistics of the command mux. Latencies are expressed in nanoseconds.
+ */
+struct CommandMuxStatistics
+{
+    /** The number of commands forwarded to listeners. */
+    uint64_t mForwarded;
+    /** The number of commands rejected because another source was in control. */
+    uint64_t mRejected;
+    /** The number of commands suppressed because they repeated the last forwarded command. */
+    uint64_t mSuppressed;
+    /** The number of switches of the active source. */
+    uint64_t mSwitches;
+    /** Latency of the last switch, from the first command of the new source which could not be forwarded. */
+    int64_t mLastSwitchLatency;
+    /** The maximum switch latency. */
+    int64_t mMaxSwitchLatency;
+};
+
+/**
+ * Arbitrates drive commands from multiple sources before they reach a robot. Each source has a priority,
+ * a lease which is renewed by its commands, and a takeover rule. Only the source in control is forwarded,
+ * and repeated identical commands are suppressed (apart from a periodic keep-alive) so that mixed-control
+ * sessions do not generate redundant bus writes. Arbitration is a single compare-and-swap on the publish
+ * side. Forwarding is serialised, and a source forwards only if it is still in control, so listeners receive
+ * commands in the order in which their sources won arbitration. Sources must be added before any command is
+ * published.
+ */
+class CommandMux : public GenericTalker<DriveCommands>
+{
+public:
+    /** The maximum number of sources. */
+    static constexpr uint8_t MAX_SOURCES = 8;
+    /** Index returned when no source is in control. */
+    static constexpr int NO_SOURCE = -1;
+
+    /**
+     * An input of the mux. Talkers of drive commands register to a source instead of a robot.
+     */
+    class Source : public GenericListener<DriveCommands>
+    {
+    public:
+        /**
+         * Forwards @p driveCommands to the mux for arbitration.
+         *  @param driveCommands commands from the talker.
+         */
+        void update(const DriveCommands& driveCommands) override;
+
+    private:
+        friend class CommandMux;
+
+        /** The mux which owns this source. */
+        CommandMux* mMux;
+        /** Index of this source in the mux. */
+        uint8_t mIndex;
+        /** Priority of this source, higher value wins. */
+        int mPriority;
+        /** Lease of this source in nanoseconds. */
+        int64_t mLease;
+        /** Takeover rule of this source. */
+        TakeoverRule mRule;
+        /** Time of the first command which could not be forwarded, 0 if none. */
+        std::atomic<int64_t> mPendingSince;
+    };
+
+    /**
+     * Class constructor, only initialises variables.
+     *  @param keepAlive the period after which a repeated command is forwarded anyway, in milliseconds.
+     */
+    CommandMux(const uint32_t keepAlive = 100);
+
+    /**
+     * Class destructor.
+     */
+    virtual ~CommandMux();
+
+    /**
+     * Adds a new source.
+     *  @param priority the priority of the source, higher value wins.
+     *  @param lease the time in milliseconds for which the source keeps control after its last command.
+     *  @param rule the takeover rule of the source.
+     *  @return the new source, or nullptr if there are too many sources.
+     */
+    Source* addSource(const int priority, const uint32_t lease = 500, const TakeoverRule rule = TAKEOVER_ALWAYS);
+
+    /**
+     *  @return index of the source in control, or NO_SOURCE if no lease is active.
+     */
+    int getActiveSource() const;
+
+    /**
+     *  @return arbitration statistics.
+     */
+    CommandMuxStatistics getStatistics() const;
+
+private:
+    /**
+     * Arbitrates a command of a source and forwards it if the source is in control.
+     *  @param index index of the source.
+     *  @param driveCommands commands of the source.
+     */
+    void publish(const uint8_t index, const DriveCommands& driveCommands);
+
+    /** All sources, the first mSourceCount are in use. */
+    Source mSources[MAX_SOURCES];
+    /** The number of sources in use. */
+    uint8_t mSourceCount;
+    /** Keep-alive period in nanoseconds. */
+    int64_t mKeepAlive;
+    /** Index of the active source in the lower 8 bits, and expiry of its lease in nanoseconds in the upper bits. */
+    std::atomic<uint64_t> mState;
+    /** Bit pattern of the last forwarded steering (upper 32 bits) and throttle (lower 32 bits). */
+    std::atomic<uint64_t> mLastCommand;
+    /** The time of the last forwarded command in nanoseconds. */
+    std::atomic<int64_t> mLastForward;
+    /** Mutex serialising the forwarding of commands to listeners. */
+    pthread_mutex_t mForwardMutex;
+    /** Counters of the statistics. */
+    std::atomic<uint64_t> mForwarded;
+    std::atomic<uint64_t> mRejected;
+    std::atomic<uint64_t> mSuppressed;
+    std::atomic<uint64_t> mSwitches;
+    std::atomic<int64_t> mLastSwitchLatency;
+    std::atomic<int64_t> mMaxSwitchLatency;
+};
@@ -0,0 +1,320 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <generic_listener.h>
+#include "command_submitter.h"
+#include "time_utils.h"
+#include "robots/abstract_robot_base.h"
+
+/** True on the worker thread while it applies a command. */
+static thread_local bool tApplying = false;
+/** Status and completion time of the command applied by the worker thread. */
+static thread_local CommandStatus tStatus = COMMAND_PENDING;
+static thread_local int64_t tCompleted = 0;
+
+
+CommandFuture::CommandFuture()
+: mSubmitter(nullptr),
+  mSlot(0),
+  mStatus(COMMAND_DROPPED),
+  mSubmitted(0),
+  mCompleted(0)
+{
+}
+
+CommandFuture::CommandFuture(CommandSubmitter* submitter, const uint16_t slot)
+: mSubmitter(submitter),
+  mSlot(slot),
+  mStatus(COMMAND_DROPPED),
+  mSubmitted(0),
+  mCompleted(0)
+{
+    // called by submit with the mutex locked
+    submitter->mSlots[slot].mHandle = this;
+}
+
+CommandFuture::CommandFuture(CommandFuture&& other)
+: mSubmitter(other.mSubmitter),
+  mSlot(other.mSlot),
+  mStatus(other.mStatus),
+  mSubmitted(other.mSubmitted),
+  mCompleted(other.mCompleted)
+{
+    if (nullptr != mSubmitter)
+    {
+        mSubmitter->attach(mSlot, this);
+    }
+    other.mSubmitter = nullptr;
+}
+
+CommandFuture& CommandFuture::operator=(CommandFuture&& other)
+{
+    if (this != &other)
+    {
+        if (nullptr != mSubmitter)
+        {
+            mSubmitter->release(mSlot);
+        }
+        mSubmitter = other.mSubmitter;
+        mSlot      = other.mSlot;
+        mStatus    = other.mStatus;
+        mSubmitted = other.mSubmitted;
+        mCompleted = other.mCompleted;
+        if (nullptr != mSubmitter)
+        {
+            mSubmitter->attach(mSlot, this);
+        }
+        other.mSubmitter = nullptr;
+    }
+    return *this;
+}
+
+CommandFuture::~CommandFuture()
+{
+    if (nullptr != mSubmitter)
+    {
+        mSubmitter->release(mSlot);
+    }
+}
+
+bool CommandFuture::isReady() const
+{
+    return COMMAND_PENDING != getStatus();
+}
+
+CommandStatus CommandFuture::getStatus() const
+{
+    if (nullptr == mSubmitter)
+    {
+        return mStatus;
+    }
+    return static_cast<CommandStatus>(mSubmitter->mSlots[mSlot].mStatus.load(std::memory_order_acquire));
+}
+
+bool CommandFuture::wait(const uint32_t timeout) const
+{
+    return nullptr == mSubmitter || isReady() || mSubmitter->wait(mSlot, timeout);
+}
+
+int64_t CommandFuture::getSubmissionTime() const
+{
+    return (nullptr == mSubmitter) ? mSubmitted : mSubmitter->mSlots[mSlot].mSubmitted;
+}
+
+int64_t CommandFuture::getCompletionTime() const
+{
+    if (nullptr == mSubmitter)
+    {
+        return mCompleted;
+    }
+    // the completion time is published by the status
+    return isReady() ? mSubmitter->mSlots[mSlot].mCompleted : 0;
+}
+
+void CommandFuture::detach(const CommandStatus status, const int64_t submitted, const int64_t completed)
+{
+    mSubmitter = nullptr;
+    mStatus    = status;
+    mSubmitted = submitted;
+    mCompleted = completed;
+}
+
+CommandSubmitter::CommandSubmitter(ARobotBase* robot)
+: mRobot(robot),
+  mSlots(),
+  mFree(0),
+  mQueue(),
+  mHead(0),
+  mQueued(0),
+  mWorker()
+{
+    for (uint16_t slot = 0; slot < MAX_PENDING; ++slot)
+    {
+        mSlots[slot].mNext = (slot + 1 < MAX_PENDING) ? slot + 1 : NO_SLOT;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mCompletionCondition, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+CommandSubmitter::~CommandSubmitter()
+{
+    stop();
+    {
+        // every command has completed after the stop, so the handles keep their final status
+        ScopedLock lock(mWorker.getMutex());
+        for (Slot& slot : mSlots)
+        {
+            if (nullptr != slot.mHandle)
+            {
+                slot.mHandle->detach(static_cast<CommandStatus>(slot.mStatus.load(std::memory_order_relaxed)),
+                                     slot.mSubmitted, slot.mCompleted);
+                slot.mHandle = nullptr;
+            }
+        }
+    }
+    pthread_cond_destroy(&mCompletionCondition);
+}
+
+CommandFuture CommandSubmitter::submit(const DriveCommands& command, const RealtimeProfile& profile,
+                                       const CompletionCallback callback, void* context)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (!mWorker.start(threadBody, this, profile) || NO_SLOT == mFree)
+    {
+        return CommandFuture();
+    }
+
+    uint16_t index = mFree;
+    Slot& slot = mSlots[index];
+    mFree = slot.mNext;
+    slot.mCommand   = command;
+    slot.mCallback  = callback;
+    slot.mContext   = context;
+    slot.mSubmitted = getMonotonicTime();
+    slot.mCompleted = 0;
+    slot.mReleased  = false;
+    slot.mStatus.store(COMMAND_PENDING, std::memory_order_relaxed);
+    mQueue[(mHead + mQueued) % MAX_PENDING] = index;
+    ++mQueued;
+    mWorker.notify();
+    // the handle is constructed in the storage of the caller, and records its address when it moves
+    return CommandFuture(this, index);
+}
+
+void CommandSubmitter::stop()
+{
+    mWorker.stop();
+    ScopedLock lock(mWorker.getMutex());
+    for (; mQueued > 0; --mQueued, mHead = (mHead + 1) % MAX_PENDING)
+    {
+        mSlots[mQueue[mHead]].mCompleted = getMonotonicTime();
+        finish(mSlots[mQueue[mHead]], COMMAND_DROPPED);
+    }
+}
+
+void CommandSubmitter::complete(const CommandStatus status)
+{
+    if (tApplying && COMMAND_PENDING == tStatus)
+    {
+        tStatus = status;
+        tCompleted = getMonotonicTime();
+    }
+}
+
+void CommandSubmitter::finish(Slot& slot, const CommandStatus status)
+{
+    slot.mStatus.store(status, std::memory_order_release);
+    if (slot.mReleased)
+    {
+        slot.mNext = mFree;
+        mFree = static_cast<uint16_t>(&slot - mSlots);
+    }
+    pthread_cond_broadcast(&mCompletionCondition);
+}
+
+void CommandSubmitter::release(const uint16_t slot)
+{
+    ScopedLock lock(mWorker.getMutex());
+    mSlots[slot].mHandle = nullptr;
+    if (COMMAND_PENDING == mSlots[slot].mStatus.load(std::memory_order_relaxed))
+    {
+        // still queued or being applied, so the worker returns it when it completes
+        mSlots[slot].mReleased = true;
+        return;
+    }
+    mSlots[slot].mNext = mFree;
+    mFree = slot;
+}
+
+void CommandSubmitter::attach(const uint16_t slot, CommandFuture* handle)
+{
+    ScopedLock lock(mWorker.getMutex());
+    mSlots[slot].mHandle = handle;
+}
+
+bool CommandSubmitter::wait(const uint16_t slot, const uint32_t timeout)
+{
+    timespec time = toTimespec(getMonotonicTime() + static_cast<int64_t>(timeout) * 1000000);
+    bool expired = false;
+
+    ScopedLock lock(mWorker.getMutex());
+    while (COMMAND_PENDING == mSlots[slot].mStatus.load(std::memory_order_relaxed) && !expired)
+    {
+        if (0 == timeout)
+        {
+            pthread_cond_wait(&mCompletionCondition, &mWorker.getMutex());
+        }
+        else
+        {
+            expired = (ETIMEDOUT == pthread_cond_timedwait(&mCompletionCondition, &mWorker.getMutex(), &time));
+        }
+    }
+    return COMMAND_PENDING != mSlots[slot].mStatus.load(std::memory_order_relaxed);
+}
+
+void CommandSubmitter::threadBody(void* submitter)
+{
+    static_cast<CommandSubmitter*>(submitter)->run();
+}
+
+void CommandSubmitter::run()
+{
+    Slot* slot;
+
+    while (mWorker.isRunning())
+    {
+        if (0 == mQueued)
+        {
+            mWorker.wait();
+            continue;
+        }
+        // the slot stays pending, so it is not returned to the pool while it is applied
+        slot = &mSlots[mQueue[mHead]];
+        mHead = (mHead + 1) % MAX_PENDING;
+        --mQueued;
+        pthread_mutex_unlock(&mWorker.getMutex());
+
+        tApplying = true;
+        tStatus = COMMAND_PENDING;
+        mRobot->update(slot->mCommand);
+        tApplying = false;
+        if (COMMAND_PENDING == tStatus)
+        {
+            // held by the rate governor or targeted by the motion profiler
+            tStatus = COMMAND_DEFERRED;
+            tCompleted = getMonotonicTime();
+        }
+        slot->mCompleted = tCompleted;
+        if (nullptr != slot->mCallback)
+        {
+            slot->mCallback(slot->mContext, slot->mCommand, tStatus, tCompleted);
+        }
+
+        pthread_mutex_lock(&mWorker.getMutex());
+        finish(*slot, tStatus);
+    }
+}
@@ -0,0 +1,300 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include "drive_commands.h"
+#include "realtime_profile.h"
+#include "worker_thread.h"
+
+class ARobotBase;
+class CommandSubmitter;
+
+/**
+ * States of a submitted drive command.
+ */
+enum CommandStatus : uint8_t
+{
+    /** The command is queued or being applied. */
+    COMMAND_PENDING,
+    /** The command was written to the bus, or was already in effect. */
+    COMMAND_WRITTEN,
+    /** Writing the command to the bus failed. */
+    COMMAND_FAILED,
+    /** The command was dropped, because it was stale or the submitter stopped before applying it. */
+    COMMAND_DROPPED,
+    /** The command was accepted, but is applied later by the rate governor, the motion profiler or an output scheduler. */
+    COMMAND_DEFERRED,
+    /** The command was not written, because the outputs already hold it, e.g. a zero command while the robot is idle. */
+    COMMAND_SKIPPED
+};
+
+/**
+ * Called on the worker thread when a submitted command completes. Must not block.
+ *  @param context the context given on submission.
+ *  @param command the completed command.
+ *  @param status the final status of the command.
+ *  @param completed time of the completion in nanoseconds, for written commands the time the write finished.
+ */
+typedef void (*CompletionCallback)(void* context, const DriveCommands& command, const CommandStatus status,
+                                   const int64_t completed);
+
+/**
+ * A handle to a command submitted with ARobotBase::submit, which completes when the command has been written to the
+ * bus or has failed. The handle owns a slot of a preallocated pool, which is returned when the handle is destroyed,
+ * even if the command is still pending. Handles can be moved but not copied. A handle may outlive its robot: the
+ * submitter detaches it when it is destroyed, and the handle keeps the final status and times of its command. The
+ * robot must not be destroyed while another thread uses one of its handles.
+ */
+class CommandFuture
+{
+public:
+    /**
+     * Creates an invalid handle.
+     */
+    CommandFuture();
+
+    /**
+     * Takes over the slot of @p other, which becomes invalid.
+     *  @param other the handle to move.
+     */
+    CommandFuture(CommandFuture&& other);
+
+    /**
+     * Releases the slot of this handle and takes over the slot of @p other, which becomes invalid.
+     *  @param other the handle to move.
+     *  @return this handle.
+     */
+    CommandFuture& operator=(CommandFuture&& other);
+
+    /**
+     * Class destructor, releases the slot.
+     */
+    virtual ~CommandFuture();
+
+    CommandFuture(const CommandFuture&) = delete;
+    CommandFuture& operator=(const CommandFuture&) = delete;
+
+    /**
+     *  @return false if the command was not submitted, because the submitter could not start or the pool was exhausted,
+     *          or if the handle was detached from its destroyed robot.
+     */
+    inline bool isValid() const
+    {
+        return nullptr != mSubmitter;
+    }
+
+    /**
+     *  @return true if the command has completed, without blocking.
+     */
+    bool isReady() const;
+
+    /**
+     *  @return the status of the command, COMMAND_DROPPED for invalid handles.
+     */
+    CommandStatus getStatus() const;
+
+    /**
+     * Waits until the command completes.
+     *  @param timeout the longest wait in milliseconds, 0 to wait without a limit.
+     *  @return true if the command has completed.
+     */
+    bool wait(const uint32_t timeout = 0) const;
+
+    /**
+     *  @return time of the submission in nanoseconds.
+     */
+    int64_t getSubmissionTime() const;
+
+    /**
+     *  @return time of the completion in nanoseconds, 0 while pending. For written commands, the time the write finished.
+     */
+    int64_t getCompletionTime() const;
+
+private:
+    friend class CommandSubmitter;
+
+    /**
+     * Creates a handle of a slot.
+     *  @param submitter the submitter owning the slot.
+     *  @param slot index of the slot.
+     */
+    CommandFuture(CommandSubmitter* submitter, const uint16_t slot);
+
+    /**
+     * Detaches the handle from its submitter, which is being destroyed. Called with the mutex of the submitter locked.
+     *  @param status the final status of the command.
+     *  @param submitted time of the submission.
+     *  @param completed time of the completion.
+     */
+    void detach(const CommandStatus status, const int64_t submitted, const int64_t completed);
+
+    /** The submitter owning the slot, nullptr for invalid and detached handles. */
+    CommandSubmitter* mSubmitter;
+    /** Index of the slot. */
+    uint16_t mSlot;
+    /** The status and times of the command once the handle is detached, COMMAND_DROPPED and 0 for invalid handles. */
+    CommandStatus mStatus;
+    int64_t mSubmitted;
+    int64_t mCompleted;
+};
+
+/**
+ * Applies drive commands submitted asynchronously to a robot on a single worker thread, and completes their handles
+ * when they have been written. Slots of pending commands come from a preallocated pool, and are queued in a fixed
+ * ring, so submissions neither allocate nor block on the bus. The worker applies commands in order through the
+ * robot's update, so they pass the same age budget, rate governor and motion profiler as synchronous commands.
+ */
+class CommandSubmitter
+{
+public:
+    /** The number of commands which can be pending at the same time, including completed ones with live handles. */
+    static constexpr uint16_t MAX_PENDING = 64;
+
+    /**
+     * Class constructor, only initialises variables.
+     *  @param robot the robot to which commands are applied.
+     */
+    CommandSubmitter(ARobotBase* robot);
+
+    /**
+     * Class destructor, stops the worker thread and detaches the handles which are still alive.
+     */
+    virtual ~CommandSubmitter();
+
+    /**
+     * Queues a command, and starts the worker thread on the first submission.
+     *  @param command the command to apply.
+     *  @param profile real-time profile of the worker thread, used only when it starts.
+     *  @param callback optional function called on the worker thread when the command completes.
+     *  @param context passed to @p callback.
+     *  @return a handle of the command, invalid if the worker thread could not start or the pool is exhausted.
+     */
+    CommandFuture submit(const DriveCommands& command, const RealtimeProfile& profile = RealtimeProfile(),
+                         const CompletionCallback callback = nullptr, void* context = nullptr);
+
+    /**
+     * Stops the worker thread. Queued commands are completed as dropped.
+     */
+    void stop();
+
+    /**
+     * Applies a new real-time profile to the worker thread if it is running.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    inline bool setRealtimeProfile(const RealtimeProfile& profile)
+    {
+        return mWorker.setProfile(profile);
+    }
+
+    /**
+     * Completes the command which the worker thread is applying, if any. Called by the robot on the applying thread,
+     * after the command was written, failed or dropped. Only the first completion of a command counts.
+     *  @param status the status of the command.
+     */
+    static void complete(const CommandStatus status);
+
+private:
+    friend class CommandFuture;
+
+    /**
+     * A pooled command.
+     */
+    struct Slot
+    {
+        /** The command. */
+        DriveCommands mCommand;
+        /** Function called when the command completes, and its context. */
+        CompletionCallback mCallback;
+        void* mContext;
+        /** Time of the submission and of the completion. */
+        int64_t mSubmitted;
+        int64_t mCompleted;
+        /** The status, published after the completion time. */
+        std::atomic<uint8_t> mStatus;
+        /** True when the handle of the slot was destroyed. */
+        bool mReleased;
+        /** The live handle of the slot, updated when it moves, nullptr once it was destroyed. */
+        CommandFuture* mHandle;
+        /** The next free slot. */
+        uint16_t mNext;
+    };
+
+    /**
+     * Completes a slot, and returns it to the pool if its handle was destroyed. Called with the mutex locked.
+     *  @param slot the slot.
+     *  @param status the status of its command.
+     */
+    void finish(Slot& slot, const CommandStatus status);
+
+    /**
+     * Returns the slot of a destroyed handle to the pool, or marks it to be returned when it completes.
+     *  @param slot index of the slot.
+     */
+    void release(const uint16_t slot);
+
+    /**
+     * Records the new address of the handle of a slot after it moved.
+     *  @param slot index of the slot.
+     *  @param handle the handle.
+     */
+    void attach(const uint16_t slot, CommandFuture* handle);
+
+    /**
+     * Waits until a slot completes.
+     *  @param slot index of the slot.
+     *  @param timeout the longest wait in milliseconds, 0 to wait without a limit.
+     *  @return true if the slot has completed.
+     */
+    bool wait(const uint16_t slot, const uint32_t timeout);
+
+    /**
+     * Body of the worker thread.
+     *  @param submitter pointer to this class.
+     */
+    static void threadBody(void* submitter);
+
+    /**
+     * The main loop of the worker thread, called with the mutex locked.
+     */
+    void run();
+
+    /** Marks the end of the free list. */
+    static constexpr uint16_t NO_SLOT = 0xFFFF;
+
+    /** The robot to which commands are applied. */
+    ARobotBase* mRobot;
+    /** The pool of slots. */
+    Slot mSlots[MAX_PENDING];
+    /** The first free slot. */
+    uint16_t mFree;
+    /** Ring of queued slots, its head and the number of queued slots. */
+    uint16_t mQueue[MAX_PENDING];
+    uint16_t mHead;
+    uint16_t mQueued;
+    /** The worker thread, whose mutex protects the pool and the queue. */
+    WorkerThread mWorker;
+    /** Condition variable on which callers wait for completions. */
+    pthread_cond_t mCompletionCondition;
+};
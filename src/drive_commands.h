@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <cstdint>
 
 struct DriveCommands
 {
@@ -29,12 +30,16 @@ struct DriveCommands
     float mSteering;
     /** Throttle control for the racer, value from -1 to 1. */
     float mThrottle;
+    /** Time of the input which produced these commands, in nanoseconds of CLOCK_MONOTONIC (see getMonotonicTime).
+        Zero means unknown, in which case commands are treated as created when received. */
+    int64_t mTimestamp;
 
     /**
      * Basic constructor that initialises all values with zeros.
      *  @param steering initial steering value.
      *  @param throttle initial throttle value.
+     *  @param timestamp time of the input in nanoseconds of CLOCK_MONOTONIC, or 0 if unknown.
      */
-    DriveCommands(const float steering = 0.0f, const float throttle = 0.0f) 
-      : mSteering(steering), mThrottle(throttle) {};
+    DriveCommands(const float steering = 0.0f, const float throttle = 0.0f, const int64_t timestamp = 0)
+      : mSteering(steering), mThrottle(throttle), mTimestamp(timestamp) {};
 };
\ No newline at end of file
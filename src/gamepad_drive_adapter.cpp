@@ -20,45 +20,461 @@
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sched.h>
 #include "gamepad_drive_adapter.h"
+#include "profiler.h"
+#include "time_utils.h"
+#include "trace.h"
 
 
 static constexpr float MAX_SHORT = 32767.0f;
 
+/** Events further apart than this in nanoseconds say nothing about the current velocity of an axis. */
+static constexpr int64_t PREDICTION_WINDOW = 100000000LL;
+
+/** Weight of the latest velocity measurement in the estimated velocity of an axis. */
+static constexpr float VELOCITY_SMOOTHING = 0.5f;
+
+/** Period in nanoseconds at which the filter of an axis advances while the axis sends no events. */
+static constexpr int64_t SETTLE_PERIOD = 10000000LL;
+
+/** A filter closer to its input than this in raw units is settled, as the input cannot change by less than a unit. */
+static constexpr float SETTLE_THRESHOLD = 0.5f;
+
+
+/**
+ * The lookup table of unconditioned inputs, which passes raw values through.
+ */
+struct IdentityCurve
+{
+    float mValues[65536];
+
+    IdentityCurve()
+    {
+        for (int32_t i = 0; i < 65536; ++i)
+        {
+            mValues[i] = static_cast<float>(i - 32768);
+        }
+    }
+};
+
+/**
+ *  @return the lookup table of unconditioned inputs.
+ */
+static const float* getIdentityCurve()
+{
+    static const IdentityCurve curve;
+    return curve.mValues;
+}
+
 
 GamepadDriveAdapter::GamepadDriveAdapter(const int steeringAxis, const int throttleAxis)
-: mSteeringAxis(steeringAxis),
-  mThrottleAxis(throttleAxis)
+: mTables(),
+  mActiveTable(&mTables[0]),
+  mReadTable(nullptr),
+  mStagedTable(),
+  mFiltered(),
+  mDispatched(),
+  mEventTimes(),
+  mVelocities(),
+  mEventTime(0),
+  mInputs(),
+  mSettling(),
+  mSettleTimes(),
+  mUnsettled(),
+  mUnsettledCount(0),
+  mLiveSettling(false)
 {
+    pthread_mutex_init(&mConfigMutex, nullptr);
+    for (uint16_t number = 0; number < MAX_INPUTS; ++number)
+    {
+        for (uint8_t type = 0; type < 2; ++type)
+        {
+            mStagedTable.mEntries[type][number].mCurve     = getIdentityCurve();
+            mStagedTable.mEntries[type][number].mSmoothing = 1.0f;
+            mStagedTable.mEntries[type][number].mJitter    = 0.0f;
+            mStagedTable.mEntries[type][number].mLookahead = 0.0f;
+            mStagedTable.mEntries[type][number].mMaxLead   = 0.0f;
+            mStagedTable.mEntries[type][number].mSuppress  = false;
+            mStagedTable.mEntries[type][number].mSettle    = false;
+            // nothing was dispatched yet, and NaN differs from every value
+            mDispatched[type][number] = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+    clearMappings();
+    mTables[0] = mStagedTable;
+    mTables[1] = mStagedTable;
+    setAxes(steeringAxis, throttleAxis);
 }
 
 GamepadDriveAdapter::~GamepadDriveAdapter()
 {
+    mSettler.stop();
+    pthread_mutex_destroy(&mConfigMutex);
 }
 
 void GamepadDriveAdapter::setAxes(const int steeringAxis, const int throttleAxis)
 {
-    mSteeringAxis = steeringAxis;
-    mThrottleAxis = throttleAxis;
+    ScopedLock lock(mConfigMutex);
+    for (uint16_t number = 0; number < MAX_INPUTS; ++number)
+    {
+        Handler handler = mStagedTable.mEntries[1][number].mHandler;
+        if (&GamepadDriveAdapter::setSteering == handler || &GamepadDriveAdapter::setThrottle == handler)
+        {
+            stageMapping(true, static_cast<uint8_t>(number), InputMapping());
+        }
+    }
+    if (steeringAxis >= 0 && steeringAxis < MAX_INPUTS)
+    {
+        stageMapping(true, static_cast<uint8_t>(steeringAxis), InputMapping(OUTPUT_STEERING, 1.0f, true));
+    }
+    if (throttleAxis >= 0 && throttleAxis < MAX_INPUTS)
+    {
+        stageMapping(true, static_cast<uint8_t>(throttleAxis), InputMapping(OUTPUT_THROTTLE));
+    }
+    publishMappings();
+}
+
+void GamepadDriveAdapter::setMapping(const bool isAxis, const uint8_t number, const InputMapping& mapping)
+{
+    ScopedLock lock(mConfigMutex);
+    stageMapping(isAxis, number, mapping);
+}
+
+void GamepadDriveAdapter::setConditioning(const uint8_t axis, const AxisConditioning& conditioning)
+{
+    ScopedLock lock(mConfigMutex);
+    MappingEntry& entry = mStagedTable.mEntries[1][axis];
+    float deadband = std::min(std::max(conditioning.mDeadband, 0.0f), 0.99f);
+    float expo = std::min(std::max(conditioning.mExpo, 0.0f), 1.0f);
+    float x;
+
+    if (0.0f == deadband && 0.0f == expo)
+    {
+        entry.mCurve = getIdentityCurve();
+    }
+    else
+    {
+        // fill the buffer which the active table does not use, once the event path has left the inactive table
+        const float* active = mActiveTable.load()->mEntries[1][axis].mCurve;
+        std::vector<float>& curve = (active == mCurves[axis][0].data()) ? mCurves[axis][1] : mCurves[axis][0];
+        waitForInactiveTable();
+        curve.resize(CURVE_SIZE);
+        for (uint32_t i = 0; i < CURVE_SIZE; ++i)
+        {
+            x = std::min(std::fabs(static_cast<float>(static_cast<int32_t>(i) - 32768) / MAX_SHORT), 1.0f);
+            x = (x <= deadband) ? 0.0f : (x - deadband) / (1.0f - deadband);
+            x = (1.0f - expo) * x + expo * x * x * x;
+            curve[i] = ((i < 32768) ? -x : x) * MAX_SHORT;
+        }
+        entry.mCurve = curve.data();
+    }
+    entry.mSmoothing = std::min(std::max(conditioning.mSmoothing, 0.01f), 1.0f);
+    entry.mJitter    = std::max(conditioning.mJitter, 0.0f) * MAX_SHORT;
+    entry.mLookahead = std::max(conditioning.mLookahead, 0.0f) / 1000.0f;
+    entry.mMaxLead   = std::min(std::max(conditioning.mMaxLead, 0.0f), 2.0f) * MAX_SHORT;
+    entry.mSuppress  = (entry.mCurve != getIdentityCurve() || entry.mSmoothing < 1.0f || entry.mJitter > 0.0f ||
+                        entry.mLookahead > 0.0f);
+    entry.mSettle    = (entry.mSmoothing < 1.0f || entry.mLookahead > 0.0f);
+}
+
+void GamepadDriveAdapter::clearMappings()
+{
+    ScopedLock lock(mConfigMutex);
+    for (uint16_t number = 0; number < MAX_INPUTS; ++number)
+    {
+        stageMapping(false, static_cast<uint8_t>(number), InputMapping());
+        stageMapping(true,  static_cast<uint8_t>(number), InputMapping());
+    }
+}
+
+void GamepadDriveAdapter::applyMappings()
+{
+    ScopedLock lock(mConfigMutex);
+    publishMappings();
 }
 
 void GamepadDriveAdapter::update(const GamepadEventData& eventData)
 {
-    if (eventData.mIsAxis)
+    // the event data does not carry the kernel event time, so stamp it at the earliest point in the library
+    convert(eventData, getMonotonicTime(), true);
+}
+
+void GamepadDriveAdapter::update(const GamepadEventData& eventData, const int64_t timestamp)
+{
+    convert(eventData, timestamp, false);
+}
+
+void GamepadDriveAdapter::settle(const int64_t timestamp)
+{
+    ScopedLock lock(mSettler.getMutex());
+    settleAxes(timestamp);
+}
+
+void GamepadDriveAdapter::convert(const GamepadEventData& eventData, const int64_t timestamp, const bool live)
+{
+    TRACE_SPAN("GamepadDriveAdapter::update");
+    PROFILE_STAGE(STAGE_GAMEPAD_ADAPTER);
+    MappingTable* table;
+    // announce the table before using it, and make sure it is still the active one, so that it is not overwritten
+    do
+    {
+        table = mActiveTable.load();
+        mReadTable.store(table);
+    } while (table != mActiveTable.load());
+
+    // the settling thread is started before any table which needs it is published, and then runs until destruction
+    const bool serialise = mSettler.isRunning();
+    if (serialise)
+    {
+        pthread_mutex_lock(&mSettler.getMutex());
+    }
+
+    const uint8_t type = eventData.mIsAxis ? 1 : 0;
+    const uint8_t number = static_cast<uint8_t>(eventData.mNumber);
+    const MappingEntry& entry = table->mEntries[type][number];
+    const float input = entry.mCurve[static_cast<int32_t>(eventData.mValue) + 32768];
+    float& filtered = mFiltered[type][number];
+    const float previous = filtered;
+    float output;
+    float velocity;
+    int64_t interval;
+    bool unsettled;
+
+    smooth(entry, filtered, input);
+    output = filtered;
+
+    if (entry.mLookahead > 0.0f)
     {
-        if (eventData.mNumber == mSteeringAxis)
+        // extrapolate with the velocity between events, a steady axis sends no events, so old events mean no velocity
+        interval = timestamp - mEventTimes[number];
+        velocity = (interval > 0 && interval < PREDICTION_WINDOW) ?
+                (filtered - previous) * static_cast<float>(NS_IN_SECOND) / static_cast<float>(interval) : 0.0f;
+        mEventTimes[number] = timestamp;
+        // an axis which has come to rest starts from no velocity rather than from the end of its last movement
+        mVelocities[number] = (0.0f == velocity) ? 0.0f :
+                mVelocities[number] + VELOCITY_SMOOTHING * (velocity - mVelocities[number]);
+        output = predict(entry, filtered, input, mVelocities[number]);
+    }
+
+    if (serialise && 1 == type)
+    {
+        // hand the axis over to the settling thread until its filter reaches the input
+        unsettled = entry.mSettle && (filtered != input || 0.0f != mVelocities[number]);
+        if (entry.mSettle)
         {
-            mDriveCommand.mSteering = static_cast<float>(-eventData.mValue) / MAX_SHORT;
-            notifyListeners(mDriveCommand);
+            mLiveSettling = live;
+            mInputs[number] = input;
+            mSettling[number] = entry;
+            mSettleTimes[number] = timestamp;
         }
-        else if (eventData.mNumber == mThrottleAxis)
+        if (unsettled != mUnsettled[number])
         {
-            mDriveCommand.mThrottle = static_cast<float>( eventData.mValue) / MAX_SHORT;
-            notifyListeners(mDriveCommand);
+            mUnsettled[number] = unsettled;
+            mUnsettledCount = unsettled ? mUnsettledCount + 1 : mUnsettledCount - 1;
+            if (unsettled && live)
+            {
+                mSettler.notify();
+            }
+        }
+    }
+
+    dispatch(type, number, entry, output, timestamp);
+    if (serialise)
+    {
+        pthread_mutex_unlock(&mSettler.getMutex());
+    }
+    mReadTable.store(nullptr, std::memory_order_release);
+}
+
+void GamepadDriveAdapter::smooth(const MappingEntry& entry, float& filtered, const float input)
+{
+    // written so that no smoothing reproduces the input exactly
+    filtered = input + (1.0f - entry.mSmoothing) * (filtered - input);
+    if (std::fabs(input - filtered) <= std::max(entry.mJitter, SETTLE_THRESHOLD))
+    {
+        // close enough to the input, so settle instead of approaching it forever
+        filtered = input;
+    }
+}
+
+float GamepadDriveAdapter::predict(const MappingEntry& entry, const float filtered, const float input, const float velocity)
+{
+    // a stick at centre or at a limit cannot keep moving the way it came
+    if (0.0f == input || std::fabs(input) >= MAX_SHORT)
+    {
+        return filtered;
+    }
+    const float output = filtered + std::max(-entry.mMaxLead, std::min(entry.mMaxLead, velocity * entry.mLookahead));
+    // never lead past the centre, i.e. never command the opposite direction from the stick
+    return (input > 0.0f) ? std::max(0.0f, std::min(MAX_SHORT, output)) : std::max(-MAX_SHORT, std::min(0.0f, output));
+}
+
+void GamepadDriveAdapter::dispatch(const uint8_t type, const uint8_t number, const MappingEntry& entry,
+                                   const float output, const int64_t timestamp, const bool settled)
+{
+    const float change = std::fabs(output - mDispatched[type][number]);
+    // suppress events of conditioned inputs which change nothing but jitter, so that they do not generate commands
+    if (!entry.mSuppress || !(change <= (settled ? 0.0f : entry.mJitter)))
+    {
+        mDispatched[type][number] = output;
+        mEventTime = timestamp;
+        (this->*entry.mHandler)(entry, output * entry.mScale + entry.mTrim);
+    }
+}
+
+int64_t GamepadDriveAdapter::settleAxes(const int64_t timestamp)
+{
+    int64_t next = std::numeric_limits<int64_t>::max();
+    int64_t expiry;
+    bool changed;
+
+    for (uint16_t number = 0; number < MAX_INPUTS && mUnsettledCount > 0; ++number)
+    {
+        if (!mUnsettled[number])
+        {
+            continue;
+        }
+        const MappingEntry& entry = mSettling[number];
+        const float input = mInputs[number];
+        float& filtered = mFiltered[1][number];
+        changed = false;
+        // an axis which is still moving is advanced by its events
+        if (filtered != input && timestamp - mSettleTimes[number] >= SETTLE_PERIOD)
+        {
+            smooth(entry, filtered, input);
+            mSettleTimes[number] = timestamp;
+            changed = true;
+        }
+        // the velocity of an axis which has sent no events for the lookahead is no longer worth extrapolating
+        expiry = mEventTimes[number] + static_cast<int64_t>(entry.mLookahead * static_cast<float>(NS_IN_SECOND));
+        if (0.0f != mVelocities[number] && timestamp >= expiry)
+        {
+            mVelocities[number] = 0.0f;
+            changed = true;
+        }
+        if (filtered == input && 0.0f == mVelocities[number])
+        {
+            mUnsettled[number] = false;
+            --mUnsettledCount;
         }
         else
         {
-            // nothing to do in here
+            // wake up for the next step of the filter or when the velocity expires, whichever comes first
+            next = std::min(next, (filtered != input) ? mSettleTimes[number] + SETTLE_PERIOD : expiry);
+            next = std::min(next, (0.0f != mVelocities[number]) ? expiry : next);
+        }
+        if (changed)
+        {
+            // the last step lands exactly on the input, even within the jitter threshold of the previous command
+            dispatch(1, static_cast<uint8_t>(number), entry, predict(entry, filtered, input, mVelocities[number]),
+                     timestamp, !mUnsettled[number]);
         }
     }
+    return next;
+}
+
+void GamepadDriveAdapter::settlerBody(void* adapter)
+{
+    static_cast<GamepadDriveAdapter*>(adapter)->runSettler();
+}
+
+void GamepadDriveAdapter::runSettler()
+{
+    while (mSettler.isRunning())
+    {
+        if (0 == mUnsettledCount || !mLiveSettling)
+        {
+            mSettler.wait();
+        }
+        else
+        {
+            const int64_t next = settleAxes(getMonotonicTime());
+            if (mUnsettledCount > 0)
+            {
+                mSettler.waitUntil(next);
+            }
+        }
+    }
+}
+
+void GamepadDriveAdapter::stageMapping(const bool isAxis, const uint8_t number, const InputMapping& mapping)
+{
+    MappingEntry& entry = mStagedTable.mEntries[isAxis ? 1 : 0][number];
+    switch (mapping.mOutput)
+    {
+        case OUTPUT_STEERING:
+            entry.mHandler = &GamepadDriveAdapter::setSteering;
+            break;
+        case OUTPUT_THROTTLE:
+            entry.mHandler = &GamepadDriveAdapter::setThrottle;
+            break;
+        case OUTPUT_AUXILIARY:
+            entry.mHandler = &GamepadDriveAdapter::setAuxiliary;
+            break;
+        default:
+            entry.mHandler = &GamepadDriveAdapter::ignoreInput;
+            break;
+    }
+    // axes are normalised to -1 to 1, buttons are already 0 or 1
+    entry.mScale   = mapping.mScale * (mapping.mInvert ? -1.0f : 1.0f) / (isAxis ? MAX_SHORT : 1.0f);
+    entry.mTrim    = mapping.mTrim;
+    entry.mChannel = mapping.mChannel;
+}
+
+void GamepadDriveAdapter::publishMappings()
+{
+    MappingTable* inactive = waitForInactiveTable();
+    *inactive = mStagedTable;
+    // start the settling thread before the event path can see an axis which needs it
+    for (uint16_t number = 0; number < MAX_INPUTS && !mSettler.isRunning(); ++number)
+    {
+        if (mStagedTable.mEntries[1][number].mSettle)
+        {
+            ScopedLock lock(mSettler.getMutex());
+            mSettler.start(&GamepadDriveAdapter::settlerBody, this);
+        }
+    }
+    mActiveTable.store(inactive);
+}
+
+GamepadDriveAdapter::MappingTable* GamepadDriveAdapter::waitForInactiveTable()
+{
+    MappingTable* active = mActiveTable.load();
+    MappingTable* inactive = (active == &mTables[0]) ? &mTables[1] : &mTables[0];
+    // the event path may still be dispatching an event with the table which was active before the last swap
+    while (mReadTable.load() == inactive)
+    {
+        sched_yield();
+    }
+    return inactive;
+}
+
+void GamepadDriveAdapter::ignoreInput(const MappingEntry&, const float)
+{
+}
+
+void GamepadDriveAdapter::setSteering(const MappingEntry&, const float value)
+{
+    mDriveCommand.mTimestamp = mEventTime;
+    mDriveCommand.mSteering = value;
+    GenericTalker<DriveCommands>::notifyListeners(mDriveCommand);
+}
+
+void GamepadDriveAdapter::setThrottle(const MappingEntry&, const float value)
+{
+    mDriveCommand.mTimestamp = mEventTime;
+    mDriveCommand.mThrottle = value;
+    GenericTalker<DriveCommands>::notifyListeners(mDriveCommand);
+}
+
+void GamepadDriveAdapter::setAuxiliary(const MappingEntry& entry, const float value)
+{
+    mAuxiliaryCommand.mTimestamp = mEventTime;
+    mAuxiliaryCommand.mChannel = entry.mChannel;
+    mAuxiliaryCommand.mValue = value;
+    GenericTalker<AuxiliaryCommands>::notifyListeners(mAuxiliaryCommand);
 }
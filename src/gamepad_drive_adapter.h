@@ -22,19 +22,111 @@
 
 #pragma once
 
+#include <atomic>
+#include <vector>
 #include <gamepad_event_data.h>
 #include <generic_listener.h>
 #include <generic_talker.h>
+#include "auxiliary_commands.h"
 #include "drive_commands.h"
+#include "worker_thread.h"
 
+/**
+ * Outputs to which gamepad inputs can be mapped.
+ */
+enum MappingOutput : uint8_t
+{
+    OUTPUT_NONE,
+    OUTPUT_STEERING,
+    OUTPUT_THROTTLE,
+    OUTPUT_AUXILIARY
+};
+
+/**
+ * Mapping of a gamepad axis or button to an output. Axes are normalised to -1 to 1 and buttons are 0 or 1
+ * before the mapping is applied, so the output is (invert ? -input : input) * scale + trim.
+ */
+struct InputMapping
+{
+    /** The output of the input. */
+    MappingOutput mOutput;
+    /** The auxiliary channel, used only with OUTPUT_AUXILIARY. */
+    uint8_t mChannel;
+    /** Scale of the normalised input. */
+    float mScale;
+    /** True to invert the input. */
+    bool mInvert;
+    /** Offset added to the scaled input. */
+    float mTrim;
+
+    /**
+     * Basic constructor.
+     *  @param output the output of the input.
+     *  @param scale scale of the normalised input.
+     *  @param invert true to invert the input.
+     *  @param trim offset added to the scaled input.
+     *  @param channel the auxiliary channel, used only with OUTPUT_AUXILIARY.
+     */
+    InputMapping(const MappingOutput output = OUTPUT_NONE, const float scale = 1.0f, const bool invert = false,
+                 const float trim = 0.0f, const uint8_t channel = 0)
+      : mOutput(output), mChannel(channel), mScale(scale), mInvert(invert), mTrim(trim) {};
+};
 
 /**
- * An adapter class which listens to gamepad updates and converts them into drive commands.
+ * Conditioning of a gamepad axis, applied before its mapping. The deadband and the expo curve are precomputed into
+ * a lookup table indexed by the raw value, while smoothing and jitter suppression are applied per event. The default
+ * conditioning passes the raw value through, and every event of the axis generates a command.
+ */
+struct AxisConditioning
+{
+    /** Half-width of the dead zone around the centre, from 0 to 1. The response outside of it starts from 0. */
+    float mDeadband;
+    /** Blend between a linear (0) and a cubic (1) response, which gives finer control around the centre. */
+    float mExpo;
+    /** Factor of the low-pass filter, from 1 (no smoothing) towards 0 (heavy smoothing), advanced with every event
+     * and every 10 ms between events, so that it settles on the last value of the axis. */
+    float mSmoothing;
+    /** Changes of the conditioned value up to this, normalised to 0 to 1, are suppressed as jitter. */
+    float mJitter;
+    /** How far ahead the value is extrapolated with its estimated velocity, in milliseconds, 0 to disable. The lead
+     * never points past the centre, stops at the centre and at the limits, and expires after this long without events. */
+    float mLookahead;
+    /** The largest extrapolation, normalised to 0 to 2. */
+    float mMaxLead;
+
+    /**
+     * Basic constructor.
+     *  @param deadband half-width of the dead zone around the centre, from 0 to 1.
+     *  @param expo blend between a linear (0) and a cubic (1) response.
+     *  @param smoothing factor of the low-pass filter, from 1 (no smoothing) towards 0.
+     *  @param jitter changes of the conditioned value up to this are suppressed.
+     *  @param lookahead how far ahead the value is extrapolated, in milliseconds, 0 to disable.
+     *  @param maxLead the largest extrapolation, normalised to 0 to 2.
+     */
+    AxisConditioning(const float deadband = 0.0f, const float expo = 0.0f, const float smoothing = 1.0f, const float jitter = 0.0f,
+                     const float lookahead = 0.0f, const float maxLead = 0.2f)
+      : mDeadband(deadband), mExpo(expo), mSmoothing(smoothing), mJitter(jitter), mLookahead(lookahead), mMaxLead(maxLead) {};
+};
+
+
+/**
+ * An adapter class which listens to gamepad updates and converts them into drive commands and auxiliary commands.
+ * Every axis and button is looked up in a dense mapping table, so an event is dispatched in constant time without
+ * branching on the configuration. Axes are conditioned with a single lookup of their raw value, optionally extrapolated
+ * to compensate the latency to the motors, and events which do not change the conditioned value are suppressed before
+ * they generate commands. Mappings are staged with setMapping and
+ * published with applyMappings, which swaps tables without locking the event path. Events must be delivered from
+ * a single thread, as the gamepad does. Once an axis is smoothed, a settling thread advances its filter while the axis
+ * sends no events, and the event path serialises with that thread through its mutex.
  */
 class GamepadDriveAdapter : public GenericListener<GamepadEventData>,
-                            public GenericTalker<DriveCommands>
+                            public GenericTalker<DriveCommands>,
+                            public GenericTalker<AuxiliaryCommands>
 {
 public:
+    /** The number of axes and the number of buttons which can be mapped. */
+    static constexpr uint16_t MAX_INPUTS = 256;
+
     /**
      * Basic constructor, initialises control axes.
      *  @param steeringAxis ID of the gamepad axis controlling steering angle.
@@ -48,23 +140,242 @@ public:
     virtual ~GamepadDriveAdapter();
 
     /**
-     * Sets the control axes.
+     * Sets the control axes, replacing any other steering and throttle mappings. Takes effect immediately.
      *  @param steeringAxis ID of the gamepad axis controlling steering angle.
      *  @param throttleAxis ID of the gamepad axis controlling throttle.
      */
     void setAxes(const int steeringAxis = 0, const int throttleAxis = 1);
 
     /**
-     * Receives updates from the gamepad and converts them into drive commands.
+     * Stages a mapping of an axis or a button. Takes effect with applyMappings.
+     *  @param isAxis true for an axis, false for a button.
+     *  @param number ID of the axis or the button.
+     *  @param mapping the new mapping, OUTPUT_NONE to ignore the input.
+     */
+    void setMapping(const bool isAxis, const uint8_t number, const InputMapping& mapping);
+
+    /**
+     * Stages conditioning of an axis and precomputes its lookup table. Takes effect with applyMappings, and is kept
+     * by clearMappings.
+     *  @param axis ID of the axis.
+     *  @param conditioning the new conditioning, AxisConditioning() to pass the raw value through.
+     */
+    void setConditioning(const uint8_t axis, const AxisConditioning& conditioning);
+
+    /**
+     * Stages removal of all mappings. Takes effect with applyMappings.
+     */
+    void clearMappings();
+
+    /**
+     * Publishes the staged mappings to the event path. Waits only while an event is dispatched with the old mappings.
+     */
+    void applyMappings();
+
+    /**
+     * Receives updates from the gamepad and converts them into drive commands or auxiliary commands.
      *  @param eventData as received from a gamepad.
      */
     void update(const GamepadEventData& eventData) override;
 
+    /**
+     * Converts an event received at a given time, e.g. when replaying a recorded session. Such events do not wake the
+     * settling thread, so a replay calls settle with its own clock instead.
+     *  @param eventData as received from a gamepad.
+     *  @param timestamp time of the event in nanoseconds of CLOCK_MONOTONIC.
+     */
+    void update(const GamepadEventData& eventData, const int64_t timestamp);
+
+    /**
+     * Advances the filters of smoothed axes which have received no events for a while, and dispatches their new values.
+     * Called by the settling thread with the current time, and by replays of recorded sessions with their own clock.
+     *  @param timestamp the current time in nanoseconds.
+     */
+    void settle(const int64_t timestamp);
+
 private:
-    /** ID of the gamepad axis controlling steering angle. */
-    int mSteeringAxis;
-    /** ID of the gamepad axis controlling throttle. */
-    int mThrottleAxis;
+    struct MappingEntry;
+
+    /** A handler of a mapped input, receiving the entry and the mapped value. */
+    typedef void (GamepadDriveAdapter::*Handler)(const MappingEntry& entry, const float value);
+
+    /** The number of entries of a conditioning lookup table, one for every raw value. */
+    static constexpr uint32_t CURVE_SIZE = 65536;
+
+    /**
+     * A compiled mapping of a single input.
+     */
+    struct MappingEntry
+    {
+        /** The handler of the output. */
+        Handler mHandler;
+        /** The conditioning lookup table, mapping raw values to conditioned raw values. */
+        const float* mCurve;
+        /** Factor of the low-pass filter. */
+        float mSmoothing;
+        /** The largest change of the conditioned raw value which is suppressed. */
+        float mJitter;
+        /** The lookahead of the prediction in seconds, 0 if disabled. */
+        float mLookahead;
+        /** The largest extrapolation in raw units. */
+        float mMaxLead;
+        /** True if the value of the axis changes between events, so that the settling thread has to advance it. */
+        bool mSettle;
+        /** True if the input is conditioned, so that events which do not change its value are suppressed. */
+        bool mSuppress;
+        /** Scale including normalisation and inversion. */
+        float mScale;
+        /** Offset added to the scaled input. */
+        float mTrim;
+        /** The auxiliary channel. */
+        uint8_t mChannel;
+    };
+
+    /**
+     * A complete mapping table, indexed by [isAxis][number].
+     */
+    struct MappingTable
+    {
+        MappingEntry mEntries[2][MAX_INPUTS];
+    };
+
+    /**
+     * Converts an event.
+     *  @param eventData as received from a gamepad.
+     *  @param timestamp time of the event in nanoseconds.
+     *  @param live true if the event has just been received, so that the settling thread runs on the same clock.
+     */
+    void convert(const GamepadEventData& eventData, const int64_t timestamp, const bool live);
+
+    /**
+     * Advances the low-pass filter of an input by a single step.
+     *  @param entry the mapping of the input.
+     *  @param filtered the filtered value, updated in place.
+     *  @param input the conditioned value of the input.
+     */
+    static void smooth(const MappingEntry& entry, float& filtered, const float input);
+
+    /**
+     * Extrapolates the filtered value of an axis.
+     *  @param entry the mapping of the axis.
+     *  @param filtered the filtered value.
+     *  @param input the conditioned value of the latest event.
+     *  @param velocity the estimated velocity in raw units per second.
+     *  @return the extrapolated value.
+     */
+    static float predict(const MappingEntry& entry, const float filtered, const float input, const float velocity);
+
+    /**
+     * Dispatches the conditioned value of an input, unless it is suppressed as jitter.
+     *  @param type 1 for an axis, 0 for a button.
+     *  @param number ID of the input.
+     *  @param entry the mapping of the input.
+     *  @param output the conditioned value.
+     *  @param timestamp time of the value in nanoseconds.
+     *  @param settled true if the value is where the input comes to rest, so that any change is dispatched.
+     */
+    void dispatch(const uint8_t type, const uint8_t number, const MappingEntry& entry, const float output,
+                  const int64_t timestamp, const bool settled = false);
+
+    /**
+     * Advances the axes which have received no events for a while, must be called with the mutex of the settling
+     * thread locked.
+     *  @param timestamp the current time in nanoseconds.
+     *  @return the time at which an axis has to be advanced next, in nanoseconds.
+     */
+    int64_t settleAxes(const int64_t timestamp);
+
+    /**
+     * Body of the settling thread.
+     *  @param adapter pointer to this class.
+     */
+    static void settlerBody(void* adapter);
+
+    /**
+     * The main loop of the settling thread, called with its mutex locked.
+     */
+    void runSettler();
+
+    /**
+     * Compiles a mapping into the staged table.
+     *  @param isAxis true for an axis, false for a button.
+     *  @param number ID of the axis or the button.
+     *  @param mapping the new mapping.
+     */
+    void stageMapping(const bool isAxis, const uint8_t number, const InputMapping& mapping);
+
+    /**
+     * Publishes the staged table, must be called with mConfigMutex locked.
+     */
+    void publishMappings();
+
+    /**
+     * Waits until the event path no longer reads the inactive table, so that the table and the lookup tables which
+     * only it references can be overwritten. Must be called with mConfigMutex locked.
+     *  @return the inactive table.
+     */
+    MappingTable* waitForInactiveTable();
+
+    /**
+     * Handler of unmapped inputs, does nothing.
+     */
+    void ignoreInput(const MappingEntry& entry, const float value);
+
+    /**
+     * Handler of steering, broadcasts drive commands with new steering.
+     *  @param entry the mapping of the input.
+     *  @param value the new steering.
+     */
+    void setSteering(const MappingEntry& entry, const float value);
+
+    /**
+     * Handler of throttle, broadcasts drive commands with new throttle.
+     *  @param entry the mapping of the input.
+     *  @param value the new throttle.
+     */
+    void setThrottle(const MappingEntry& entry, const float value);
+
+    /**
+     * Handler of auxiliary outputs, broadcasts auxiliary commands.
+     *  @param entry the mapping of the input.
+     *  @param value the new value of the auxiliary channel.
+     */
+    void setAuxiliary(const MappingEntry& entry, const float value);
+
+    /** Double-buffered mapping tables used by the event path. */
+    MappingTable mTables[2];
+    /** The table used by the event path. */
+    std::atomic<MappingTable*> mActiveTable;
+    /** The table which is being read by the event path, nullptr if none. */
+    std::atomic<MappingTable*> mReadTable;
+    /** Mappings staged by setMapping. */
+    MappingTable mStagedTable;
+    /** Double-buffered conditioning lookup tables of every axis, allocated when the axis is first conditioned. */
+    std::vector<float> mCurves[MAX_INPUTS][2];
+    /** Filtered and last dispatched conditioned values of every input, indexed by [isAxis][number], NaN if none. */
+    float mFiltered[2][MAX_INPUTS];
+    float mDispatched[2][MAX_INPUTS];
+    /** Time of the last event and estimated velocity in raw units per second of every axis, for the prediction. */
+    int64_t mEventTimes[MAX_INPUTS];
+    float mVelocities[MAX_INPUTS];
+    /** Time of the event being dispatched. */
+    int64_t mEventTime;
+    /** The last conditioned value and mapping of every axis which the settling thread has to advance. */
+    float mInputs[MAX_INPUTS];
+    MappingEntry mSettling[MAX_INPUTS];
+    /** Time at which the filter of every axis last advanced, with an event or by settling. */
+    int64_t mSettleTimes[MAX_INPUTS];
+    /** Flags of the axes which the settling thread has to advance, and their number. */
+    bool mUnsettled[MAX_INPUTS];
+    uint16_t mUnsettledCount;
+    /** True if the axes are settled on CLOCK_MONOTONIC by the thread, false if on the clock of a replay. */
+    bool mLiveSettling;
+    /** Mutex serialising reconfiguration, never taken by the event path. */
+    pthread_mutex_t mConfigMutex;
     /** Drive commands for broadcasting. */
     DriveCommands mDriveCommand;
+    /** Auxiliary commands for broadcasting. */
+    AuxiliaryCommands mAuxiliaryCommand;
+    /** The settling thread, started when an axis is first smoothed. */
+    WorkerThread mSettler;
 };
@@ -0,0 +1,292 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "logger.h"
+
+#if defined(JETRACER_LOG_LEVEL) && JETRACER_LOG_LEVEL > 0
+
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <vector>
+
+namespace
+{
+
+/**
+ * Single-producer single-consumer ring buffer of records, written only by its owning thread.
+ */
+struct LogBuffer
+{
+    /** Buffered records. */
+    LogRecord mRecords[Logger::BUFFER_SIZE];
+    /** The total number of records committed by the owning thread. */
+    std::atomic<uint32_t> mHead;
+    /** The total number of records written by the sink thread. */
+    std::atomic<uint32_t> mTail;
+};
+
+/** Names of log levels. */
+const char* const LEVEL_NAMES[] = {"", "ERROR", "WARNING", "INFO", "DEBUG"};
+
+/** Buffers of all threads which have logged. Buffers are never freed, so records of finished threads are written. */
+std::vector<LogBuffer*> gBuffers;
+/** Mutex protecting the list of buffers, taken only once per thread and by the sink thread. */
+pthread_mutex_t gBuffersMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Buffer of the calling thread. */
+thread_local LogBuffer* tBuffer = nullptr;
+/** True while the sink thread accepts records. */
+std::atomic<bool> gRunning(false);
+/** The number of dropped records. */
+std::atomic<uint64_t> gDropped(0);
+/** The stream to which the sink writes. */
+FILE* gFile = nullptr;
+/** Period of draining the buffers in nanoseconds. */
+int64_t gPeriod = 0;
+/** The sink thread. */
+pthread_t gThread;
+
+/**
+ *  @return the buffer of the calling thread, allocated on first use.
+ */
+LogBuffer* getBuffer()
+{
+    if (nullptr == tBuffer)
+    {
+        tBuffer = new LogBuffer();
+        tBuffer->mHead.store(0);
+        tBuffer->mTail.store(0);
+        pthread_mutex_lock(&gBuffersMutex);
+        gBuffers.push_back(tBuffer);
+        pthread_mutex_unlock(&gBuffersMutex);
+    }
+    return tBuffer;
+}
+
+/**
+ * Formats a single conversion with a single argument.
+ *  @param spec the conversion without its length modifier and conversion character.
+ *  @param length the length of @p spec, there must be room for three more characters.
+ *  @param conversion the conversion character.
+ *  @param type the type of @p argument.
+ *  @param argument the argument.
+ */
+void writeArgument(char* spec, size_t length, const char conversion, const LogArgumentType type, const LogArgument& argument)
+{
+    long long integer = (LOG_SIGNED == type) ? argument.mSigned :
+                        (LOG_UNSIGNED == type) ? static_cast<long long>(argument.mUnsigned) :
+                        (LOG_REAL == type) ? static_cast<long long>(argument.mReal) : 0;
+    double real = (LOG_REAL == type) ? argument.mReal : static_cast<double>(integer);
+
+    switch (conversion)
+    {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            // all integers are stored in 64 bits, so the length modifier is replaced
+            spec[length++] = 'l';
+            spec[length++] = 'l';
+            spec[length++] = conversion;
+            spec[length]   = '\0';
+            fprintf(gFile, spec, integer);
+            break;
+        case 'c':
+            spec[length++] = conversion;
+            spec[length]   = '\0';
+            fprintf(gFile, spec, static_cast<int>(integer));
+            break;
+        case 's':
+            spec[length++] = conversion;
+            spec[length]   = '\0';
+            fprintf(gFile, spec, (LOG_STRING == type) ? argument.mString : "<invalid>");
+            break;
+        case 'p':
+            spec[length++] = conversion;
+            spec[length]   = '\0';
+            fprintf(gFile, spec, argument.mPointer);
+            break;
+        default:
+            spec[length++] = conversion;
+            spec[length]   = '\0';
+            fprintf(gFile, spec, real);
+            break;
+    }
+}
+
+/**
+ * Formats a record and writes it to the sink stream.
+ *  @param record the record to write.
+ */
+void writeRecord(const LogRecord& record)
+{
+    const char* format = record.mFormat;
+    char spec[24];
+    size_t length;
+    uint8_t index = 0;
+
+    fprintf(gFile, "[%lld.%06lld] %s: ", static_cast<long long>(record.mTime / NS_IN_SECOND),
+            static_cast<long long>(record.mTime % NS_IN_SECOND / 1000), LEVEL_NAMES[record.mLevel]);
+    while ('\0' != *format)
+    {
+        if ('%' != *format)
+        {
+            fputc(*format++, gFile);
+        }
+        else if ('%' == format[1])
+        {
+            fputc('%', gFile);
+            format += 2;
+        }
+        else
+        {
+            // copy flags, width and precision, then skip the length modifier
+            length = 0;
+            spec[length++] = *format++;
+            while ('\0' != *format && nullptr != strchr("-+ #0123456789.", *format) && length < sizeof(spec) - 4)
+            {
+                spec[length++] = *format++;
+            }
+            while ('\0' != *format && nullptr != strchr("hlLqjzt", *format))
+            {
+                ++format;
+            }
+            if ('\0' == *format)
+            {
+                break;
+            }
+            if (index < record.mCount)
+            {
+                writeArgument(spec, length, *format, record.mTypes[index], record.mArguments[index]);
+                ++index;
+            }
+            ++format;
+        }
+    }
+    fputc('\n', gFile);
+}
+
+/**
+ * Writes all committed records of all buffers.
+ */
+void drain()
+{
+    uint32_t head;
+    uint32_t tail;
+    bool written = false;
+
+    pthread_mutex_lock(&gBuffersMutex);
+    for (LogBuffer* buffer : gBuffers)
+    {
+        head = buffer->mHead.load(std::memory_order_acquire);
+        tail = buffer->mTail.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail)
+        {
+            writeRecord(buffer->mRecords[tail % Logger::BUFFER_SIZE]);
+            written = true;
+        }
+        buffer->mTail.store(tail, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&gBuffersMutex);
+    if (written)
+    {
+        fflush(gFile);
+    }
+}
+
+/**
+ * The sink thread, which periodically drains the buffers.
+ */
+void* sinkThreadBody(void*)
+{
+    timespec time;
+    int64_t deadline = getMonotonicTime();
+    while (gRunning.load(std::memory_order_relaxed))
+    {
+        drain();
+        deadline += gPeriod;
+        time = toTimespec(deadline);
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr))
+        {
+            ;
+        }
+    }
+    drain();
+    return nullptr;
+}
+
+} // namespace
+
+bool Logger::start(FILE* file, const uint32_t period)
+{
+    if (!gRunning.load() && nullptr != file)
+    {
+        gFile = file;
+        gPeriod = static_cast<int64_t>(period) * 1000000;
+        gRunning.store(true);
+        if (0 != pthread_create(&gThread, nullptr, sinkThreadBody, nullptr))
+        {
+            gRunning.store(false);
+        }
+    }
+    return gRunning.load();
+}
+
+void Logger::stop()
+{
+    if (gRunning.exchange(false))
+    {
+        pthread_join(gThread, nullptr);
+    }
+}
+
+uint64_t Logger::getDropped()
+{
+    return gDropped.load(std::memory_order_relaxed);
+}
+
+LogRecord* Logger::acquire()
+{
+    if (!gRunning.load(std::memory_order_relaxed))
+    {
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    LogBuffer* buffer = getBuffer();
+    uint32_t head = buffer->mHead.load(std::memory_order_relaxed);
+    if (head - buffer->mTail.load(std::memory_order_acquire) >= BUFFER_SIZE)
+    {
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &buffer->mRecords[head % BUFFER_SIZE];
+}
+
+void Logger::commit()
+{
+    tBuffer->mHead.store(tBuffer->mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+#endif
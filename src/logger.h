@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+/**
+ * Asynchronous logging of the control stack with compile-time level filtering. Enabled by building with
+ * -DJETRACER_LOG_LEVEL=<level> (1 error, 2 warning, 3 info, 4 debug), otherwise all macros expand to nothing
+ * and their arguments are not evaluated.
+ *
+ * A log call copies the format pointer, a timestamp and the arguments in binary form into a lock-free buffer
+ * of the calling thread. Formatting and I/O are done by the sink thread started with LOG_START. The format
+ * and any string arguments must outlive the sink, e.g. string literals. Records are dropped, and counted,
+ * if a buffer is full or the sink is not running.
+ *
+ *  LOG_ERROR(format, ...)    logs an error with printf-like format.
+ *  LOG_WARNING(format, ...)  logs a warning.
+ *  LOG_INFO(format, ...)     logs an informative message.
+ *  LOG_DEBUG(format, ...)    logs a debug message.
+ *  LOG_START(file)           starts the sink thread writing to FILE* @p file, evaluates to true on success.
+ *  LOG_STOP()                writes all pending records and stops the sink thread.
+ */
+
+#define LOG_LEVEL_ERROR      1
+#define LOG_LEVEL_WARNING    2
+#define LOG_LEVEL_INFO       3
+#define LOG_LEVEL_DEBUG      4
+
+#if defined(JETRACER_LOG_LEVEL) && JETRACER_LOG_LEVEL > 0
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include "time_utils.h"
+
+#define LOG_START(file) Logger::start(file)
+#define LOG_STOP() Logger::stop()
+
+#if JETRACER_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Logger::log(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+
+#if JETRACER_LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) Logger::log(LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...)
+#endif
+
+#if JETRACER_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) Logger::log(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+
+#if JETRACER_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) Logger::log(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)
+#endif
+
+
+/**
+ * Types of arguments stored in a log record.
+ */
+enum LogArgumentType : uint8_t
+{
+    LOG_SIGNED,
+    LOG_UNSIGNED,
+    LOG_REAL,
+    LOG_STRING,
+    LOG_POINTER
+};
+
+/**
+ * A single argument of a log record in binary form.
+ */
+union LogArgument
+{
+    int64_t mSigned;
+    uint64_t mUnsigned;
+    double mReal;
+    const char* mString;
+    const void* mPointer;
+};
+
+/**
+ * A log record as stored by the logging thread.
+ */
+struct LogRecord
+{
+    /** The maximum number of arguments of a record. */
+    static constexpr uint8_t MAX_ARGUMENTS = 8;
+
+    /** Time of the call in nanoseconds. */
+    int64_t mTime;
+    /** The printf-like format, must be a string literal. */
+    const char* mFormat;
+    /** The level of the record. */
+    uint8_t mLevel;
+    /** The number of arguments. */
+    uint8_t mCount;
+    /** Types of arguments. */
+    LogArgumentType mTypes[MAX_ARGUMENTS];
+    /** Arguments of the record. */
+    LogArgument mArguments[MAX_ARGUMENTS];
+};
+
+/**
+ * Collects log records in per-thread buffers and formats them in a sink thread.
+ */
+class Logger
+{
+public:
+    /** The number of records buffered per thread. */
+    static constexpr uint32_t BUFFER_SIZE = 1024;
+
+    /**
+     * Logs a record. Never blocks, the record is dropped if the buffer of the calling thread is full.
+     *  @param level the level of the record.
+     *  @param format printf-like format, must be a string literal.
+     *  @param args arguments of the format, integers, floating-point values, string literals or pointers.
+     */
+    template <typename... Args>
+    static inline void log(const uint8_t level, const char* format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= LogRecord::MAX_ARGUMENTS, "Too many arguments of a log record");
+        LogRecord* record = acquire();
+        if (nullptr != record)
+        {
+            record->mTime   = getMonotonicTime();
+            record->mFormat = format;
+            record->mLevel  = level;
+            record->mCount  = static_cast<uint8_t>(sizeof...(Args));
+            pack(record, 0, args...);
+            commit();
+        }
+    }
+
+    /**
+     * Starts the sink thread.
+     *  @param file the stream to which records are written, e.g. stderr.
+     *  @param period how often the buffers are drained in milliseconds.
+     *  @return true if the sink thread is running.
+     */
+    static bool start(FILE* file, const uint32_t period = 10);
+
+    /**
+     * Writes all pending records and stops the sink thread.
+     */
+    static void stop();
+
+    /**
+     *  @return the number of records dropped because a buffer was full or the sink was not running.
+     */
+    static uint64_t getDropped();
+
+private:
+    /**
+     *  @return the next free record in the buffer of the calling thread, or nullptr if the record should be dropped.
+     */
+    static LogRecord* acquire();
+
+    /**
+     * Publishes the record returned by acquire() to the sink thread.
+     */
+    static void commit();
+
+    /**
+     * Stores arguments of a record, one at a time.
+     *  @param record the record.
+     *  @param index the index of the first argument in @p args.
+     *  @param args the remaining arguments.
+     */
+    static inline void pack(LogRecord*, const uint8_t)
+    {
+    }
+
+    template <typename T, typename... Args>
+    static inline void pack(LogRecord* record, const uint8_t index, T value, Args... args)
+    {
+        store(record->mTypes[index], record->mArguments[index], value);
+        pack(record, index + 1, args...);
+    }
+
+    /**
+     * Stores a single argument with its type.
+     *  @param type the type of the stored argument.
+     *  @param argument the stored argument.
+     *  @param value the value of the argument.
+     */
+    template <typename T>
+    static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    store(LogArgumentType& type, LogArgument& argument, const T value)
+    {
+        if (std::is_signed<T>::value || std::is_enum<T>::value)
+        {
+            type = LOG_SIGNED;
+            argument.mSigned = static_cast<int64_t>(value);
+        }
+        else
+        {
+            type = LOG_UNSIGNED;
+            argument.mUnsigned = static_cast<uint64_t>(value);
+        }
+    }
+
+    template <typename T>
+    static inline typename std::enable_if<std::is_floating_point<T>::value>::type
+    store(LogArgumentType& type, LogArgument& argument, const T value)
+    {
+        type = LOG_REAL;
+        argument.mReal = static_cast<double>(value);
+    }
+
+    static inline void store(LogArgumentType& type, LogArgument& argument, const char* value)
+    {
+        type = LOG_STRING;
+        argument.mString = value;
+    }
+
+    static inline void store(LogArgumentType& type, LogArgument& argument, const void* value)
+    {
+        type = LOG_POINTER;
+        argument.mPointer = value;
+    }
+};
+
+#else
+
+#define LOG_ERROR(...)
+#define LOG_WARNING(...)
+#define LOG_INFO(...)
+#define LOG_DEBUG(...)
+#define LOG_START(file) false
+#define LOG_STOP()
+
+#endif
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cinttypes>
+#include <cstdio>
+#include "metrics.h"
+
+namespace
+{
+
+/**
+ * Appends a single metric sample.
+ *  @param text the text to append to.
+ *  @param name the name of the metric.
+ *  @param help the description of the metric.
+ *  @param type the type of the metric, counter or gauge.
+ *  @param value the value of the metric.
+ */
+void appendMetric(std::string& text, const char* name, const char* help, const char* type, const double value)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s %s\n%s %.9g\n", name, help, name, type, name, value);
+    text += buffer;
+}
+
+} // namespace
+
+Metrics& Metrics::getInstance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Metrics()
+: mCommandsReceived(0),
+  mCommandsApplied(0),
+  mCommandsDropped(0),
+  mCommandAge(0),
+  mSteering(0.0f),
+  mThrottle(0.0f),
+  mRateLimit(0.0f),
+  mBusUtilisation(0.0f),
+  mDevices()
+{
+}
+
+void Metrics::format(std::string& text, const double loopRate) const
+{
+    static const char* const deviceMetrics[3][2] = {
+        {"jetracer_i2c_transactions_total", "I2C transactions per device address."},
+        {"jetracer_i2c_bytes_total", "I2C register bytes transferred per device address."},
+        {"jetracer_i2c_errors_total", "Failed I2C transactions per device address."}};
+    char buffer[128];
+    uint64_t value;
+
+    text.clear();
+    appendMetric(text, "jetracer_commands_received_total", "Drive commands received by robots.", "counter",
+            static_cast<double>(mCommandsReceived.load(std::memory_order_relaxed)));
+    appendMetric(text, "jetracer_commands_applied_total", "Drive commands fully written to the bus.", "counter",
+            static_cast<double>(mCommandsApplied.load(std::memory_order_relaxed)));
+    appendMetric(text, "jetracer_commands_dropped_total", "Drive commands which were not applied.", "counter",
+            static_cast<double>(mCommandsDropped.load(std::memory_order_relaxed)));
+    appendMetric(text, "jetracer_command_age_seconds", "Input-to-actuation age of the last applied command.", "gauge",
+            static_cast<double>(mCommandAge.load(std::memory_order_relaxed)) / 1e9);
+    appendMetric(text, "jetracer_steering", "The last applied steering value.", "gauge",
+            mSteering.load(std::memory_order_relaxed));
+    appendMetric(text, "jetracer_throttle", "The last applied throttle value.", "gauge",
+            mThrottle.load(std::memory_order_relaxed));
+    appendMetric(text, "jetracer_loop_rate_hz", "Rate of applied drive commands since the previous scrape.", "gauge", loopRate);
+    appendMetric(text, "jetracer_rate_limit_hz", "Command rate selected by the rate governor.", "gauge",
+            mRateLimit.load(std::memory_order_relaxed));
+    appendMetric(text, "jetracer_bus_utilisation", "Bus utilisation measured by the rate governor.", "gauge",
+            mBusUtilisation.load(std::memory_order_relaxed));
+
+    for (int metric = 0; metric < 3; ++metric)
+    {
+        snprintf(buffer, sizeof(buffer), "# HELP %s %s\n# TYPE %s counter\n",
+                deviceMetrics[metric][0], deviceMetrics[metric][1], deviceMetrics[metric][0]);
+        text += buffer;
+        for (uint8_t address = 0; address < I2C_ADDRESSES; ++address)
+        {
+            const Device& device = mDevices[address];
+            if (0 == device.mTransactions.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+            value = (0 == metric) ? device.mTransactions.load(std::memory_order_relaxed) :
+                    (1 == metric) ? device.mBytes.load(std::memory_order_relaxed) :
+                                    device.mErrors.load(std::memory_order_relaxed);
+            snprintf(buffer, sizeof(buffer), "%s{address=\"0x%02x\"} %" PRIu64 "\n", deviceMetrics[metric][0], address, value);
+            text += buffer;
+        }
+    }
+}
@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+
+/**
+ * Process-wide counters and gauges of the control path and the I2C bus. All updates are relaxed atomic
+ * operations, so they can be left enabled in production without adding locks to the hot path.
+ */
+class Metrics
+{
+public:
+    /** The number of 7-bit I2C addresses. */
+    static constexpr uint8_t I2C_ADDRESSES = 128;
+
+    /**
+     *  @return the process-wide instance.
+     */
+    static Metrics& getInstance();
+
+    /**
+     * Records a received drive command.
+     */
+    inline void commandReceived()
+    {
+        mCommandsReceived.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Records a drive command which was fully written to the bus and updates current outputs.
+     *  @param steering current steering value, NaN if the command did not change it.
+     *  @param throttle current throttle value, NaN if the command did not change it.
+     */
+    inline void commandApplied(const float steering, const float throttle)
+    {
+        mCommandsApplied.fetch_add(1, std::memory_order_relaxed);
+        if (!std::isnan(steering))
+        {
+            mSteering.store(steering, std::memory_order_relaxed);
+        }
+        if (!std::isnan(throttle))
+        {
+            mThrottle.store(throttle, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Records the age of an applied drive command, from its input to the end of the bus writes.
+     *  @param age the age in nanoseconds.
+     */
+    inline void commandAge(const int64_t age)
+    {
+        mCommandAge.store(age, std::memory_order_relaxed);
+    }
+
+    /**
+     * Records a drive command which was not (or not fully) applied.
+     */
+    inline void commandDropped()
+    {
+        mCommandsDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Records an I2C transaction.
+     *  @param address 7-bit address of the device.
+     *  @param bytes the number of register bytes transferred.
+     *  @param success true if the transaction succeeded.
+     */
+    inline void i2cTransaction(const uint8_t address, const uint32_t bytes, const bool success)
+    {
+        Device& device = mDevices[address & (I2C_ADDRESSES - 1)];
+        device.mTransactions.fetch_add(1, std::memory_order_relaxed);
+        device.mBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (!success)
+        {
+            device.mErrors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Records the command rate selected by a rate governor.
+     *  @param rate the selected maximum rate of applied commands in Hz.
+     *  @param utilisation the measured bus utilisation, from 0 to 1.
+     */
+    inline void rateSelected(const float rate, const float utilisation)
+    {
+        mRateLimit.store(rate, std::memory_order_relaxed);
+        mBusUtilisation.store(utilisation, std::memory_order_relaxed);
+    }
+
+    /**
+     * Formats all metrics in the Prometheus text exposition format.
+     *  @param[out] text the formatted metrics.
+     *  @param loopRate the rate of applied commands in Hz, computed by the caller.
+     */
+    void format(std::string& text, const double loopRate) const;
+
+    /**
+     *  @return the number of applied commands.
+     */
+    inline uint64_t getCommandsApplied() const
+    {
+        return mCommandsApplied.load(std::memory_order_relaxed);
+    }
+
+private:
+    /** Counters of a single I2C device. */
+    struct Device
+    {
+        /** The number of transactions. */
+        std::atomic<uint64_t> mTransactions;
+        /** The number of register bytes transferred. */
+        std::atomic<uint64_t> mBytes;
+        /** The number of failed transactions. */
+        std::atomic<uint64_t> mErrors;
+    };
+
+    /**
+     * Class constructor, initialises all values with zeros.
+     */
+    Metrics();
+
+    /** The number of received drive commands. */
+    std::atomic<uint64_t> mCommandsReceived;
+    /** The number of applied drive commands. */
+    std::atomic<uint64_t> mCommandsApplied;
+    /** The number of dropped drive commands. */
+    std::atomic<uint64_t> mCommandsDropped;
+    /** Input-to-actuation age of the last applied command in nanoseconds. */
+    std::atomic<int64_t> mCommandAge;
+    /** The last applied steering value. */
+    std::atomic<float> mSteering;
+    /** The last applied throttle value. */
+    std::atomic<float> mThrottle;
+    /** The rate selected by a rate governor in Hz, 0 if none. */
+    std::atomic<float> mRateLimit;
+    /** Bus utilisation measured by a rate governor. */
+    std::atomic<float> mBusUtilisation;
+    /** Counters of all I2C devices indexed by their address. */
+    Device mDevices[I2C_ADDRESSES];
+};
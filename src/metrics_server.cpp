@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <generic_listener.h>
+#include "metrics.h"
+#include "metrics_server.h"
+#include "time_utils.h"
+
+/** How often the server thread checks if it should stop, in milliseconds. */
+static constexpr int POLL_TIMEOUT = 200;
+
+
+MetricsServer::MetricsServer()
+: mSocket(-1),
+  mLastScrape(0),
+  mLastApplied(0),
+  mWorker()
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+bool MetricsServer::start(const uint16_t port)
+{
+    sockaddr_in address;
+    int reuse = 1;
+    ScopedLock lock(mWorker.getMutex());
+
+    if (mWorker.isRunning())
+    {
+        return false;
+    }
+    mSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mSocket < 0)
+    {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (0 != bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) || 0 != listen(mSocket, 4))
+    {
+        close(mSocket);
+        mSocket = -1;
+        return false;
+    }
+    return startThread();
+}
+
+bool MetricsServer::startUnixSocket(const char* path)
+{
+    sockaddr_un address;
+    ScopedLock lock(mWorker.getMutex());
+
+    if (mWorker.isRunning() || strlen(path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    mSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mSocket < 0)
+    {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (0 != bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) || 0 != listen(mSocket, 4))
+    {
+        close(mSocket);
+        mSocket = -1;
+        return false;
+    }
+    return startThread();
+}
+
+void MetricsServer::stop()
+{
+    mWorker.stop();
+    ScopedLock lock(mWorker.getMutex());
+    if (mSocket >= 0)
+    {
+        close(mSocket);
+        mSocket = -1;
+    }
+}
+
+bool MetricsServer::startThread()
+{
+    mLastScrape = getMonotonicTime();
+    mLastApplied = Metrics::getInstance().getCommandsApplied();
+    if (!mWorker.start(threadBody, this))
+    {
+        close(mSocket);
+        mSocket = -1;
+        return false;
+    }
+    return true;
+}
+
+void MetricsServer::threadBody(void* server)
+{
+    static_cast<MetricsServer*>(server)->run();
+}
+
+void MetricsServer::run()
+{
+    pollfd descriptor;
+    int client;
+
+    descriptor.fd = mSocket;
+    descriptor.events = POLLIN;
+    // the thread waits on the socket rather than on the condition variable, so it never needs the mutex
+    pthread_mutex_unlock(&mWorker.getMutex());
+    while (mWorker.isRunning())
+    {
+        if (poll(&descriptor, 1, POLL_TIMEOUT) > 0 && (descriptor.revents & POLLIN))
+        {
+            client = accept4(mSocket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                serve(client);
+                close(client);
+            }
+        }
+    }
+    pthread_mutex_lock(&mWorker.getMutex());
+}
+
+void MetricsServer::serve(const int client)
+{
+    char request[1024];
+    char header[128];
+    std::string body;
+    pollfd descriptor;
+    int64_t now = getMonotonicTime();
+    uint64_t applied = Metrics::getInstance().getCommandsApplied();
+    double rate = static_cast<double>(applied - mLastApplied) * NS_IN_SECOND / static_cast<double>(now - mLastScrape);
+
+    // the content of the request does not matter, but read it so that the client does not see a reset
+    descriptor.fd = client;
+    descriptor.events = POLLIN;
+    if (poll(&descriptor, 1, POLL_TIMEOUT) > 0)
+    {
+        if (recv(client, request, sizeof(request), 0) < 0)
+        {
+            return;
+        }
+    }
+
+    mLastScrape = now;
+    mLastApplied = applied;
+    Metrics::getInstance().format(body, rate);
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n\r\n", body.size());
+    if (send(client, header, strlen(header), MSG_NOSIGNAL) > 0)
+    {
+        send(client, body.data(), body.size(), MSG_NOSIGNAL);
+    }
+}
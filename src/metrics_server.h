@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include "worker_thread.h"
+
+
+/**
+ * A minimal HTTP endpoint serving Metrics in the Prometheus text format. It listens either on a loopback
+ * TCP port or on a Unix domain socket, and answers every request with the current metrics. Requests are
+ * served one at a time on a single background thread.
+ */
+class MetricsServer
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     */
+    MetricsServer();
+
+    /**
+     * Class destructor, stops the server.
+     */
+    virtual ~MetricsServer();
+
+    /**
+     * Starts serving metrics on 127.0.0.1.
+     *  @param port the TCP port to listen on.
+     *  @return true if the server was started.
+     */
+    bool start(const uint16_t port = 9105);
+
+    /**
+     * Starts serving metrics on a Unix domain socket, e.g. for `curl --unix-socket <path> http://localhost/metrics`.
+     *  @param path the path of the socket, an existing file is replaced.
+     *  @return true if the server was started.
+     */
+    bool startUnixSocket(const char* path);
+
+    /**
+     * Stops the server.
+     */
+    void stop();
+
+private:
+    /**
+     * Starts the server thread on an already listening socket. Must be called with the mutex locked.
+     *  @return true if the thread was started.
+     */
+    bool startThread();
+
+    /**
+     * Entry point of the server thread.
+     *  @param server pointer to this class.
+     */
+    static void threadBody(void* server);
+
+    /**
+     * The main loop of the server thread.
+     */
+    void run();
+
+    /**
+     * Answers a single client with the current metrics.
+     *  @param client the socket of the client.
+     */
+    void serve(const int client);
+
+    /** The listening socket, or -1. */
+    int mSocket;
+    /** The time of the previous scrape in nanoseconds. */
+    int64_t mLastScrape;
+    /** The number of applied commands at the previous scrape. */
+    uint64_t mLastApplied;
+    /** The server thread, its mutex guards the listening socket. */
+    WorkerThread mWorker;
+};
@@ -0,0 +1,267 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include "motion_profiler.h"
+#include "time_utils.h"
+
+/** True while the profiler thread applies a profiled command, which must not be profiled again. */
+static thread_local bool tDispatching = false;
+
+
+MotionProfiler::MotionProfiler(GenericListener<DriveCommands>* target)
+: mTarget(target),
+  mSteering(),
+  mThrottle(),
+  mPeriod(0),
+  mNextStep(0),
+  mSteps(0),
+  mReversals(0),
+  mResets(0),
+  mWorker()
+{
+}
+
+MotionProfiler::~MotionProfiler()
+{
+    stop();
+}
+
+bool MotionProfiler::start(const MotionLimits& steering, const MotionLimits& throttle, const float rate, const RealtimeProfile& profile)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (rate <= 0.0f)
+    {
+        return false;
+    }
+    mSteering.mLimits = steering;
+    mThrottle.mLimits = throttle;
+    mPeriod = static_cast<int64_t>(NS_IN_SECOND / rate);
+    mWorker.notify();
+    return mWorker.start(threadBody, this, profile);
+}
+
+void MotionProfiler::stop()
+{
+    mWorker.stop();
+}
+
+bool MotionProfiler::isDispatching()
+{
+    return tDispatching;
+}
+
+bool MotionProfiler::admit(const DriveCommands& driveCommands)
+{
+    if (!mWorker.isRunning() || tDispatching)
+    {
+        return true;
+    }
+    ScopedLock lock(mWorker.getMutex());
+    setTarget(mSteering, driveCommands.mSteering);
+    setTarget(mThrottle, driveCommands.mThrottle);
+    return false;
+}
+
+bool MotionProfiler::admitSteering(const float steering)
+{
+    if (!mWorker.isRunning() || tDispatching)
+    {
+        return true;
+    }
+    ScopedLock lock(mWorker.getMutex());
+    setTarget(mSteering, steering);
+    return false;
+}
+
+bool MotionProfiler::admitThrottle(const float throttle)
+{
+    if (!mWorker.isRunning() || tDispatching)
+    {
+        return true;
+    }
+    ScopedLock lock(mWorker.getMutex());
+    setTarget(mThrottle, throttle);
+    return false;
+}
+
+void MotionProfiler::reset(const float steering, const float throttle)
+{
+    ScopedLock lock(mWorker.getMutex());
+    int64_t now = getMonotonicTime();
+    reset(mSteering, steering, now);
+    reset(mThrottle, throttle, now);
+    ++mResets;
+}
+
+DriveCommands MotionProfiler::getTargets() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    return DriveCommands(mSteering.mTarget, mThrottle.mTarget);
+}
+
+MotionStatistics MotionProfiler::getStatistics() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    MotionStatistics statistics;
+    statistics.mSteps     = mSteps;
+    statistics.mReversals = mReversals;
+    return statistics;
+}
+
+void MotionProfiler::setTarget(Axis& axis, const float target)
+{
+    bool settled = isSettled(mSteering) && isSettled(mThrottle);
+    axis.mTarget = std::max(-1.0f, std::min(1.0f, target));
+    if (settled && !isSettled(axis))
+    {
+        mWorker.notify();
+    }
+}
+
+void MotionProfiler::reset(Axis& axis, const float value, const int64_t now)
+{
+    if (0.0f != value)
+    {
+        axis.mNegative = value < 0.0f;
+        axis.mMoved = true;
+    }
+    else if (0.0f != axis.mPosition)
+    {
+        // the dwell starts now, in the direction the output was moving
+        axis.mZeroSince = now;
+    }
+    axis.mTarget = axis.mPosition = value;
+    axis.mVelocity = 0.0f;
+}
+
+bool MotionProfiler::step(Axis& axis, const float period, const int64_t now)
+{
+    const float acceleration = axis.mLimits.mAcceleration;
+    const float jerk = axis.mLimits.mJerk;
+    float goal = axis.mTarget;
+    float error;
+    float speed;
+    bool reversing = false;
+
+    if (acceleration <= 0.0f && 0 == axis.mLimits.mDwell)
+    {
+        // the output is not profiled
+        axis.mPosition = goal;
+        axis.mVelocity = 0.0f;
+        return false;
+    }
+    if (0.0f != axis.mPosition && std::signbit(goal) != std::signbit(axis.mPosition))
+    {
+        // pass through zero first
+        goal = 0.0f;
+    }
+    else if (0.0f == axis.mPosition && 0.0f != goal && axis.mMoved && std::signbit(goal) != axis.mNegative)
+    {
+        if (now - axis.mZeroSince < static_cast<int64_t>(axis.mLimits.mDwell) * 1000000)
+        {
+            // dwell at zero before reversing
+            axis.mVelocity = 0.0f;
+            return false;
+        }
+        reversing = true;
+    }
+
+    error = goal - axis.mPosition;
+    if (acceleration <= 0.0f)
+    {
+        axis.mPosition = goal;
+        axis.mVelocity = 0.0f;
+    }
+    else
+    {
+        // approach with the highest rate from which the output can still slow down to the goal within the jerk limit
+        speed = (jerk > 0.0f) ? std::min(acceleration, std::sqrt(2.0f * jerk * std::fabs(error))) : acceleration;
+        speed = std::copysign(speed, error) - axis.mVelocity;
+        axis.mVelocity += (jerk > 0.0f) ? std::max(-jerk * period, std::min(jerk * period, speed)) : speed;
+        axis.mPosition += axis.mVelocity * period;
+        if ((goal - axis.mPosition) * error <= 0.0f)
+        {
+            axis.mPosition = goal;
+            axis.mVelocity = 0.0f;
+        }
+    }
+
+    if (0.0f != axis.mPosition)
+    {
+        axis.mNegative = axis.mPosition < 0.0f;
+        axis.mMoved = true;
+    }
+    else if (0.0f != error)
+    {
+        axis.mZeroSince = now;
+    }
+    return reversing;
+}
+
+void MotionProfiler::threadBody(void* profiler)
+{
+    static_cast<MotionProfiler*>(profiler)->run();
+}
+
+void MotionProfiler::run()
+{
+    DriveCommands driveCommands;
+    int64_t now;
+    float period;
+    uint32_t resets;
+    bool redispatch = false;
+
+    while (mWorker.isRunning())
+    {
+        if (!redispatch && isSettled(mSteering) && isSettled(mThrottle))
+        {
+            mWorker.wait();
+            continue;
+        }
+
+        now = getMonotonicTime();
+        if (!redispatch && now < mNextStep)
+        {
+            mWorker.waitUntil(mNextStep);
+            continue;
+        }
+
+        period = static_cast<float>(mPeriod) / static_cast<float>(NS_IN_SECOND);
+        mReversals += step(mSteering, period, now) ? 1 : 0;
+        mReversals += step(mThrottle, period, now) ? 1 : 0;
+        driveCommands = DriveCommands(mSteering.mPosition, mThrottle.mPosition);
+        // keep the pace of steps, unless the thread fell behind or was parked
+        mNextStep = (now - mNextStep > mPeriod) ? now + mPeriod : mNextStep + mPeriod;
+        ++mSteps;
+        resets = mResets;
+        pthread_mutex_unlock(&mWorker.getMutex());
+
+        tDispatching = true;
+        mTarget->update(driveCommands);
+        tDispatching = false;
+        pthread_mutex_lock(&mWorker.getMutex());
+        // a reset during the dispatch, e.g. the stop of the watchdog, may have been overwritten by this step
+        redispatch = (resets != mResets);
+    }
+}
@@ -0,0 +1,241 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <generic_listener.h>
+#include "drive_commands.h"
+#include "realtime_profile.h"
+#include "worker_thread.h"
+
+/**
+ * Limits of a profiled output, which ranges from -1 to 1.
+ */
+struct MotionLimits
+{
+    /** The maximum rate of change of the output in full scale per second, 0 for no limit. */
+    float mAcceleration;
+    /** The maximum change of that rate in full scale per second squared, 0 for no limit. */
+    float mJerk;
+    /** The time for which the output stays at zero before it reverses, in milliseconds. */
+    uint32_t mDwell;
+
+    /**
+     * Basic constructor, the default limits do not profile the output.
+     *  @param acceleration the maximum rate of change of the output in full scale per second, 0 for no limit.
+     *  @param jerk the maximum change of that rate in full scale per second squared, 0 for no limit.
+     *  @param dwell the time at zero before the output reverses, in milliseconds.
+     */
+    MotionLimits(const float acceleration = 0.0f, const float jerk = 0.0f, const uint32_t dwell = 0)
+      : mAcceleration(acceleration), mJerk(jerk), mDwell(dwell) {};
+};
+
+/**
+ * Statistics of a motion profiler.
+ */
+struct MotionStatistics
+{
+    /** The number of intermediate commands applied. */
+    uint64_t mSteps;
+    /** The number of times an output passed through zero to reverse. */
+    uint64_t mReversals;
+};
+
+/**
+ * Shapes steering and throttle so that they change smoothly, within acceleration and jerk limits, and reverse only
+ * after dwelling at zero. Commands set the targets of the outputs, and a thread steps the outputs towards them at
+ * the actuation rate, applying every step as a drive command through the target listener. The thread sleeps once
+ * the outputs reach their targets.
+ */
+class MotionProfiler
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     *  @param target the listener which applies commands, normally the robot.
+     */
+    MotionProfiler(GenericListener<DriveCommands>* target);
+
+    /**
+     * Class destructor, stops the profiler thread.
+     */
+    virtual ~MotionProfiler();
+
+    /**
+     * Starts profiling, or changes its limits if already started. The outputs start from their last values.
+     *  @param steering limits of steering.
+     *  @param throttle limits of throttle.
+     *  @param rate the rate at which the outputs are stepped, in Hz.
+     *  @param profile real-time profile of the profiler thread.
+     *  @return true if the profiler is running.
+     */
+    bool start(const MotionLimits& steering, const MotionLimits& throttle, const float rate,
+               const RealtimeProfile& profile = RealtimeProfile());
+
+    /**
+     * Stops profiling, the outputs stay where they are.
+     */
+    void stop();
+
+    /**
+     * Applies a new real-time profile to the profiler thread if it is running.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    inline bool setRealtimeProfile(const RealtimeProfile& profile)
+    {
+        return mWorker.setProfile(profile);
+    }
+
+    /**
+     *  @return true if the profiler is running.
+     */
+    inline bool isRunning() const
+    {
+        return mWorker.isRunning();
+    }
+
+    /**
+     *  @return true if the calling thread is applying a profiled command.
+     */
+    static bool isDispatching();
+
+    /**
+     * Sets the targets of both outputs, unless the profiler is not running or the command is a profiled one.
+     *  @param driveCommands the command.
+     *  @return true if the command should be applied now, false if it became the target of the profiler.
+     */
+    bool admit(const DriveCommands& driveCommands);
+
+    /**
+     * Sets the target of steering, unless the profiler is not running or the command is a profiled one.
+     *  @param steering the new steering.
+     *  @return true if the steering should be applied now, false if it became the target of the profiler.
+     */
+    bool admitSteering(const float steering);
+
+    /**
+     * Sets the target of throttle, unless the profiler is not running or the command is a profiled one.
+     *  @param throttle the new throttle.
+     *  @return true if the throttle should be applied now, false if it became the target of the profiler.
+     */
+    bool admitThrottle(const float throttle);
+
+    /**
+     * Moves both outputs and their targets to new values immediately, e.g. after an emergency stop.
+     *  @param steering the new steering.
+     *  @param throttle the new throttle.
+     */
+    void reset(const float steering, const float throttle);
+
+    /**
+     *  @return the targets of the outputs.
+     */
+    DriveCommands getTargets() const;
+
+    /**
+     *  @return statistics of the profiler.
+     */
+    MotionStatistics getStatistics() const;
+
+private:
+    /**
+     * The state of a profiled output.
+     */
+    struct Axis
+    {
+        /** Limits of the output. */
+        MotionLimits mLimits;
+        /** The target of the output. */
+        float mTarget;
+        /** The current output. */
+        float mPosition;
+        /** The current rate of change of the output per second. */
+        float mVelocity;
+        /** Time at which the output reached zero. */
+        int64_t mZeroSince;
+        /** True if the output was last non-zero in the negative direction. */
+        bool mNegative;
+        /** True once the output has been non-zero, so that a move from rest has a direction to reverse. */
+        bool mMoved;
+    };
+
+    /**
+     * Sets a target and wakes the profiler thread up, must be called with the mutex locked.
+     *  @param axis the output.
+     *  @param target the new target.
+     */
+    void setTarget(Axis& axis, const float target);
+
+    /**
+     * Moves an output and its target to a new value immediately, must be called with the mutex locked.
+     *  @param axis the output.
+     *  @param value the new value.
+     *  @param now current time in nanoseconds.
+     */
+    static void reset(Axis& axis, const float value, const int64_t now);
+
+    /**
+     * Steps an output towards its target.
+     *  @param axis the output.
+     *  @param period the step period in seconds.
+     *  @param now current time in nanoseconds.
+     *  @return true if the output started reversing after dwelling at zero.
+     */
+    static bool step(Axis& axis, const float period, const int64_t now);
+
+    /**
+     *  @return true if the output has reached its target.
+     */
+    static inline bool isSettled(const Axis& axis)
+    {
+        return axis.mPosition == axis.mTarget && 0.0f == axis.mVelocity;
+    }
+
+    /**
+     * Body of the profiler thread.
+     *  @param profiler pointer to this class.
+     */
+    static void threadBody(void* profiler);
+
+    /**
+     * The main loop of the profiler thread, called with the mutex locked.
+     */
+    void run();
+
+    /** The listener which applies commands. */
+    GenericListener<DriveCommands>* mTarget;
+    /** Profiled steering and throttle. */
+    Axis mSteering;
+    Axis mThrottle;
+    /** The step period in nanoseconds. */
+    int64_t mPeriod;
+    /** Time of the next step. */
+    int64_t mNextStep;
+    /** Counters of the statistics. */
+    uint64_t mSteps;
+    uint64_t mReversals;
+    /** The number of resets, which tells if one happened while a step was dispatched. */
+    uint32_t mResets;
+    /** The profiler thread, whose mutex protects the outputs. */
+    WorkerThread mWorker;
+};
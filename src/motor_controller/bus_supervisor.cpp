@@ -0,0 +1,192 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <generic_listener.h>
+#include "bus_supervisor.h"
+#include "time_utils.h"
+
+
+BusSupervisor::BusSupervisor()
+: mDevices(),
+  mDeviceCount(0),
+  mRetryDelay(10000000LL),
+  mVerificationPeriod(0),
+  mNextVerified(0),
+  mWoken(false),
+  mWorker()
+{
+}
+
+BusSupervisor::~BusSupervisor()
+{
+    stop();
+}
+
+bool BusSupervisor::addDevice(PCA9685* device)
+{
+    if (mWorker.isRunning() || mDeviceCount >= MAX_DEVICES)
+    {
+        return false;
+    }
+    mDevices[mDeviceCount++] = device;
+    device->setSupervisor(this);
+    return true;
+}
+
+bool BusSupervisor::start()
+{
+    ScopedLock lock(mWorker.getMutex());
+    return mWorker.start(threadBody, this);
+}
+
+void BusSupervisor::stop()
+{
+    mWorker.stop();
+}
+
+void BusSupervisor::notify()
+{
+    ScopedLock lock(mWorker.getMutex());
+    mWoken = true;
+    mWorker.notify();
+}
+
+void BusSupervisor::setRetryDelay(const uint32_t delay)
+{
+    ScopedLock lock(mWorker.getMutex());
+    mRetryDelay = static_cast<int64_t>(delay) * 1000;
+}
+
+void BusSupervisor::setVerificationPeriod(const uint32_t period)
+{
+    mVerificationPeriod.store(static_cast<int64_t>(period) * 1000, std::memory_order_relaxed);
+    // wake the thread up so that it waits with the new period
+    notify();
+}
+
+BusStatistics BusSupervisor::getStatistics() const
+{
+    BusStatistics total = BusStatistics();
+    BusStatistics statistics;
+    for (size_t i = 0; i < mDeviceCount; ++i)
+    {
+        statistics = mDevices[i]->getStatistics();
+        total.mTransactions += statistics.mTransactions;
+        total.mErrors       += statistics.mErrors;
+        total.mRetries      += statistics.mRetries;
+        total.mTimeouts     += statistics.mTimeouts;
+        total.mLostFrames   += statistics.mLostFrames;
+        total.mRecoveries   += statistics.mRecoveries;
+        total.mBusyTime     += statistics.mBusyTime;
+        total.mVerifications += statistics.mVerifications;
+        total.mMismatches    += statistics.mMismatches;
+        total.mDeferredVerifications += statistics.mDeferredVerifications;
+        total.mMaxTransactionTime = (statistics.mMaxTransactionTime > total.mMaxTransactionTime) ?
+                statistics.mMaxTransactionTime : total.mMaxTransactionTime;
+    }
+    return total;
+}
+
+uint32_t BusSupervisor::getFrameCount() const
+{
+    uint32_t count = 0;
+    for (size_t i = 0; i < mDeviceCount; ++i)
+    {
+        count += mDevices[i]->getFrameCount();
+    }
+    return count;
+}
+
+bool BusSupervisor::isWriting() const
+{
+    for (size_t i = 0; i < mDeviceCount; ++i)
+    {
+        if (mDevices[i]->isWriting())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BusSupervisor::threadBody(void* supervisor)
+{
+    static_cast<BusSupervisor*>(supervisor)->run();
+}
+
+void BusSupervisor::run()
+{
+    bool pending = false;
+    bool verify;
+    int64_t period;
+    int64_t deadline;
+
+    while (mWorker.isRunning())
+    {
+        verify = false;
+        if (pending)
+        {
+            // a previous recovery failed, so back off before retrying, requests of other boards are handled afterwards
+            deadline = getMonotonicTime() + mRetryDelay;
+            while (mWorker.isRunning() && getMonotonicTime() < deadline)
+            {
+                mWorker.waitUntil(deadline);
+            }
+        }
+        else if ((period = mVerificationPeriod.load(std::memory_order_relaxed)) > 0)
+        {
+            deadline = getMonotonicTime() + period;
+            while (mWorker.isRunning() && !mWoken && getMonotonicTime() < deadline)
+            {
+                mWorker.waitUntil(deadline);
+            }
+            // nothing to recover for a whole period, so the bus is idle enough for a read-back
+            verify = !mWoken;
+        }
+        else
+        {
+            while (mWorker.isRunning() && !mWoken)
+            {
+                mWorker.wait();
+            }
+        }
+        mWoken = false;
+
+        // the boards request recovery through notify, so they are handled without the mutex
+        pthread_mutex_unlock(&mWorker.getMutex());
+        if (verify && mDeviceCount > 0)
+        {
+            mDevices[mNextVerified]->verifyNextChannel();
+            mNextVerified = (mNextVerified + 1) % mDeviceCount;
+        }
+        pending = false;
+        for (size_t i = 0; mWorker.isRunning() && i < mDeviceCount; ++i)
+        {
+            if (mDevices[i]->isRecoveryPending())
+            {
+                mDevices[i]->recover();
+                pending |= mDevices[i]->isRecoveryPending();
+            }
+        }
+        pthread_mutex_lock(&mWorker.getMutex());
+    }
+}
@@ -0,0 +1,129 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include "pca9685.h"
+#include "worker_thread.h"
+
+
+/**
+ * Performs bus recovery of PCA9685 boards on a background thread, so that escalation after failed
+ * writes never runs on the thread which issues drive commands. Boards request recovery through
+ * notify(), only after a write has failed. Optionally, the same thread periodically reads back channels of the
+ * boards while the bus is idle, and repairs those which do not hold their last commanded values.
+ */
+class BusSupervisor
+{
+public:
+    /** The maximum number of boards handled by a single supervisor. */
+    static constexpr size_t MAX_DEVICES = 4;
+
+    /**
+     * Class constructor, only initialises variables.
+     */
+    BusSupervisor();
+
+    /**
+     * Class destructor, stops the supervisor thread.
+     */
+    virtual ~BusSupervisor();
+
+    /**
+     * Adds a board to supervise and sets this supervisor as its recovery handler.
+     *  @param device the board to supervise.
+     *  @return true if the board was added.
+     */
+    bool addDevice(PCA9685* device);
+
+    /**
+     * Starts the supervisor thread.
+     *  @return true if the thread is running.
+     */
+    bool start();
+
+    /**
+     * Stops the supervisor thread.
+     */
+    void stop();
+
+    /**
+     * Wakes up the supervisor thread. It only holds its mutex while it waits, so the hot path can call this after
+     * a failed write without waiting for a recovery.
+     */
+    void notify();
+
+    /**
+     *  @param delay the delay between consecutive recovery attempts of a board in microseconds.
+     */
+    void setRetryDelay(const uint32_t delay);
+
+    /**
+     * Sets the period of read-back verification. Every period, one commanded channel of the next board is read
+     * back and compared with its last commanded value, unless the bus is busy with a frame of that board.
+     *  @param period the period in microseconds, or 0 to disable the verification.
+     */
+    void setVerificationPeriod(const uint32_t period);
+
+    /**
+     *  @return statistics summed over all supervised boards.
+     */
+    BusStatistics getStatistics() const;
+
+    /**
+     *  @return the number of frames started on all supervised boards, which changes whenever one of them is written.
+     */
+    uint32_t getFrameCount() const;
+
+    /**
+     *  @return true while a frame is being written to any of the supervised boards.
+     */
+    bool isWriting() const;
+
+private:
+    /**
+     * Entry point of the supervisor thread.
+     *  @param supervisor pointer to this class.
+     */
+    static void threadBody(void* supervisor);
+
+    /**
+     * The main loop of the supervisor thread.
+     */
+    void run();
+
+    /** Supervised boards. */
+    PCA9685* mDevices[MAX_DEVICES];
+    /** The number of supervised boards. */
+    size_t mDeviceCount;
+    /** The delay between consecutive recovery attempts in nanoseconds. */
+    int64_t mRetryDelay;
+    /** The period of read-back verification in nanoseconds, 0 if disabled. */
+    std::atomic<int64_t> mVerificationPeriod;
+    /** The board whose channel is verified next. */
+    size_t mNextVerified;
+    /** Flag indicating if the supervisor thread was woken up since it last checked the boards. */
+    bool mWoken;
+    /** The supervisor thread. */
+    WorkerThread mWorker;
+};
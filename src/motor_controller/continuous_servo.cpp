@@ -47,9 +47,9 @@ void ContinuousServo::initialise(const int minPulse, const int maxPulse)
     mDutyRange         = maxDuty - mMinDuty;
 }
 
-void ContinuousServo::setFraction(const float fraction) const
+bool ContinuousServo::setFraction(const float fraction) const
 {
-    mPCA9685->setDutyCycle(mChannel, static_cast<uint16_t>(mMinDuty + fraction * mDutyRange + 0.5f));
+    return mPCA9685->setDutyCycle(mChannel, static_cast<uint16_t>(mMinDuty + fraction * mDutyRange + 0.5f));
 }
 
 float ContinuousServo::getFraction() const
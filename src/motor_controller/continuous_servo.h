@@ -51,10 +51,29 @@ public:
     /**
      * Sets the throttle of the servo.
      *  @param throttle a value from -1 to 1.
+     *  @return true if the throttle was written successfully.
      */
-    inline void setThrottle(const float throttle) const
+    inline bool setThrottle(const float throttle) const
     {
-        setFraction((throttle + 1) / 2);
+        return setFraction((throttle + 1) / 2);
+    }
+
+    /**
+     * Converts throttle into the duty cycle which setThrottle would write, e.g. for deferred writes.
+     *  @param throttle a value from -1 to 1.
+     *  @return a 12-bit duty cycle.
+     */
+    inline uint16_t toDutyCycle(const float throttle) const
+    {
+        return static_cast<uint16_t>(mMinDuty + (throttle + 1) / 2 * mDutyRange + 0.5f);
+    }
+
+    /**
+     *  @return the channel to which this servo is connected.
+     */
+    inline uint8_t getChannel() const
+    {
+        return mChannel;
     }
 
     /**
@@ -69,7 +88,7 @@ private:
     /** Pulse width expressed as fraction between 0.0 (`minPulse`) and 1.0 (`maxPulse`).
         For conventional servos, corresponds to the servo position as a fraction
         of the actuation range. */
-    void setFraction(const float fraction) const;
+    bool setFraction(const float fraction) const;
     float getFraction() const;
 
     /** Pointer to PCA9685 class for PWM control functionality. */
@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <generic_listener.h>
+#include "output_scheduler.h"
+#include "time_utils.h"
+
+
+OutputScheduler::OutputScheduler(const PCA9685* pca9685, pthread_mutex_t* mutex)
+: mPCA9685(pca9685),
+  mMutex(mutex),
+  mValues(),
+  mPending(0),
+  mPeriod(0),
+  mLead(0),
+  mWrites(0),
+  mCoalesced(0),
+  mLateSlots(0),
+  mWorker()
+{
+}
+
+OutputScheduler::~OutputScheduler()
+{
+    stop();
+}
+
+bool OutputScheduler::start(const uint32_t lead, const RealtimeProfile& profile)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (!mWorker.isRunning())
+    {
+        mPeriod = mPCA9685->getPeriod();
+        mLead   = static_cast<int64_t>(lead) * 1000;
+        if (mPeriod <= 2 * mLead)
+        {
+            // the period is too short to gain anything from scheduling, e.g. a 1.6 kHz motor board
+            return false;
+        }
+        mPending.store(0);
+    }
+    return mWorker.start(threadBody, this, profile);
+}
+
+void OutputScheduler::stop()
+{
+    mWorker.stop();
+}
+
+void OutputScheduler::setDutyCycle(const uint8_t channel, const uint16_t value)
+{
+    uint16_t mask = static_cast<uint16_t>(1 << channel);
+    mValues[channel].store(value, std::memory_order_relaxed);
+    uint16_t pending = mPending.fetch_or(mask, std::memory_order_release);
+    if (pending & mask)
+    {
+        mCoalesced.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (0 == pending)
+    {
+        // only the first update after an idle period wakes the thread up, and it holds the mutex only while it waits
+        ScopedLock lock(mWorker.getMutex());
+        mWorker.notify();
+    }
+}
+
+OutputSchedulerStatistics OutputScheduler::getStatistics() const
+{
+    OutputSchedulerStatistics statistics;
+    statistics.mWrites    = mWrites.load(std::memory_order_relaxed);
+    statistics.mCoalesced = mCoalesced.load(std::memory_order_relaxed);
+    statistics.mLateSlots = mLateSlots.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+void OutputScheduler::threadBody(void* scheduler)
+{
+    static_cast<OutputScheduler*>(scheduler)->run();
+}
+
+void OutputScheduler::run()
+{
+    uint32_t restarts = mPCA9685->getRestartCount();
+    int64_t anchor = mPCA9685->getCycleStart();
+    int64_t lastCycle = -1;
+    int64_t cycle;
+    int64_t slot;
+    uint16_t pending;
+    timespec time;
+
+    anchor = (0 != anchor) ? anchor : getMonotonicTime();
+    while (mWorker.isRunning())
+    {
+        if (0 == mPending.load(std::memory_order_acquire))
+        {
+            mWorker.wait();
+            continue;
+        }
+
+        // wake, recover and setFrequency restart the PWM counter, which moves the periods, or changes their length
+        if (restarts != mPCA9685->getRestartCount())
+        {
+            restarts  = mPCA9685->getRestartCount();
+            anchor    = mPCA9685->getCycleStart();
+            mPeriod   = (0 != mPCA9685->getPeriod()) ? mPCA9685->getPeriod() : mPeriod;
+            lastCycle = -1;
+        }
+
+        // the first period which begins at least one lead from now, but never the same period twice
+        cycle = (getMonotonicTime() + mLead - anchor) / mPeriod + 1;
+        cycle = (cycle > lastCycle) ? cycle : lastCycle + 1;
+        slot  = anchor + cycle * mPeriod - mLead;
+        time  = toTimespec(slot);
+        // the absolute timer is more precise than a timed wait, and the writes take the mutex of the board instead
+        pthread_mutex_unlock(&mWorker.getMutex());
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr))
+        {
+            ;
+        }
+        if (getMonotonicTime() - slot > mLead)
+        {
+            mLateSlots.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        lastCycle = cycle;
+        pending = mPending.exchange(0, std::memory_order_acquire);
+        pthread_mutex_lock(mMutex);
+        for (uint8_t channel = 0; pending; ++channel, pending >>= 1)
+        {
+            if (pending & 1)
+            {
+                mPCA9685->setDutyCycle(channel, mValues[channel].load(std::memory_order_relaxed));
+                mWrites.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        pthread_mutex_unlock(mMutex);
+        pthread_mutex_lock(&mWorker.getMutex());
+    }
+}
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include "pca9685.h"
+#include "realtime_profile.h"
+#include "worker_thread.h"
+
+
+/**
+ * Statistics of an output scheduler.
+ */
+struct OutputSchedulerStatistics
+{
+    /** The number of channel writes issued. */
+    uint64_t mWrites;
+    /** The number of updates which replaced a value before it was written. */
+    uint64_t mCoalesced;
+    /** The number of write slots in which the thread woke up after the PWM period had already begun. */
+    uint64_t mLateSlots;
+};
+
+/**
+ * Writes channels of a slow PCA9685 (e.g. a 50 Hz servo board) at most once per PWM period, just before the
+ * next period begins. Servos sample the pulse width only once per period, so writing every update wastes bus
+ * time, and a write in the middle of a period takes effect only with the next pulse anyway. Updates are stored
+ * lock-free, and the latest value of each channel is written in the next slot. The phase of the PWM counter is
+ * estimated from the time of its last restart (see PCA9685::getCycleStart). The thread sleeps while there is
+ * nothing to write.
+ */
+class OutputScheduler
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     *  @param pca9685 the board whose channels are scheduled.
+     *  @param mutex the mutex which guards writes to @p pca9685, locked for every write.
+     */
+    OutputScheduler(const PCA9685* pca9685, pthread_mutex_t* mutex);
+
+    /**
+     * Class destructor, stops the scheduler thread.
+     */
+    virtual ~OutputScheduler();
+
+    /**
+     * Starts the scheduler thread. The board must have its frequency configured.
+     *  @param lead how long before the next PWM period the writes start, in microseconds.
+     *  @param profile real-time profile of the scheduler thread.
+     *  @return true if the thread is running, false if the period is too short for scheduling.
+     */
+    bool start(const uint32_t lead = 1500, const RealtimeProfile& profile = RealtimeProfile());
+
+    /**
+     * Stops the scheduler thread. Values which were not written yet are discarded.
+     */
+    void stop();
+
+    /**
+     *  @return true if the scheduler thread is running.
+     */
+    inline bool isRunning() const
+    {
+        return mWorker.isRunning();
+    }
+
+    /**
+     * Applies a new real-time profile to the scheduler thread if it is running. The next start uses the profile
+     * passed to start.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    inline bool setRealtimeProfile(const RealtimeProfile& profile)
+    {
+        return mWorker.setProfile(profile);
+    }
+
+    /**
+     * Schedules a new duty cycle of a channel. Safe to call from the hot path, only the first update after the
+     * thread went idle takes its mutex to wake it up.
+     *  @param channel the channel to write (0-15).
+     *  @param value a 12-bit duty cycle.
+     */
+    void setDutyCycle(const uint8_t channel, const uint16_t value);
+
+    /**
+     *  @return statistics of the scheduler.
+     */
+    OutputSchedulerStatistics getStatistics() const;
+
+private:
+    /**
+     * Entry point of the scheduler thread.
+     *  @param scheduler pointer to this class.
+     */
+    static void threadBody(void* scheduler);
+
+    /**
+     * The main loop of the scheduler thread.
+     */
+    void run();
+
+    /** The board whose channels are scheduled. */
+    const PCA9685* mPCA9685;
+    /** The mutex which guards writes to the board. */
+    pthread_mutex_t* mMutex;
+    /** Latest duty cycles of channels. */
+    std::atomic<uint16_t> mValues[PCA9685_CHANNELS];
+    /** Bit mask of channels with values waiting to be written. */
+    std::atomic<uint16_t> mPending;
+    /** The PWM period in nanoseconds. */
+    int64_t mPeriod;
+    /** The lead of writes before the next period in nanoseconds. */
+    int64_t mLead;
+    /** Counters of the statistics. */
+    std::atomic<uint64_t> mWrites;
+    std::atomic<uint64_t> mCoalesced;
+    std::atomic<uint64_t> mLateSlots;
+    /** The scheduler thread, which waits on its condition variable while it is idle. */
+    WorkerThread mWorker;
+};
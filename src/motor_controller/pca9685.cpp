@@ -22,7 +22,13 @@
 
 #include <unistd.h>
 #include <i2c.h>
+#include "bus_supervisor.h"
+#include "logger.h"
+#include "metrics.h"
 #include "pca9685.h"
+#include "profiler.h"
+#include "time_utils.h"
+#include "trace.h"
 
 #define MODE1              0x00
 #define MODE2              0x01
@@ -50,43 +56,106 @@ static constexpr float REFERENCE_CLK_SPEED_SCALED = static_cast<float>(25000000.
 
 PCA9685::PCA9685(const I2C* i2c, const uint8_t deviceAddress) 
 : mI2C(i2c), 
-  mDeviceAddress(deviceAddress)
+  mDeviceAddress(deviceAddress),
+  mSupervisor(nullptr),
+  mMaxRetries(2),
+  mTimeout(2000000LL),
+  mShadow(),
+  mCommandedChannels(0),
+  mDirtyChannels(0),
+  mMode(0),
+  mPrescale(0),
+  mCycleStart(0),
+  mRestarts(0),
+  mFramesStarted(0),
+  mFramesFinished(0),
+  mNextVerified(0),
+  mAsleep(false),
+  mRecoveryPending(false),
+  mTransactions(0),
+  mErrors(0),
+  mRetries(0),
+  mTimeouts(0),
+  mLostFrames(0),
+  mRecoveries(0),
+  mMaxTransactionTime(0),
+  mBusyTime(0),
+  mVerifications(0),
+  mMismatches(0),
+  mDeferredVerifications(0)
 {
 }
 
 PCA9685::~PCA9685()
 {
-    mI2C->writeByte(mDeviceAddress, ALL_LED_ON_L , 0);
-    mI2C->writeByte(mDeviceAddress, ALL_LED_ON_H , 0);
-    mI2C->writeByte(mDeviceAddress, ALL_LED_OFF_L, 0);
-    mI2C->writeByte(mDeviceAddress, ALL_LED_OFF_H, 0x10);
+    writeRegister(ALL_LED_ON_L , 0);
+    writeRegister(ALL_LED_ON_H , 0);
+    writeRegister(ALL_LED_OFF_L, 0);
+    writeRegister(ALL_LED_OFF_H, 0x10);
     reset();
 }
 
-void PCA9685::reset() const
+bool PCA9685::reset() const
 {
-    mI2C->writeByte(mDeviceAddress, MODE1, 0);
+    mMode.store(0, std::memory_order_relaxed);
+    mAsleep.store(false, std::memory_order_relaxed);
+    return writeRegister(MODE1, 0);
 }
 
 float PCA9685::getFrequency() const
 {
-    return REFERENCE_CLK_SPEED_SCALED / static_cast<float>(mI2C->readByte(mDeviceAddress, PRESCALE));
+    return REFERENCE_CLK_SPEED_SCALED / static_cast<float>(readRegister(PRESCALE));
 }
 
-void PCA9685::setFrequency(const float frequency) const
+int64_t PCA9685::getPeriod() const
 {
+    uint8_t prescale = mPrescale.load(std::memory_order_relaxed);
+    // the counter advances with every prescale + 1 oscillator clocks
+    return (0 == prescale) ? 0 : static_cast<int64_t>(static_cast<float>(prescale + 1) * NS_IN_SECOND / REFERENCE_CLK_SPEED_SCALED);
+}
+
+bool PCA9685::setFrequency(const float frequency) const
+{
+    bool flag = false;
     uint8_t prescale = static_cast<uint8_t>(REFERENCE_CLK_SPEED_SCALED / frequency + 0.5f) - 1;
     if (prescale >= 3)
     {
-        uint8_t oldMode = mI2C->readByte(mDeviceAddress, MODE1); // Mode 1
-        mI2C->writeByte(mDeviceAddress, MODE1, (oldMode & 0x7F) | SLEEP); // Mode 1, sleep
-        mI2C->writeByte(mDeviceAddress, PRESCALE, prescale); // Prescale
-        mI2C->writeByte(mDeviceAddress, MODE1, oldMode); // Mode 1
+        uint8_t oldMode = readRegister(MODE1); // Mode 1
+        flag  = writeRegister(MODE1, (oldMode & 0x7F) | SLEEP); // Mode 1, sleep
+        flag &= writeRegister(PRESCALE, prescale); // Prescale
+        flag &= writeRegister(MODE1, oldMode); // Mode 1
 
         usleep(5000);
         // Mode 1, autoincrement on, fix to stop pca9685 from accepting commands at all addresses
-        mI2C->writeByte(mDeviceAddress, MODE1, oldMode | RESTART | AUTO_INCR);
+        flag &= writeRegister(MODE1, oldMode | RESTART | AUTO_INCR);
+        mMode.store((oldMode & ~RESTART) | AUTO_INCR, std::memory_order_relaxed);
+        mPrescale.store(prescale, std::memory_order_relaxed);
+        recordRestart();
     }
+    return flag;
+}
+
+bool PCA9685::sleep() const
+{
+    mAsleep.store(true, std::memory_order_relaxed);
+    return writeRegister(MODE1, mMode.load(std::memory_order_relaxed) | SLEEP);
+}
+
+bool PCA9685::wake() const
+{
+    uint8_t mode = mMode.load(std::memory_order_relaxed);
+    bool flag = writeRegister(MODE1, mode);
+    // the oscillator needs at most 500 us to stabilise before the PWM channels can be restarted
+    usleep(500);
+    flag &= writeRegister(MODE1, mode | RESTART);
+    recordRestart();
+    mAsleep.store(false, std::memory_order_relaxed);
+    if (!flag)
+    {
+        // recovery restores the mode and re-sends all channels, which also wakes the board up
+        requestRecovery();
+    }
+    return flag;
 }
 
 uint16_t PCA9685::getDutyCycle(const uint8_t channel) const
@@ -96,22 +165,279 @@ uint16_t PCA9685::getDutyCycle(const uint8_t channel) const
     return (on == 0x1000) ? on : off;
 }
 
+void PCA9685::setRetryPolicy(const uint8_t maxRetries, const uint32_t timeout)
+{
+    mMaxRetries = maxRetries;
+    mTimeout = static_cast<int64_t>(timeout) * 1000;
+}
+
+void PCA9685::setSupervisor(BusSupervisor* supervisor)
+{
+    mSupervisor = supervisor;
+}
+
+bool PCA9685::recover() const
+{
+    bool flag = true;
+    uint8_t mode = mMode.load(std::memory_order_relaxed) | (mAsleep.load(std::memory_order_relaxed) ? SLEEP : 0);
+    uint8_t prescale = mPrescale.load(std::memory_order_relaxed);
+    uint16_t channels = mCommandedChannels.load(std::memory_order_acquire);
+    uint32_t value;
+
+    mRecoveryPending.store(false, std::memory_order_release);
+    mRecoveries.fetch_add(1, std::memory_order_relaxed);
+    if (prescale >= 3 && readRegister(PRESCALE) != prescale)
+    {
+        // the board has been reset, e.g. by a brownout, so restore its configuration as in setFrequency
+        flag &= writeRegister(MODE1, (mode & 0x7F) | SLEEP);
+        flag &= writeRegister(PRESCALE, prescale);
+        flag &= writeRegister(MODE1, mode);
+        usleep(5000);
+        flag &= writeRegister(MODE1, mode | RESTART);
+        recordRestart();
+    }
+    else
+    {
+        flag &= writeRegister(MODE1, mode);
+    }
+
+    for (uint8_t channel = 0; flag && channel < PCA9685_CHANNELS; ++channel)
+    {
+        if (channels & (1 << channel))
+        {
+            // the hot path may update the channel concurrently, so repeat until the written frame is the latest one
+            do
+            {
+                mFramesStarted.fetch_add(1);
+                value = mShadow[channel].load(std::memory_order_acquire);
+                flag &= writeChannels(channel);
+            } while (flag && value != mShadow[channel].load(std::memory_order_acquire));
+        }
+    }
+
+    if (!flag)
+    {
+        // keep the board flagged so that the supervisor retries later
+        mRecoveryPending.store(true, std::memory_order_release);
+        LOG_ERROR("PCA9685 0x%02x: recovery failed", mDeviceAddress);
+    }
+    else
+    {
+        LOG_INFO("PCA9685 0x%02x: recovered, channels 0x%04x re-sent", mDeviceAddress, channels);
+    }
+    return flag;
+}
+
+bool PCA9685::verifyNextChannel() const
+{
+    uint16_t channels = mCommandedChannels.load(std::memory_order_acquire);
+    uint8_t prescale = mPrescale.load(std::memory_order_relaxed);
+    uint8_t channel = mNextVerified;
+    uint8_t offset;
+    uint32_t expected, actual, started;
+
+    if (0 == channels || mAsleep.load(std::memory_order_relaxed) || mRecoveryPending.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+    while (0 == (channels & (1 << channel)))
+    {
+        channel = (channel + 1) % PCA9685_CHANNELS;
+    }
+
+    // the hot path counts a frame as started before it updates the shadow, so a frame which has not been written
+    // yet is either seen in flight here, or changes the counter before the read-back completes; the counter is
+    // loaded first, so a shadow updated by a frame counted after it is caught by the check after the read-back
+    started = mFramesStarted.load();
+    expected = mShadow[channel].load();
+    if (started != mFramesFinished.load())
+    {
+        mDeferredVerifications.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    offset = 4 * channel;
+    actual = (static_cast<uint32_t>(readRegister(LED0_ON_H  + offset)) << 24) |
+             (static_cast<uint32_t>(readRegister(LED0_ON_L  + offset)) << 16) |
+             (static_cast<uint32_t>(readRegister(LED0_OFF_H + offset)) << 8)  |
+              static_cast<uint32_t>(readRegister(LED0_OFF_L + offset));
+    if (started != mFramesStarted.load())
+    {
+        mDeferredVerifications.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    mNextVerified = (channel + 1) % PCA9685_CHANNELS;
+    mVerifications.fetch_add(1, std::memory_order_relaxed);
+    if (actual != expected)
+    {
+        mMismatches.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARNING("PCA9685 0x%02x: channel %u holds 0x%08x instead of 0x%08x", mDeviceAddress, channel, actual, expected);
+        if (prescale >= 3 && readRegister(PRESCALE) != prescale)
+        {
+            // the whole board has been reset, so restore its configuration and all channels
+            requestRecovery();
+        }
+        else
+        {
+            mFramesStarted.fetch_add(1);
+            writeChannels(channel);
+        }
+    }
+    return true;
+}
+
+BusStatistics PCA9685::getStatistics() const
+{
+    BusStatistics statistics;
+    statistics.mTransactions       = mTransactions.load(std::memory_order_relaxed);
+    statistics.mErrors             = mErrors.load(std::memory_order_relaxed);
+    statistics.mRetries            = mRetries.load(std::memory_order_relaxed);
+    statistics.mTimeouts           = mTimeouts.load(std::memory_order_relaxed);
+    statistics.mLostFrames         = mLostFrames.load(std::memory_order_relaxed);
+    statistics.mRecoveries         = mRecoveries.load(std::memory_order_relaxed);
+    statistics.mMaxTransactionTime = mMaxTransactionTime.load(std::memory_order_relaxed);
+    statistics.mBusyTime           = mBusyTime.load(std::memory_order_relaxed);
+    statistics.mVerifications      = mVerifications.load(std::memory_order_relaxed);
+    statistics.mMismatches         = mMismatches.load(std::memory_order_relaxed);
+    statistics.mDeferredVerifications = mDeferredVerifications.load(std::memory_order_relaxed);
+    return statistics;
+}
+
 void PCA9685::getPWM(const uint8_t channel, uint16_t& on, uint16_t& off) const
 {
     uint8_t channelOffset = 4 * channel;
-    uint8_t on_l  = mI2C->readByte(mDeviceAddress, LED0_ON_L  + channelOffset);
-    uint8_t on_h  = mI2C->readByte(mDeviceAddress, LED0_ON_H  + channelOffset);
-    uint8_t off_l = mI2C->readByte(mDeviceAddress, LED0_OFF_L + channelOffset);
-    uint8_t off_h = mI2C->readByte(mDeviceAddress, LED0_OFF_H + channelOffset);
-    on  = (static_cast<uint16_t>(on_h)  << 8) & on_l;
-    off = (static_cast<uint16_t>(off_h) << 8) & off_l;
+    uint8_t on_l  = readRegister(LED0_ON_L  + channelOffset);
+    uint8_t on_h  = readRegister(LED0_ON_H  + channelOffset);
+    uint8_t off_l = readRegister(LED0_OFF_L + channelOffset);
+    uint8_t off_h = readRegister(LED0_OFF_H + channelOffset);
+    on  = (static_cast<uint16_t>(on_h)  << 8) | on_l;
+    off = (static_cast<uint16_t>(off_h) << 8) | off_l;
 }
 
-void PCA9685::setPWM(const uint8_t channel, const uint16_t on, const uint16_t off) const
+bool PCA9685::setDutyCycles(const uint8_t channel, const uint16_t* values, const uint8_t count) const
 {
-    uint8_t channelOffset = 4 * channel;
-    mI2C->writeByte(mDeviceAddress, LED0_ON_L  + channelOffset, on  &  0xFF);
-    mI2C->writeByte(mDeviceAddress, LED0_ON_H  + channelOffset, on  >>  8);
-    mI2C->writeByte(mDeviceAddress, LED0_OFF_L + channelOffset, off &  0xFF);
-    mI2C->writeByte(mDeviceAddress, LED0_OFF_H + channelOffset, off >>  8);
+    TRACE_SPAN("PCA9685::setDutyCycles");
+    PROFILE_STAGE(STAGE_SET_PWM);
+    // count the frame before updating the shadow, so that the verifier never takes the old registers for a mismatch
+    mFramesStarted.fetch_add(1);
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        mShadow[channel + i].store(values[i] & 0x0FFF, std::memory_order_release);
+    }
+    mCommandedChannels.fetch_or(static_cast<uint16_t>(((1 << count) - 1) << channel), std::memory_order_release);
+    return writeChannels(channel, count);
+}
+
+bool PCA9685::setPWM(const uint8_t channel, const uint16_t on, const uint16_t off) const
+{
+    TRACE_SPAN("PCA9685::setPWM");
+    PROFILE_STAGE(STAGE_SET_PWM);
+    // count the frame before updating the shadow, so that the verifier never takes the old registers for a mismatch
+    mFramesStarted.fetch_add(1);
+    mShadow[channel].store((static_cast<uint32_t>(on) << 16) | off, std::memory_order_release);
+    mCommandedChannels.fetch_or(1 << channel, std::memory_order_release);
+    return writeChannels(channel);
+}
+
+bool PCA9685::writeChannels(const uint8_t channel, const uint8_t count) const
+{
+    uint8_t frame[4 * PCA9685_CHANNELS];
+    uint16_t mask = static_cast<uint16_t>(((1 << count) - 1) << channel);
+    uint32_t value;
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        value = mShadow[channel + i].load(std::memory_order_acquire);
+        frame[4 * i]     = static_cast<uint8_t>((value >> 16) & 0xFF);
+        frame[4 * i + 1] = static_cast<uint8_t>(value >> 24);
+        frame[4 * i + 2] = static_cast<uint8_t>( value        & 0xFF);
+        frame[4 * i + 3] = static_cast<uint8_t>((value >> 8) & 0xFF);
+    }
+    int64_t deadline = getMonotonicTime() + mTimeout;
+    bool flag = writeRegisters(LED0_ON_L + 4 * channel, frame, 4 * count);
+
+    // always re-send the full frame, a partially written channel may hold an arbitrary mix of old and new counts
+    for (uint8_t retry = 0; !flag && retry < mMaxRetries && getMonotonicTime() < deadline; ++retry)
+    {
+        mRetries.fetch_add(1, std::memory_order_relaxed);
+        flag = writeRegisters(LED0_ON_L + 4 * channel, frame, 4 * count);
+    }
+
+    if (flag)
+    {
+        mDirtyChannels.fetch_and(~mask, std::memory_order_relaxed);
+    }
+    else
+    {
+        mDirtyChannels.fetch_or(mask, std::memory_order_relaxed);
+        mLostFrames.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARNING("PCA9685 0x%02x: lost frame of channels %u to %u", mDeviceAddress, channel, channel + count - 1);
+        requestRecovery();
+    }
+    mFramesFinished.fetch_add(1, std::memory_order_release);
+    return flag;
+}
+
+bool PCA9685::writeRegisters(const uint8_t reg, const uint8_t* data, const uint8_t length) const
+{
+    bool flag = true;
+    uint8_t written = 0;
+    int64_t start = getMonotonicTime();
+    for (; flag && written < length; ++written)
+    {
+        flag = mI2C->writeByte(mDeviceAddress, reg + written, data[written]);
+    }
+    int64_t duration = getMonotonicTime() - start;
+    int64_t maxDuration = mMaxTransactionTime.load(std::memory_order_relaxed);
+
+    Metrics::getInstance().i2cTransaction(mDeviceAddress, written, flag);
+    mTransactions.fetch_add(1, std::memory_order_relaxed);
+    mBusyTime.fetch_add(duration, std::memory_order_relaxed);
+    if (!flag)
+    {
+        mErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (duration > mTimeout)
+    {
+        mTimeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+    while (duration > maxDuration && !mMaxTransactionTime.compare_exchange_weak(maxDuration, duration, std::memory_order_relaxed))
+    {
+        ;
+    }
+    return flag;
+}
+
+bool PCA9685::writeRegister(const uint8_t reg, const uint8_t value) const
+{
+    int64_t deadline = getMonotonicTime() + mTimeout;
+    bool flag = writeRegisters(reg, &value, 1);
+    for (uint8_t retry = 0; !flag && retry < mMaxRetries && getMonotonicTime() < deadline; ++retry)
+    {
+        mRetries.fetch_add(1, std::memory_order_relaxed);
+        flag = writeRegisters(reg, &value, 1);
+    }
+    return flag;
+}
+
+uint8_t PCA9685::readRegister(const uint8_t reg) const
+{
+    int64_t start = getMonotonicTime();
+    uint8_t value = mI2C->readByte(mDeviceAddress, reg);
+    mBusyTime.fetch_add(getMonotonicTime() - start, std::memory_order_relaxed);
+    Metrics::getInstance().i2cTransaction(mDeviceAddress, 1, true);
+    return value;
+}
+
+void PCA9685::requestRecovery() const
+{
+    if (!mRecoveryPending.exchange(true, std::memory_order_acq_rel) && nullptr != mSupervisor)
+    {
+        mSupervisor->notify();
+    }
+}
+
+void PCA9685::recordRestart() const
+{
+    mCycleStart.store(getMonotonicTime(), std::memory_order_relaxed);
+    mRestarts.fetch_add(1, std::memory_order_release);
 }
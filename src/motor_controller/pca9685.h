@@ -22,10 +22,44 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
+class BusSupervisor;
 class I2C;
 
+/** The number of PWM channels of PCA9685. */
+static constexpr uint8_t PCA9685_CHANNELS = 16;
+
+/**
+ * Error and timing counters of I2C transactions issued by a PCA9685 object.
+ */
+struct BusStatistics
+{
+    /** The number of register transactions attempted. */
+    uint32_t mTransactions;
+    /** The number of transactions which failed. */
+    uint32_t mErrors;
+    /** The number of transactions which were retried after a failure. */
+    uint32_t mRetries;
+    /** The number of transactions which took longer than the timeout. */
+    uint32_t mTimeouts;
+    /** The number of frames which could not be written within the retry budget. */
+    uint32_t mLostFrames;
+    /** The number of bus recoveries performed. */
+    uint32_t mRecoveries;
+    /** The longest transaction time in nanoseconds. */
+    int64_t mMaxTransactionTime;
+    /** The total time the bus was busy with transactions in nanoseconds. */
+    int64_t mBusyTime;
+    /** The number of channels read back and compared with their last commanded values. */
+    uint32_t mVerifications;
+    /** The number of read-back channels which did not hold their last commanded values. */
+    uint32_t mMismatches;
+    /** The number of read-backs discarded because a frame was written at the same time. */
+    uint32_t mDeferredVerifications;
+};
+
 class PCA9685
 {
 public:
@@ -43,19 +77,66 @@ public:
 
     /**
      * Resets PCA9685.
+     *  @return true if the reset was written successfully.
      */
-    void reset() const;
+    bool reset() const;
 
     /**
      *  @return the frequency of PCA9685 in Hz.
      */
     float getFrequency() const;
 
+    /**
+     *  @return the PWM period configured with setFrequency in nanoseconds, 0 if the frequency was not set.
+     */
+    int64_t getPeriod() const;
+
+    /**
+     *  @return the time at which the PWM counter was last restarted by this class in nanoseconds, 0 if never.
+     *  Together with getPeriod, it estimates when the next PWM period begins.
+     */
+    inline int64_t getCycleStart() const
+    {
+        return mCycleStart.load(std::memory_order_relaxed);
+    }
+
+    /**
+     *  @return the number of restarts of the PWM counter by setFrequency, wake and recover, which changes whenever
+     *  getCycleStart or getPeriod may have changed.
+     */
+    inline uint32_t getRestartCount() const
+    {
+        return mRestarts.load(std::memory_order_acquire);
+    }
+
     /**
      * Sets new frequency to PCA9685.
      *  @param frequency new frequency in Hz.
+     *  @return true if the new frequency was written successfully.
+     */
+    bool setFrequency(const float frequency) const;
+
+    /**
+     * Puts the oscillator to sleep with a single write, which turns all outputs off while keeping the
+     * channel registers. Writes to the channels are still accepted and take effect after wake.
+     *  @return true if the mode was written successfully.
+     */
+    bool sleep() const;
+
+    /**
+     * Wakes the oscillator up and restarts the PWM channels with their previous values. Takes about
+     * 0.5 ms because the oscillator needs to stabilise before the restart.
+     *  @return true if the mode was written successfully.
      */
-    void setFrequency(const float frequency) const;
+    bool wake() const;
+
+    /**
+     *  @return true if the board was put to sleep with sleep().
+     */
+    inline bool isAsleep() const
+    {
+        return mAsleep.load(std::memory_order_relaxed);
+    }
 
     /** 
      * 12 bit value that dictates how much of one cycle is high (1) versus low (0). 0x0FFF will
@@ -63,12 +144,23 @@ public:
      * if aiming for controlling the pins as GPIO, use the other method.
      *  @param channel the channel to control (0-15).
      *  @param value ratio of how much of the tick should start with high state.
+     *  @return true if the channel was written successfully.
      */
-    inline void setDutyCycle(const uint8_t channel, const uint16_t value) const
+    inline bool setDutyCycle(const uint8_t channel, const uint16_t value) const
     {
-        setPWM(channel, 0, value & 0x0FFF);
+        return setPWM(channel, 0, value & 0x0FFF);
     }
 
+    /**
+     * Sets duty cycles of consecutive channels, which are written in a single register transaction, so that
+     * all of them change in the same PWM period.
+     *  @param channel the first channel to control (0-15).
+     *  @param values 12-bit duty cycles of the channels.
+     *  @param count the number of channels, @p channel + @p count must not exceed 16.
+     *  @return true if the channels were written successfully.
+     */
+    bool setDutyCycles(const uint8_t channel, const uint16_t* values, const uint8_t count) const;
+
     /**
      * Returns the current duty cycle for a given @p channel.
      *  @param channel the channel to query (0-15).
@@ -80,10 +172,78 @@ public:
      * Sets a pin to be either fully on or fully off. 
      *  @param channel the channel to control (0-15).
      *  @param on true to set the @p channel full on.
+     *  @return true if the channel was written successfully.
+     */
+    inline bool setGPIO(const uint8_t channel, const bool on) const
+    {
+        return setPWM(channel, 0x1000 * on, 0x1000 * !on);
+    }
+
+    /**
+     * Sets the retry policy of register writes. A frame is retried at most @p maxRetries times, and
+     * no new attempt is started once @p timeout has elapsed since the first one.
+     *  @param maxRetries the maximum number of retries of a failed frame.
+     *  @param timeout the time budget of a frame, including retries, in microseconds.
+     */
+    void setRetryPolicy(const uint8_t maxRetries, const uint32_t timeout);
+
+    /**
+     * Sets the supervisor which performs bus recovery when a frame could not be written.
+     *  @param supervisor the bus supervisor, or nullptr to disable recovery.
+     */
+    void setSupervisor(BusSupervisor* supervisor);
+
+    /**
+     *  @return true if this board is waiting for bus recovery.
      */
-    inline void setGPIO(const uint8_t channel, const bool on) const
+    inline bool isRecoveryPending() const
     {
-        setPWM(channel, 0x1000 * on, 0x1000 * !on);
+        return mRecoveryPending.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Recovers the board after failed writes: restores MODE1 and the prescaler if the board was reset,
+     * and re-sends full frames of all commanded channels. Must not be called from the hot path.
+     *  @return true if the board was fully restored.
+     */
+    bool recover() const;
+
+    /**
+     * Reads back the registers of the next commanded channel, in round-robin order, and compares them with the
+     * last commanded value. A mismatched channel is re-written, or the board is flagged for recovery if it has
+     * been reset. The read-back is discarded if any frame is written at the same time, so command writes never
+     * wait for it beyond a single register transfer. Must not be called from the hot path.
+     *  @return true if a channel was compared, false if there was nothing to verify or the read-back was deferred.
+     */
+    bool verifyNextChannel() const;
+
+    /**
+     *  @return the number of frames started, which changes whenever a frame is written to this board.
+     */
+    inline uint32_t getFrameCount() const
+    {
+        return mFramesStarted.load(std::memory_order_relaxed);
+    }
+
+    /**
+     *  @return true while a frame is being written to this board.
+     */
+    inline bool isWriting() const
+    {
+        return mFramesStarted.load() != mFramesFinished.load();
+    }
+
+    /**
+     *  @return error and timing counters of this board.
+     */
+    BusStatistics getStatistics() const;
+
+    /**
+     *  @return the address of this PCA9685.
+     */
+    inline uint8_t getDeviceAddress() const
+    {
+        return mDeviceAddress;
     }
 
 private:
@@ -100,11 +260,96 @@ private:
      *  @param channel PCA9685's channel which should be modified.
      *  @param on a count when the PWM duty cycle should be set to ON.
      *  @param off a count when the PWM duty cycle should be set to OFF.
+     *  @return true if the channel was written successfully.
+     */
+    bool setPWM(const uint8_t channel, const uint16_t on, const uint16_t off) const;
+
+    /**
+     * Writes the full frames of consecutive channels (ON and OFF registers) from the shadow registers in one
+     * transaction, retrying according to the retry policy. Marks the channels as dirty and requests recovery
+     * on failure. The caller must count the frame in mFramesStarted first, the frame is counted as finished here.
+     *  @param channel the first channel to write.
+     *  @param count the number of channels to write.
+     *  @return true if the frame was written successfully.
+     */
+    bool writeChannels(const uint8_t channel, const uint8_t count = 1) const;
+
+    /**
+     * Writes consecutive registers in a single attempt, stopping at the first failed byte.
+     *  @param reg the first register to write.
+     *  @param data values of the registers.
+     *  @param length the number of registers to write.
+     *  @return true if all registers were written successfully.
+     */
+    bool writeRegisters(const uint8_t reg, const uint8_t* data, const uint8_t length) const;
+
+    /**
+     * Writes a single register with the retry policy. Used for configuration registers.
+     *  @param reg the register to write.
+     *  @param value the new value of the register.
+     *  @return true if the register was written successfully.
+     */
+    bool writeRegister(const uint8_t reg, const uint8_t value) const;
+
+    /**
+     * Reads a single register.
+     *  @param reg the register to read.
+     *  @return the value of the register.
+     */
+    uint8_t readRegister(const uint8_t reg) const;
+
+    /**
+     * Flags the board for recovery and wakes up the supervisor.
+     */
+    void requestRecovery() const;
+
+    /**
+     * Records a restart of the PWM counter, which begins a new PWM period.
      */
-    void setPWM(const uint8_t channel, const uint16_t on, const uint16_t off) const;
+    void recordRestart() const;
 
     /** Pointer to the class handling I2C communication. */
     const I2C* mI2C;
     /** The address of this PCA9685. */
     const uint8_t mDeviceAddress;
+    /** The supervisor which performs bus recovery. */
+    BusSupervisor* mSupervisor;
+    /** The maximum number of retries of a failed frame. */
+    uint8_t mMaxRetries;
+    /** The time budget of a frame in nanoseconds. */
+    int64_t mTimeout;
+    /** Last commanded ON (upper 16 bits) and OFF (lower 16 bits) counts of every channel. */
+    mutable std::atomic<uint32_t> mShadow[PCA9685_CHANNELS];
+    /** Bit mask of channels which have been commanded. */
+    mutable std::atomic<uint16_t> mCommandedChannels;
+    /** Bit mask of channels whose last frame was not written successfully. */
+    mutable std::atomic<uint16_t> mDirtyChannels;
+    /** The MODE1 value which this class last configured. */
+    mutable std::atomic<uint8_t> mMode;
+    /** The prescaler value which this class last configured, 0 if never configured. */
+    mutable std::atomic<uint8_t> mPrescale;
+    /** The time of the last restart of the PWM counter in nanoseconds, and the number of restarts. */
+    mutable std::atomic<int64_t> mCycleStart;
+    mutable std::atomic<uint32_t> mRestarts;
+    /** The number of frames started and finished, which tell the verifier if a frame was written meanwhile. */
+    mutable std::atomic<uint32_t> mFramesStarted;
+    mutable std::atomic<uint32_t> mFramesFinished;
+    /** The next channel to verify, only used by the verifying thread. */
+    mutable uint8_t mNextVerified;
+    /** True if the board was put to sleep. */
+    mutable std::atomic<bool> mAsleep;
+    /** Flag indicating if the board is waiting for bus recovery. */
+    mutable std::atomic<bool> mRecoveryPending;
+    /** Counters of the statistics. */
+    mutable std::atomic<uint32_t> mTransactions;
+    mutable std::atomic<uint32_t> mErrors;
+    mutable std::atomic<uint32_t> mRetries;
+    mutable std::atomic<uint32_t> mTimeouts;
+    mutable std::atomic<uint32_t> mLostFrames;
+    mutable std::atomic<uint32_t> mRecoveries;
+    mutable std::atomic<int64_t> mMaxTransactionTime;
+    mutable std::atomic<int64_t> mBusyTime;
+    mutable std::atomic<uint32_t> mVerifications;
+    mutable std::atomic<uint32_t> mMismatches;
+    mutable std::atomic<uint32_t> mDeferredVerifications;
 };
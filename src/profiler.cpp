@@ -0,0 +1,215 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef JETRACER_PROFILE
+
+#include <atomic>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <vector>
+#include "profiler.h"
+#include "time_utils.h"
+
+namespace
+{
+
+/** The number of counters opened with perf_event_open. */
+constexpr int PERF_COUNTERS = ProfileSample::WALL_TIME;
+
+/** Names of stages. */
+const char* const STAGE_NAMES[PROFILE_STAGES] = {"GamepadDriveAdapter::update", "command application", "mixing", "PCA9685::setPWM"};
+/** Names of counters. */
+const char* const COUNTER_NAMES[ProfileSample::COUNTERS] = {"cycles", "instructions", "cache-misses", "context-switches",
+                                                            "wall-ns", "cpu-ns"};
+
+/**
+ * Counters of the stages of a single thread, written only by the owning thread.
+ */
+struct ProfileBuffer
+{
+    /** The number of calls of each stage. */
+    std::atomic<uint64_t> mCalls[PROFILE_STAGES];
+    /** Totals of counters of each stage. */
+    std::atomic<uint64_t> mTotals[PROFILE_STAGES][ProfileSample::COUNTERS];
+    /** File descriptor of the leader of the counter group, -1 if no counter is available. */
+    int mLeader;
+    /** Positions of counters in a group read, -1 for counters which are not available. */
+    int mPositions[PERF_COUNTERS];
+    /** The number of counters in the group. */
+    int mOpened;
+    /** Kernel ID of the owning thread. */
+    long mThreadId;
+    /** Name of the owning thread. */
+    char mThreadName[16];
+};
+
+/** Buffers of all threads which have been profiled. Buffers are never freed, so results of finished threads can be dumped. */
+std::vector<ProfileBuffer*> gBuffers;
+/** Mutex protecting the list of buffers, taken only once per thread and during dump. */
+pthread_mutex_t gBuffersMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Buffer of the calling thread. */
+thread_local ProfileBuffer* tBuffer = nullptr;
+
+/**
+ * Opens a counter of the calling thread.
+ *  @param type the type of the counter.
+ *  @param config the counter.
+ *  @param leader the group leader, or -1 to open a new group.
+ *  @return the file descriptor of the counter, or -1 if it is not available.
+ */
+int openCounter(const uint32_t type, const uint64_t config, const int leader)
+{
+    perf_event_attr attr = perf_event_attr();
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    // user space only, which is allowed with the default perf_event_paranoid on L4T
+    attr.exclude_kernel = (PERF_TYPE_SOFTWARE == type) ? 0 : 1;
+    attr.exclude_hv     = 1;
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+    if (fd < 0 && PERF_TYPE_SOFTWARE == type)
+    {
+        attr.exclude_kernel = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+    }
+    return fd;
+}
+
+/**
+ *  @return the buffer of the calling thread, allocated with its counters on first use.
+ */
+ProfileBuffer* getBuffer()
+{
+    static const uint32_t types[PERF_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const uint64_t configs[PERF_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES};
+    int fd;
+
+    if (nullptr == tBuffer)
+    {
+        tBuffer = new ProfileBuffer();
+        tBuffer->mLeader = -1;
+        tBuffer->mOpened = 0;
+        for (int counter = 0; counter < PERF_COUNTERS; ++counter)
+        {
+            // counters which cannot be opened or joined to the group are skipped
+            fd = openCounter(types[counter], configs[counter], tBuffer->mLeader);
+            tBuffer->mPositions[counter] = (fd < 0) ? -1 : tBuffer->mOpened++;
+            tBuffer->mLeader = (tBuffer->mLeader < 0) ? fd : tBuffer->mLeader;
+        }
+        tBuffer->mThreadId = syscall(SYS_gettid);
+        if (0 != pthread_getname_np(pthread_self(), tBuffer->mThreadName, sizeof(tBuffer->mThreadName)))
+        {
+            snprintf(tBuffer->mThreadName, sizeof(tBuffer->mThreadName), "%ld", tBuffer->mThreadId);
+        }
+        pthread_mutex_lock(&gBuffersMutex);
+        gBuffers.push_back(tBuffer);
+        pthread_mutex_unlock(&gBuffersMutex);
+    }
+    return tBuffer;
+}
+
+} // namespace
+
+void Profiler::sample(ProfileSample& sample)
+{
+    ProfileBuffer* buffer = getBuffer();
+    uint64_t values[1 + PERF_COUNTERS] = {0};
+    timespec time;
+
+    if (buffer->mLeader >= 0 && read(buffer->mLeader, values, sizeof(values)) <= 0)
+    {
+        values[0] = 0;
+    }
+    for (int counter = 0; counter < PERF_COUNTERS; ++counter)
+    {
+        int position = buffer->mPositions[counter];
+        sample.mValues[counter] = (position >= 0 && static_cast<uint64_t>(position) < values[0]) ? values[1 + position] : 0;
+    }
+    sample.mValues[ProfileSample::WALL_TIME] = static_cast<uint64_t>(getMonotonicTime());
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    sample.mValues[ProfileSample::CPU_TIME] = static_cast<uint64_t>(time.tv_sec) * NS_IN_SECOND + time.tv_nsec;
+}
+
+void Profiler::accumulate(const ProfileStage stage, const ProfileSample& start, const ProfileSample& end)
+{
+    ProfileBuffer* buffer = getBuffer();
+    buffer->mCalls[stage].store(buffer->mCalls[stage].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    for (int counter = 0; counter < ProfileSample::COUNTERS; ++counter)
+    {
+        std::atomic<uint64_t>& total = buffer->mTotals[stage][counter];
+        total.store(total.load(std::memory_order_relaxed) + end.mValues[counter] - start.mValues[counter], std::memory_order_relaxed);
+    }
+}
+
+bool Profiler::dump(FILE* file)
+{
+    uint64_t calls;
+    uint64_t total;
+
+    if (nullptr == file)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&gBuffersMutex);
+    for (ProfileBuffer* buffer : gBuffers)
+    {
+        fprintf(file, "thread %ld (%s), counters:", buffer->mThreadId, buffer->mThreadName);
+        for (int counter = 0; counter < ProfileSample::COUNTERS; ++counter)
+        {
+            if (counter >= PERF_COUNTERS || buffer->mPositions[counter] >= 0)
+            {
+                fprintf(file, " %s", COUNTER_NAMES[counter]);
+            }
+        }
+        fputc('\n', file);
+
+        for (int stage = 0; stage < PROFILE_STAGES; ++stage)
+        {
+            calls = buffer->mCalls[stage].load(std::memory_order_relaxed);
+            if (0 == calls)
+            {
+                continue;
+            }
+            fprintf(file, "  %-28s calls %-10llu", STAGE_NAMES[stage], static_cast<unsigned long long>(calls));
+            for (int counter = 0; counter < ProfileSample::COUNTERS; ++counter)
+            {
+                if (counter >= PERF_COUNTERS || buffer->mPositions[counter] >= 0)
+                {
+                    total = buffer->mTotals[stage][counter].load(std::memory_order_relaxed);
+                    fprintf(file, " %s %llu (%.1f/call)", COUNTER_NAMES[counter], static_cast<unsigned long long>(total),
+                            static_cast<double>(total) / static_cast<double>(calls));
+                }
+            }
+            fputc('\n', file);
+        }
+    }
+    pthread_mutex_unlock(&gBuffersMutex);
+    return 0 == fflush(file);
+}
+
+#endif
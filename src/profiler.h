@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+/**
+ * Optional sampling of hardware performance counters around control-path stages. Enabled by building with
+ * -DJETRACER_PROFILE=ON, otherwise all macros expand to nothing and no profiling code is compiled.
+ *
+ * Each thread opens its counters with perf_event_open when it first enters a stage. Counters which are not
+ * available (e.g. no PMU access, or a restrictive /proc/sys/kernel/perf_event_paranoid) are skipped, and
+ * calls, wall time and thread CPU time are collected in any case.
+ *
+ *  PROFILE_STAGE(stage)  counts from this point until the end of the enclosing scope towards @p stage.
+ *  PROFILE_DUMP(file)    writes per-thread results to FILE* @p file.
+ */
+
+/**
+ * Profiled stages of the control path. Stages nest, so the counts of a stage include the stages it calls.
+ */
+enum ProfileStage
+{
+    STAGE_GAMEPAD_ADAPTER,
+    STAGE_COMMAND_APPLY,
+    STAGE_MIXING,
+    STAGE_SET_PWM,
+    PROFILE_STAGES
+};
+
+#ifdef JETRACER_PROFILE
+
+#include <cstdint>
+#include <cstdio>
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_STAGE(stage) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(stage)
+#define PROFILE_DUMP(file) Profiler::dump(file)
+
+/**
+ * Counters sampled at the boundaries of a stage.
+ */
+struct ProfileSample
+{
+    /** Indices of counters in the sample. */
+    enum Counter
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        CONTEXT_SWITCHES,
+        WALL_TIME,
+        CPU_TIME,
+        COUNTERS
+    };
+
+    /** Values of the counters. */
+    uint64_t mValues[COUNTERS];
+};
+
+/**
+ * Collects counters per thread and per stage.
+ */
+class Profiler
+{
+public:
+    /**
+     * Samples the counters of the calling thread, opening them on first use.
+     *  @param[out] sample the current values of the counters.
+     */
+    static void sample(ProfileSample& sample);
+
+    /**
+     * Adds the difference of two samples to a stage of the calling thread.
+     *  @param stage the stage.
+     *  @param start the sample taken when the stage was entered.
+     *  @param end the sample taken when the stage was left.
+     */
+    static void accumulate(const ProfileStage stage, const ProfileSample& start, const ProfileSample& end);
+
+    /**
+     * Writes totals and per-call averages of all threads and stages, and which counters are available.
+     *  @param file the stream to write to.
+     *  @return true if the results were written.
+     */
+    static bool dump(FILE* file);
+};
+
+/**
+ * Counts from construction until destruction towards a stage.
+ */
+class ProfileScope
+{
+public:
+    /**
+     * Enters the stage.
+     *  @param stage the stage.
+     */
+    explicit ProfileScope(const ProfileStage stage) : mStage(stage)
+    {
+        Profiler::sample(mStart);
+    }
+
+    /**
+     * Leaves the stage.
+     */
+    ~ProfileScope()
+    {
+        ProfileSample end;
+        Profiler::sample(end);
+        Profiler::accumulate(mStage, mStart, end);
+    }
+
+private:
+    /** The stage. */
+    ProfileStage mStage;
+    /** The sample taken when the stage was entered. */
+    ProfileSample mStart;
+};
+
+#else
+
+#define PROFILE_STAGE(stage)
+#define PROFILE_DUMP(file) false
+
+#endif
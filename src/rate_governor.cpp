@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include "metrics.h"
+#include "rate_governor.h"
+#include "time_utils.h"
+#include "motor_controller/bus_supervisor.h"
+
+/** The rate is re-selected from measurements over windows of this length in nanoseconds. */
+static constexpr int64_t MEASUREMENT_WINDOW = 250000000LL;
+
+/** True while the governor thread applies a held command, which must not be held again. */
+static thread_local bool tDispatching = false;
+
+
+RateGovernor::RateGovernor(GenericListener<DriveCommands>* target, const BusSupervisor* supervisor)
+: mTarget(target),
+  mSupervisor(supervisor),
+  mTargetUtilisation(0.0f),
+  mMinRate(0.0f),
+  mMaxRate(0.0f),
+  mInterval(0),
+  mNextSlot(0),
+  mAdmitted(0),
+  mCoalesced(0),
+  mUtilisation(0.0f),
+  mCommandTime(0),
+  mWindowStart(0),
+  mWindowBusyTime(0),
+  mWindowAdmitted(0),
+  mHeldCommand(),
+  mHeld(false),
+  mWorker()
+{
+}
+
+RateGovernor::~RateGovernor()
+{
+    stop();
+}
+
+bool RateGovernor::start(const float utilisation, const float minRate, const float maxRate, const RealtimeProfile& profile)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (utilisation <= 0.0f || minRate <= 0.0f || maxRate < minRate)
+    {
+        return false;
+    }
+
+    mTargetUtilisation = std::min(utilisation, 1.0f);
+    mMinRate  = minRate;
+    mMaxRate  = maxRate;
+    mInterval = static_cast<int64_t>(NS_IN_SECOND / maxRate);
+    mWindowStart    = getMonotonicTime();
+    mWindowBusyTime = mSupervisor->getStatistics().mBusyTime;
+    mWindowAdmitted = mAdmitted;
+    return mWorker.start(threadBody, this, profile);
+}
+
+void RateGovernor::stop()
+{
+    mWorker.stop();
+    ScopedLock lock(mWorker.getMutex());
+    mHeld = false;
+}
+
+bool RateGovernor::admit(const DriveCommands& driveCommands)
+{
+    if (!mWorker.isRunning() || tDispatching)
+    {
+        return true;
+    }
+
+    int64_t now = getMonotonicTime();
+    ScopedLock lock(mWorker.getMutex());
+    measure(now);
+    if (mHeld || now < mNextSlot)
+    {
+        // only the latest command matters, so a newer one replaces the held one
+        mCoalesced += mHeld ? 1 : 0;
+        mHeldCommand = driveCommands;
+        if (!mHeld)
+        {
+            mHeld = true;
+            mWorker.notify();
+        }
+        return false;
+    }
+    mNextSlot = now + mInterval;
+    ++mAdmitted;
+    return true;
+}
+
+RateStatistics RateGovernor::getStatistics() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    RateStatistics statistics;
+    statistics.mRate        = (0 == mInterval) ? 0.0f : static_cast<float>(NS_IN_SECOND) / static_cast<float>(mInterval);
+    statistics.mUtilisation = mUtilisation;
+    statistics.mCommandTime = mCommandTime;
+    statistics.mCoalesced   = mCoalesced;
+    return statistics;
+}
+
+void RateGovernor::threadBody(void* governor)
+{
+    static_cast<RateGovernor*>(governor)->run();
+}
+
+void RateGovernor::run()
+{
+    DriveCommands driveCommands;
+    int64_t now;
+
+    while (mWorker.isRunning())
+    {
+        if (!mHeld)
+        {
+            mWorker.wait();
+            continue;
+        }
+
+        now = getMonotonicTime();
+        if (now < mNextSlot)
+        {
+            mWorker.waitUntil(mNextSlot);
+            continue;
+        }
+
+        measure(now);
+        driveCommands = mHeldCommand;
+        mHeld = false;
+        mNextSlot = now + mInterval;
+        ++mAdmitted;
+        pthread_mutex_unlock(&mWorker.getMutex());
+
+        tDispatching = true;
+        mTarget->update(driveCommands);
+        tDispatching = false;
+        pthread_mutex_lock(&mWorker.getMutex());
+    }
+}
+
+void RateGovernor::measure(const int64_t now)
+{
+    int64_t elapsed = now - mWindowStart;
+    if (elapsed < MEASUREMENT_WINDOW)
+    {
+        return;
+    }
+
+    int64_t busyTime = mSupervisor->getStatistics().mBusyTime;
+    int64_t busy = busyTime - mWindowBusyTime;
+    uint64_t admitted = mAdmitted - mWindowAdmitted;
+    float rate;
+
+    mUtilisation = static_cast<float>(busy) / static_cast<float>(elapsed);
+    if (admitted > 0 && busy > 0)
+    {
+        // all bus time is attributed to commands, so recoveries and other writes lower the rate as well
+        mCommandTime = busy / static_cast<int64_t>(admitted);
+        rate = mTargetUtilisation * static_cast<float>(NS_IN_SECOND) / static_cast<float>(mCommandTime);
+        rate = std::max(mMinRate, std::min(mMaxRate, rate));
+        mInterval = static_cast<int64_t>(NS_IN_SECOND / rate);
+    }
+    Metrics::getInstance().rateSelected(static_cast<float>(NS_IN_SECOND) / static_cast<float>(mInterval), mUtilisation);
+
+    mWindowStart    = now;
+    mWindowBusyTime = busyTime;
+    mWindowAdmitted = mAdmitted;
+}
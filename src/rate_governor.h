@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <generic_listener.h>
+#include "drive_commands.h"
+#include "realtime_profile.h"
+#include "worker_thread.h"
+
+class BusSupervisor;
+
+/**
+ * Statistics of a rate governor.
+ */
+struct RateStatistics
+{
+    /** The selected maximum rate of applied commands in Hz. */
+    float mRate;
+    /** Measured bus utilisation, the fraction of time the bus was busy. */
+    float mUtilisation;
+    /** Measured bus time per applied command in nanoseconds. */
+    int64_t mCommandTime;
+    /** The number of commands which were replaced by a newer one before their slot. */
+    uint64_t mCoalesced;
+};
+
+/**
+ * Limits the rate at which drive commands are applied, so that the bus utilisation stays under a target. The bus
+ * time of every transaction is measured by the PCA9685 boards, and the rate is re-selected from the measured bus
+ * time per command. Commands arriving before their slot are held, and only the latest one is applied when the slot
+ * opens, by a thread which sleeps while nothing is held.
+ */
+class RateGovernor
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     *  @param target the listener which applies commands, normally the robot.
+     *  @param supervisor the supervisor of all boards written by @p target, used for the bus time.
+     */
+    RateGovernor(GenericListener<DriveCommands>* target, const BusSupervisor* supervisor);
+
+    /**
+     * Class destructor, stops the governor thread.
+     */
+    virtual ~RateGovernor();
+
+    /**
+     * Starts governing, or changes its parameters if already started.
+     *  @param utilisation the target bus utilisation, from 0 to 1.
+     *  @param minRate the lowest rate which can be selected in Hz.
+     *  @param maxRate the highest rate which can be selected in Hz, also the initial rate.
+     *  @param profile real-time profile of the governor thread.
+     *  @return true if the governor is running.
+     */
+    bool start(const float utilisation, const float minRate, const float maxRate, const RealtimeProfile& profile = RealtimeProfile());
+
+    /**
+     * Stops governing, held commands are discarded.
+     */
+    void stop();
+
+    /**
+     * Applies a new real-time profile to the governor thread if it is running.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    inline bool setRealtimeProfile(const RealtimeProfile& profile)
+    {
+        return mWorker.setProfile(profile);
+    }
+
+    /**
+     * Decides whether a command can be applied now. Commands which cannot are held and applied later.
+     *  @param driveCommands the command.
+     *  @return true if the command should be applied now, false if it was held.
+     */
+    bool admit(const DriveCommands& driveCommands);
+
+    /**
+     *  @return statistics of the governor.
+     */
+    RateStatistics getStatistics() const;
+
+private:
+    /**
+     * Body of the governor thread.
+     *  @param governor pointer to this class.
+     */
+    static void threadBody(void* governor);
+
+    /**
+     * The main loop of the governor thread, called with the mutex locked.
+     */
+    void run();
+
+    /**
+     * Re-selects the rate if the measurement window has elapsed. Must be called with the mutex locked.
+     *  @param now current time in nanoseconds.
+     */
+    void measure(const int64_t now);
+
+    /** The listener which applies commands. */
+    GenericListener<DriveCommands>* mTarget;
+    /** The supervisor of the boards. */
+    const BusSupervisor* mSupervisor;
+    /** Target bus utilisation. */
+    float mTargetUtilisation;
+    /** Limits of the rate in Hz. */
+    float mMinRate;
+    float mMaxRate;
+    /** Minimum interval between applied commands in nanoseconds. */
+    int64_t mInterval;
+    /** The earliest time at which the next command can be applied. */
+    int64_t mNextSlot;
+    /** The number of admitted commands. */
+    uint64_t mAdmitted;
+    /** The number of coalesced commands. */
+    uint64_t mCoalesced;
+    /** Measured utilisation and bus time per command. */
+    float mUtilisation;
+    int64_t mCommandTime;
+    /** Start of the current measurement window, with the bus time and admitted commands at that moment. */
+    int64_t mWindowStart;
+    int64_t mWindowBusyTime;
+    uint64_t mWindowAdmitted;
+    /** The held command. */
+    DriveCommands mHeldCommand;
+    /** True if a command is held. */
+    bool mHeld;
+    /** The governor thread, whose mutex protects the held command and the measurement. */
+    WorkerThread mWorker;
+};
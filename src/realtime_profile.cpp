@@ -0,0 +1,183 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <alloca.h>
+#include <cerrno>
+#include <cstdlib>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "realtime_profile.h"
+#include "time_utils.h"
+
+
+bool RealtimeProfile::applyToCurrentThread() const
+{
+    bool flag = true;
+    if (mPriority > 0)
+    {
+        sched_param param;
+        param.sched_priority = mPriority;
+        flag &= (0 == pthread_setschedparam(pthread_self(), SCHED_FIFO, &param));
+    }
+    if (mCpu >= 0)
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(mCpu, &cpuSet);
+        flag &= (0 == pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet));
+    }
+    if (isEnabled())
+    {
+        prefaultStack(mStackPrefault);
+    }
+    return flag;
+}
+
+bool RealtimeProfile::applyToThread(const pthread_t thread) const
+{
+    sched_param param;
+    cpu_set_t cpuSet;
+    bool flag;
+
+    param.sched_priority = std::max(mPriority, 0);
+    flag = (0 == pthread_setschedparam(thread, (mPriority > 0) ? SCHED_FIFO : SCHED_OTHER, &param));
+    CPU_ZERO(&cpuSet);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        // the kernel restricts the set to the CPUs which are available to the process
+        if (mCpu < 0 || cpu == mCpu)
+        {
+            CPU_SET(cpu, &cpuSet);
+        }
+    }
+    flag &= (0 == pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet));
+    return flag;
+}
+
+bool RealtimeProfile::lockMemory() const
+{
+    if (!mLockMemory)
+    {
+        return true;
+    }
+    if (0 != mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        return false;
+    }
+
+    // keep freed memory in the heap and avoid mmap so that prefaulted pages are reused
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mHeapPrefault > 0)
+    {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        volatile char* heap = static_cast<volatile char*>(malloc(mHeapPrefault));
+        if (nullptr != heap)
+        {
+            for (size_t i = 0; i < mHeapPrefault; i += pageSize)
+            {
+                heap[i] = 0;
+            }
+            free(const_cast<char*>(heap));
+        }
+    }
+    return true;
+}
+
+bool RealtimeProfile::unlockMemory()
+{
+    // the defaults of glibc
+    mallopt(M_TRIM_THRESHOLD, 128 * 1024);
+    mallopt(M_MMAP_MAX, 65536);
+    return 0 == munlockall();
+}
+
+void RealtimeProfile::prefaultStack(const size_t size)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    volatile char* stack = static_cast<volatile char*>(alloca(size));
+    for (size_t i = 0; i < size; i += pageSize)
+    {
+        stack[i] = 0;
+    }
+}
+
+WakeupJitter RealtimeProfile::measureWakeupJitter(const uint32_t iterations, const uint32_t period)
+{
+    WakeupJitter jitter;
+    int64_t deadline = getMonotonicTime();
+    timespec time;
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        deadline += static_cast<int64_t>(period) * 1000;
+        time = toTimespec(deadline);
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr))
+        {
+            ;
+        }
+        jitter.add(getMonotonicTime() - deadline);
+    }
+    return jitter;
+}
+
+/**
+ * Parameters and result of a jitter measurement on its own thread.
+ */
+struct JitterMeasurement
+{
+    /** The profile of the thread. */
+    const RealtimeProfile* mProfile;
+    /** The number of wake-ups and the period between them in microseconds. */
+    uint32_t mIterations;
+    uint32_t mPeriod;
+    /** The measured jitter. */
+    WakeupJitter mJitter;
+};
+
+/**
+ * Entry point of the measuring thread.
+ *  @param measurement pointer to the JitterMeasurement.
+ */
+static void* measureJitter(void* measurement)
+{
+    JitterMeasurement* data = static_cast<JitterMeasurement*>(measurement);
+    data->mProfile->applyToCurrentThread();
+    data->mJitter = RealtimeProfile::measureWakeupJitter(data->mIterations, data->mPeriod);
+    return nullptr;
+}
+
+WakeupJitter RealtimeProfile::measureThreadJitter(const uint32_t iterations, const uint32_t period) const
+{
+    JitterMeasurement measurement = {this, iterations, period, WakeupJitter()};
+    pthread_t thread;
+
+    if (0 == pthread_create(&thread, nullptr, measureJitter, &measurement))
+    {
+        pthread_join(thread, nullptr);
+    }
+    return measurement.mJitter;
+}
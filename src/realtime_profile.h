@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+
+/**
+ * Statistics of thread wake-up lateness with respect to absolute deadlines, in nanoseconds.
+ */
+struct WakeupJitter
+{
+    /** The number of measured wake-ups. */
+    uint32_t mSamples;
+    /** The minimum lateness of a wake-up. */
+    int64_t mMinLateness;
+    /** The maximum lateness of a wake-up. */
+    int64_t mMaxLateness;
+    /** The sum of lateness of all wake-ups. */
+    int64_t mTotalLateness;
+
+    /**
+     * Basic constructor that initialises all values with zeros.
+     */
+    WakeupJitter() : mSamples(0), mMinLateness(0), mMaxLateness(0), mTotalLateness(0) {};
+
+    /**
+     * Adds a new measurement.
+     *  @param lateness wake-up lateness in nanoseconds.
+     */
+    inline void add(const int64_t lateness)
+    {
+        mMinLateness = (0 == mSamples || lateness < mMinLateness) ? lateness : mMinLateness;
+        mMaxLateness = (0 == mSamples || lateness > mMaxLateness) ? lateness : mMaxLateness;
+        mTotalLateness += lateness;
+        ++mSamples;
+    }
+};
+
+/**
+ * An opt-in real-time execution profile for threads which write to the I2C bus. By default all
+ * values keep the standard Linux scheduling, so applying a default profile is a no-op.
+ */
+struct RealtimeProfile
+{
+    /** SCHED_FIFO priority from 1 to 99, or 0 to keep the default scheduling policy. */
+    int mPriority;
+    /** The CPU to which the thread should be pinned, or -1 for no pinning. */
+    int mCpu;
+    /** Flag indicating if all current and future process memory should be locked and the heap prefaulted. */
+    bool mLockMemory;
+    /** The number of bytes of the thread stack to prefault. */
+    size_t mStackPrefault;
+    /** The number of bytes of heap to prefault when locking memory. */
+    size_t mHeapPrefault;
+
+    /**
+     * Basic constructor.
+     *  @param priority SCHED_FIFO priority, or 0 for default scheduling.
+     *  @param cpu the CPU to pin to, or -1 for no pinning.
+     *  @param lockMemory true to lock and prefault memory.
+     *  @param stackPrefault the number of bytes of the thread stack to prefault.
+     *  @param heapPrefault the number of bytes of heap to prefault.
+     */
+    RealtimeProfile(const int priority = 0, const int cpu = -1, const bool lockMemory = false,
+                    const size_t stackPrefault = 64 * 1024, const size_t heapPrefault = 1024 * 1024)
+      : mPriority(priority), mCpu(cpu), mLockMemory(lockMemory), mStackPrefault(stackPrefault), mHeapPrefault(heapPrefault) {};
+
+    /**
+     *  @return true if the profile changes anything compared to the default scheduling.
+     */
+    inline bool isEnabled() const
+    {
+        return mPriority > 0 || mCpu >= 0 || mLockMemory;
+    }
+
+    /**
+     * Applies the scheduling policy and CPU affinity to the calling thread and prefaults its stack.
+     *  @return true if all requested settings were applied.
+     */
+    bool applyToCurrentThread() const;
+
+    /**
+     * Applies the scheduling policy and CPU affinity to a running thread, which may carry a previous profile. Unlike
+     * applyToCurrentThread, default values are applied too: SCHED_OTHER without a priority, and all CPUs without
+     * pinning. The stack of the thread is not prefaulted.
+     *  @param thread the thread.
+     *  @return true if all settings were applied.
+     */
+    bool applyToThread(const pthread_t thread) const;
+
+    /**
+     * Locks all current and future pages of the process, disables heap trimming and prefaults the heap.
+     *  @return true if the memory was locked.
+     */
+    bool lockMemory() const;
+
+    /**
+     * Reverts lockMemory: unlocks the pages of the process and restores the default heap trimming.
+     *  @return true if the memory was unlocked.
+     */
+    static bool unlockMemory();
+
+    /**
+     * Touches @p size bytes of the calling thread's stack so that later use does not cause page faults.
+     *  @param size the number of bytes to prefault.
+     */
+    static void prefaultStack(const size_t size);
+
+    /**
+     * Measures wake-up lateness of the calling thread sleeping with an absolute timer.
+     *  @param iterations the number of wake-ups to measure.
+     *  @param period the period between wake-ups in microseconds.
+     *  @return wake-up jitter statistics.
+     */
+    static WakeupJitter measureWakeupJitter(const uint32_t iterations = 1000, const uint32_t period = 1000);
+
+    /**
+     * Measures wake-up lateness on a new thread with this profile applied, which is what the threads using the
+     * profile experience, whether or not they are busy. Blocks for @p iterations times @p period.
+     *  @param iterations the number of wake-ups to measure.
+     *  @param period the period between wake-ups in microseconds.
+     *  @return wake-up jitter statistics, empty if the thread could not be started.
+     */
+    WakeupJitter measureThreadJitter(const uint32_t iterations = 1000, const uint32_t period = 1000) const;
+};
@@ -20,10 +20,61 @@
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cmath>
 #include <generic_talker.h>
 #include "abstract_robot_base.h"
+#include "logger.h"
+#include "metrics.h"
+#include "time_utils.h"
 
+/**
+ * @return process CPU time in nanoseconds.
+ */
+static int64_t getProcessCpuTime()
+{
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<int64_t>(time.tv_sec) * NS_IN_SECOND + time.tv_nsec;
+}
+
+/**
+ * Creates an optional subsystem when it is first enabled, so that robots which never enable it do not carry it.
+ *  @param subsystem the subsystem, read without locking by the hot path.
+ *  @param mutex mutex serialising the creation.
+ *  @param args arguments of the constructor of the subsystem.
+ *  @return the subsystem.
+ */
+template <typename T, typename... Args>
+static T* getOrCreate(std::atomic<T*>& subsystem, pthread_mutex_t& mutex, Args... args)
+{
+    T* instance = subsystem.load();
+    if (nullptr == instance)
+    {
+        ScopedLock lock(mutex);
+        instance = subsystem.load();
+        if (nullptr == instance)
+        {
+            instance = new T(args...);
+            subsystem.store(instance);
+        }
+    }
+    return instance;
+}
+
+/**
+ * Stops the thread of an optional subsystem, if it was created.
+ *  @param subsystem the subsystem.
+ */
+template <typename T>
+static void stopSubsystem(const std::atomic<T*>& subsystem)
+{
+    T* instance = subsystem.load();
+    if (nullptr != instance)
+    {
+        instance->stop();
+    }
+}
 
 ARobotBase::ARobotBase(const char* name, const float steeringGain, const float steeringOffset, const float throttleGain)
 : mName(name),
@@ -32,17 +83,54 @@ ARobotBase::ARobotBase(const char* name, const float steeringGain, const float s
   mSteeringGain(steeringGain),
   mSteeringOffset(steeringOffset),
   mThrottleGain(throttleGain),
+  mBusSupervisor(),
   mI2C(),
-  mThrottlePCA(&mI2C, PCA9685_ADDRESS_2)
+  mThrottlePCA(&mI2C, PCA9685_ADDRESS_2),
+  mMaxCommandAge(0),
+  mAppliedCommands(0),
+  mStaleCommands(0),
+  mLastCommandAge(0),
+  mMaxAppliedAge(0),
+  mTotalCommandAge(0),
+  mIdleTimeout(0),
+  mLastActivity(0),
+  mIdle(false),
+  mCreated(getMonotonicTime()),
+  mCreatedCpuTime(getProcessCpuTime()),
+  mIdleSince(0),
+  mIdleCpuSince(0),
+  mIdleEntries(0),
+  mWakeups(0),
+  mSkippedCommands(0),
+  mWrittenCommands(0),
+  mLastWakeLatency(0),
+  mMaxWakeLatency(0),
+  mIdleTime(0),
+  mIdleCpuTime(0),
+  mIdleMonitor(),
+  mTrajectoryExecutor(this),
+  mRateGovernor(nullptr),
+  mWatchdog(nullptr),
+  mMotionProfiler(nullptr),
+  mCommandSubmitter(nullptr),
+  mAuxiliaryBus(nullptr)
 {
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(&mMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    mBusSupervisor.addDevice(&mThrottlePCA);
 }
 
 ARobotBase::~ARobotBase()
 {
+    stopBackgroundThreads();
+    delete mRateGovernor.load();
+    delete mWatchdog.load();
+    delete mMotionProfiler.load();
+    delete mCommandSubmitter.load();
+    delete mAuxiliaryBus.load();
     pthread_mutex_destroy(&mMutex);
 }
 
@@ -53,8 +141,9 @@ bool ARobotBase::initialise(const char* devicePath)
     {
         mThrottlePCA.reset();
         mThrottlePCA.setFrequency(1600);
-        return true;
+        return mBusSupervisor.start();
     }
+    LOG_ERROR("%s: failed to open the I2C device", mName);
     return false;
 }
 
@@ -106,6 +195,500 @@ void ARobotBase::setThrottleGain(const float throttleGain)
     mThrottleGain = clip(throttleGain);
 }
 
+bool ARobotBase::executeTrajectory(const TrajectorySample* samples, const size_t count, const bool interpolate)
+{
+    return mTrajectoryExecutor.execute(samples, count, interpolate);
+}
+
+void ARobotBase::cancelTrajectory()
+{
+    mTrajectoryExecutor.cancel();
+}
+
+bool ARobotBase::isTrajectoryRunning() const
+{
+    return mTrajectoryExecutor.isRunning();
+}
+
+TrajectoryStatistics ARobotBase::getTrajectoryStatistics() const
+{
+    return mTrajectoryExecutor.getStatistics();
+}
+
+bool ARobotBase::setRealtimeProfile(const RealtimeProfile& profile)
+{
+    bool flag = true;
+    {
+        ScopedLock lock(mMutex);
+        if (mRealtimeProfile.mLockMemory && !profile.mLockMemory)
+        {
+            flag &= RealtimeProfile::unlockMemory();
+        }
+        mRealtimeProfile = profile;
+        flag &= profile.lockMemory();
+    }
+    // subsystems created from now on start with the new profile, the running ones switch to it
+    return applyRealtimeProfile(profile) && flag;
+}
+
+bool ARobotBase::applyRealtimeProfile(const RealtimeProfile& profile)
+{
+    bool flag = true;
+    RateGovernor* governor = mRateGovernor.load();
+    MotionProfiler* profiler = mMotionProfiler.load();
+    Watchdog* watchdog = mWatchdog.load();
+    CommandSubmitter* submitter = mCommandSubmitter.load();
+
+    flag &= mTrajectoryExecutor.setRealtimeProfile(profile);
+    flag &= (nullptr == governor) || governor->setRealtimeProfile(profile);
+    flag &= (nullptr == profiler) || profiler->setRealtimeProfile(profile);
+    flag &= (nullptr == watchdog) || watchdog->setRealtimeProfile(profile);
+    flag &= (nullptr == submitter) || submitter->setRealtimeProfile(profile);
+    // the auxiliary bus keeps its idle priority, so that it never competes with the control path
+    return flag;
+}
+
+RealtimeProfile ARobotBase::getRealtimeProfile() const
+{
+    ScopedLock lock(mMutex);
+    return mRealtimeProfile;
+}
+
+WakeupJitter ARobotBase::getWakeupJitter() const
+{
+    return mTrajectoryExecutor.getWakeupJitter();
+}
+
+WakeupJitter ARobotBase::measureWakeupJitter(const uint32_t iterations, const uint32_t period) const
+{
+    return getRealtimeProfile().measureThreadJitter(iterations, period);
+}
+
+BusStatistics ARobotBase::getBusStatistics() const
+{
+    return mBusSupervisor.getStatistics();
+}
+
+void ARobotBase::setVerificationPeriod(const uint32_t period)
+{
+    mBusSupervisor.setVerificationPeriod(period);
+}
+
+void ARobotBase::setMaxCommandAge(const uint32_t maxAge)
+{
+    mMaxCommandAge.store(static_cast<int64_t>(maxAge) * 1000, std::memory_order_relaxed);
+}
+
+uint32_t ARobotBase::getMaxCommandAge() const
+{
+    return static_cast<uint32_t>(mMaxCommandAge.load(std::memory_order_relaxed) / 1000);
+}
+
+CommandAgeStatistics ARobotBase::getCommandAgeStatistics() const
+{
+    CommandAgeStatistics statistics;
+    statistics.mApplied  = mAppliedCommands.load(std::memory_order_relaxed);
+    statistics.mStale    = mStaleCommands.load(std::memory_order_relaxed);
+    statistics.mLastAge  = mLastCommandAge.load(std::memory_order_relaxed);
+    statistics.mMaxAge   = mMaxAppliedAge.load(std::memory_order_relaxed);
+    statistics.mTotalAge = mTotalCommandAge.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+bool ARobotBase::setBusUtilisationTarget(const float utilisation, const float minRate, const float maxRate)
+{
+    if (utilisation <= 0.0f)
+    {
+        stopSubsystem(mRateGovernor);
+        return true;
+    }
+    RateGovernor* governor = getOrCreate(mRateGovernor, mMutex, this, &mBusSupervisor);
+    return governor->start(utilisation, minRate, maxRate, getRealtimeProfile());
+}
+
+RateStatistics ARobotBase::getRateStatistics() const
+{
+    RateGovernor* governor = mRateGovernor.load();
+    return (nullptr == governor) ? RateStatistics() : governor->getStatistics();
+}
+
+bool ARobotBase::setIdleTimeout(const uint32_t timeout)
+{
+    ScopedLock lock(mIdleMonitor.getMutex());
+    mIdleTimeout.store(static_cast<int64_t>(timeout) * 1000000, std::memory_order_relaxed);
+    mLastActivity.store(getMonotonicTime());
+    mIdleMonitor.notify();
+    // the thread stays parked while the idle mode is disabled
+    return (0 == timeout) || mIdleMonitor.start(idleThreadBody, this);
+}
+
+uint32_t ARobotBase::getIdleTimeout() const
+{
+    return static_cast<uint32_t>(mIdleTimeout.load(std::memory_order_relaxed) / 1000000);
+}
+
+IdleStatistics ARobotBase::getIdleStatistics() const
+{
+    ScopedLock lock(mMutex);
+    IdleStatistics statistics;
+    int64_t now        = getMonotonicTime();
+    int64_t cpuTime    = getProcessCpuTime() - mCreatedCpuTime;
+    int64_t idleTime   = mIdleTime.load(std::memory_order_relaxed);
+    int64_t idleCpu    = mIdleCpuTime.load(std::memory_order_relaxed);
+    uint64_t written   = mWrittenCommands.load(std::memory_order_relaxed);
+    if (mIdle.load())
+    {
+        idleTime += now - mIdleSince;
+        idleCpu  += getProcessCpuTime() - mIdleCpuSince;
+    }
+    int64_t activeTime = now - mCreated - idleTime;
+    int64_t activeCpu  = cpuTime - idleCpu;
+
+    statistics.mEntries           = mIdleEntries.load(std::memory_order_relaxed);
+    statistics.mWakeups           = mWakeups.load(std::memory_order_relaxed);
+    statistics.mSkippedCommands   = mSkippedCommands.load(std::memory_order_relaxed);
+    statistics.mSavedTransactions = (0 == written) ? 0 : statistics.mSkippedCommands * getBusStatistics().mTransactions / written;
+    statistics.mLastWakeLatency   = mLastWakeLatency.load(std::memory_order_relaxed);
+    statistics.mMaxWakeLatency    = mMaxWakeLatency.load(std::memory_order_relaxed);
+    statistics.mIdleTime          = idleTime;
+    statistics.mSavedCpuTime      = (activeTime <= 0) ? 0 :
+            std::max<int64_t>(0, static_cast<int64_t>(static_cast<double>(activeCpu) / activeTime * idleTime) - idleCpu);
+    return statistics;
+}
+
+bool ARobotBase::setMotionProfile(const MotionLimits& throttle, const MotionLimits& steering, const float rate)
+{
+    MotionProfiler* profiler = mMotionProfiler.load();
+    if (throttle.mAcceleration <= 0.0f && 0 == throttle.mDwell && steering.mAcceleration <= 0.0f && 0 == steering.mDwell)
+    {
+        if (nullptr != profiler && profiler->isRunning())
+        {
+            DriveCommands targets = profiler->getTargets();
+            profiler->stop();
+            // apply the targets which the profiler did not reach
+            update(targets);
+        }
+        return true;
+    }
+    profiler = getOrCreate(mMotionProfiler, mMutex, this);
+    if (!profiler->isRunning())
+    {
+        float steering;
+        float throttle;
+        {
+            // the ramps start from wherever the outputs were left
+            ScopedLock lock(mMutex);
+            steering = mSteering;
+            throttle = (0.0f == mThrottleGain) ? 0.0f : mThrottle / mThrottleGain;
+        }
+        profiler->reset(steering, throttle);
+    }
+    return profiler->start(steering, throttle, rate, getRealtimeProfile());
+}
+
+MotionStatistics ARobotBase::getMotionStatistics() const
+{
+    MotionProfiler* profiler = mMotionProfiler.load();
+    return (nullptr == profiler) ? MotionStatistics() : profiler->getStatistics();
+}
+
+bool ARobotBase::setWatchdogTimeout(const uint32_t timeout)
+{
+    if (0 == timeout)
+    {
+        stopSubsystem(mWatchdog);
+        return true;
+    }
+    Watchdog* watchdog = getOrCreate(mWatchdog, mMutex, this, &mMutex);
+    return watchdog->start(timeout, getRealtimeProfile());
+}
+
+uint32_t ARobotBase::getWatchdogTimeout() const
+{
+    Watchdog* watchdog = mWatchdog.load();
+    return (nullptr == watchdog) ? 0 : watchdog->getTimeout();
+}
+
+WatchdogStatistics ARobotBase::getWatchdogStatistics() const
+{
+    Watchdog* watchdog = mWatchdog.load();
+    return (nullptr == watchdog) ? WatchdogStatistics() : watchdog->getStatistics();
+}
+
+CommandFuture ARobotBase::submit(const DriveCommands& driveCommands, const CompletionCallback callback, void* context)
+{
+    CommandSubmitter* submitter = getOrCreate(mCommandSubmitter, mMutex, this);
+    return submitter->submit(driveCommands, getRealtimeProfile(), callback, context);
+}
+
+bool ARobotBase::addAuxiliaryDevice(AAuxiliaryDevice* device)
+{
+    AuxiliaryBus* bus = getOrCreate(mAuxiliaryBus, mMutex, &mI2C, &mBusSupervisor);
+    return bus->addDevice(device);
+}
+
+bool ARobotBase::setAuxiliaryBudget(const float budget)
+{
+    if (budget <= 0.0f)
+    {
+        stopSubsystem(mAuxiliaryBus);
+        return true;
+    }
+    AuxiliaryBus* bus = getOrCreate(mAuxiliaryBus, mMutex, &mI2C, &mBusSupervisor);
+    return bus->start(budget);
+}
+
+AuxiliaryStatistics ARobotBase::getAuxiliaryStatistics() const
+{
+    AuxiliaryBus* bus = mAuxiliaryBus.load();
+    return (nullptr == bus) ? AuxiliaryStatistics() : bus->getStatistics();
+}
+
+bool ARobotBase::acceptCommand(const DriveCommands& driveCommands)
+{
+    if (MotionProfiler::isDispatching())
+    {
+        // a step towards a target which has already been accepted
+        return true;
+    }
+
+    int64_t maxAge = mMaxCommandAge.load(std::memory_order_relaxed);
+    if (0 != driveCommands.mTimestamp && maxAge > 0 && getMonotonicTime() - driveCommands.mTimestamp > maxAge)
+    {
+        mStaleCommands.fetch_add(1, std::memory_order_relaxed);
+        CommandSubmitter::complete(COMMAND_DROPPED);
+        LOG_DEBUG("%s: dropped a command %lld us old", mName, (getMonotonicTime() - driveCommands.mTimestamp) / 1000);
+        Metrics::getInstance().commandDropped();
+        return false;
+    }
+    // commands arriving faster than the bus allows are held and applied later by the rate governor
+    RateGovernor* governor = mRateGovernor.load(std::memory_order_acquire);
+    if (nullptr != governor && !governor->admit(driveCommands))
+    {
+        return false;
+    }
+    MotionProfiler* profiler = mMotionProfiler.load(std::memory_order_acquire);
+    if (nullptr != profiler && !profiler->admit(driveCommands))
+    {
+        // the profiler applies the steps towards the command, but the command itself is the sign of life
+        feedWatchdog(getMonotonicTime());
+        return false;
+    }
+    return true;
+}
+
+bool ARobotBase::acceptSteering(const float steering)
+{
+    MotionProfiler* profiler = mMotionProfiler.load(std::memory_order_acquire);
+    if (nullptr != profiler && !profiler->admitSteering(steering))
+    {
+        feedWatchdog(getMonotonicTime());
+        return false;
+    }
+    return true;
+}
+
+bool ARobotBase::acceptThrottle(const float throttle)
+{
+    MotionProfiler* profiler = mMotionProfiler.load(std::memory_order_acquire);
+    if (nullptr != profiler && !profiler->admitThrottle(throttle))
+    {
+        feedWatchdog(getMonotonicTime());
+        return false;
+    }
+    return true;
+}
+
+void ARobotBase::resetMotionProfile(const float steering, const float throttle)
+{
+    MotionProfiler* profiler = mMotionProfiler.load(std::memory_order_acquire);
+    if (nullptr != profiler)
+    {
+        profiler->reset(steering, throttle);
+    }
+}
+
+void ARobotBase::recordCommand(const CommandStatus status, const float steering, const float throttle,
+                               const int64_t timestamp)
+{
+    int64_t age;
+    int64_t maxAge;
+
+    CommandSubmitter::complete(status);
+    if (COMMAND_FAILED == status)
+    {
+        Metrics::getInstance().commandDropped();
+        return;
+    }
+    if (COMMAND_WRITTEN != status)
+    {
+        // not on the bus yet, so neither the outputs nor the age of the command are known
+        return;
+    }
+
+    Metrics::getInstance().commandApplied(steering, throttle);
+    if (0 != timestamp)
+    {
+        age = getMonotonicTime() - timestamp;
+        maxAge = mMaxAppliedAge.load(std::memory_order_relaxed);
+        mAppliedCommands.fetch_add(1, std::memory_order_relaxed);
+        mLastCommandAge.store(age, std::memory_order_relaxed);
+        mTotalCommandAge.fetch_add(age, std::memory_order_relaxed);
+        while (age > maxAge && !mMaxAppliedAge.compare_exchange_weak(maxAge, age, std::memory_order_relaxed))
+        {
+            ;
+        }
+        Metrics::getInstance().commandAge(age);
+    }
+}
+
+bool ARobotBase::handleIdle(const float steering, const float throttle, const int64_t timestamp)
+{
+    int64_t now = getMonotonicTime();
+    bool active = std::abs(steering) > std::numeric_limits<float>::epsilon() ||
+                  std::abs(throttle) > std::numeric_limits<float>::epsilon();
+
+    if (!MotionProfiler::isDispatching())
+    {
+        // steps of the profiler towards an old target are no sign of life
+        feedWatchdog(now);
+    }
+    if (active)
+    {
+        // publish the activity before checking the idle flag, enterIdle does the opposite, so one of them sees the other
+        mLastActivity.store(now);
+    }
+    if (mIdle.load())
+    {
+        if (!active)
+        {
+            mSkippedCommands.fetch_add(1, std::memory_order_relaxed);
+            // nothing is written while idle, so the outputs stay where the idle mode left them
+            recordCommand(COMMAND_SKIPPED, UNCHANGED, UNCHANGED, timestamp);
+            return false;
+        }
+        wakeUp(now);
+    }
+    mWrittenCommands.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ARobotBase::setOutputsAsleep(const bool asleep)
+{
+    if (asleep)
+    {
+        if (std::abs(mThrottle) > std::numeric_limits<float>::epsilon() ||
+            std::abs(mSteering) > std::numeric_limits<float>::epsilon())
+        {
+            return false;
+        }
+        // a board which fails to go to sleep simply stays awake with its outputs at zero
+        mThrottlePCA.sleep();
+        return true;
+    }
+    return mThrottlePCA.wake();
+}
+
+void ARobotBase::enterIdle()
+{
+    ScopedLock lock(mMutex);
+    int64_t lastActivity = mLastActivity.load();
+    int64_t idleSince = getMonotonicTime();
+    int64_t idleCpuSince = getProcessCpuTime();
+
+    // set the idle flag before checking the activity, handleIdle does the opposite, so one of them sees the other
+    mIdle.store(true);
+    if (idleSince - mLastActivity.load() < mIdleTimeout.load(std::memory_order_relaxed))
+    {
+        // a command has just arrived
+        mIdle.store(false);
+    }
+    else if (!setOutputsAsleep(true))
+    {
+        // the robot is still moving, so restart the quiet period
+        mIdle.store(false);
+        mLastActivity.compare_exchange_strong(lastActivity, idleSince);
+    }
+    else
+    {
+        mIdleSince = idleSince;
+        mIdleCpuSince = idleCpuSince;
+        mIdleEntries.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("%s: idle", mName);
+    }
+}
+
+void ARobotBase::wakeUp(const int64_t start)
+{
+    ScopedLock lock(mMutex);
+    if (mIdle.load())
+    {
+        setOutputsAsleep(false);
+        int64_t now = getMonotonicTime();
+        int64_t latency = now - start;
+        int64_t maxLatency = mMaxWakeLatency.load(std::memory_order_relaxed);
+
+        mIdle.store(false);
+        mIdleTime.fetch_add(now - mIdleSince, std::memory_order_relaxed);
+        mIdleCpuTime.fetch_add(getProcessCpuTime() - mIdleCpuSince, std::memory_order_relaxed);
+        mWakeups.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("%s: woke up in %lld us", mName, latency / 1000);
+        mLastWakeLatency.store(latency, std::memory_order_relaxed);
+        while (latency > maxLatency && !mMaxWakeLatency.compare_exchange_weak(maxLatency, latency, std::memory_order_relaxed))
+        {
+            ;
+        }
+
+        ScopedLock idleLock(mIdleMonitor.getMutex());
+        mIdleMonitor.notify();
+    }
+}
+
+void ARobotBase::idleThreadBody(void* robot)
+{
+    static_cast<ARobotBase*>(robot)->runIdleMonitor();
+}
+
+void ARobotBase::runIdleMonitor()
+{
+    int64_t timeout;
+    int64_t deadline;
+
+    while (mIdleMonitor.isRunning())
+    {
+        timeout = mIdleTimeout.load(std::memory_order_relaxed);
+        if (0 == timeout || mIdle.load())
+        {
+            // parked until the idle mode is enabled or the robot wakes up
+            mIdleMonitor.wait();
+            continue;
+        }
+
+        deadline = mLastActivity.load() + timeout;
+        if (getMonotonicTime() < deadline)
+        {
+            mIdleMonitor.waitUntil(deadline);
+            continue;
+        }
+
+        pthread_mutex_unlock(&mIdleMonitor.getMutex());
+        enterIdle();
+        pthread_mutex_lock(&mIdleMonitor.getMutex());
+    }
+}
+
+void ARobotBase::stopBackgroundThreads()
+{
+    stopSubsystem(mCommandSubmitter);
+    stopSubsystem(mAuxiliaryBus);
+    stopSubsystem(mWatchdog);
+    stopSubsystem(mMotionProfiler);
+    mTrajectoryExecutor.stop();
+    stopSubsystem(mRateGovernor);
+    mBusSupervisor.stop();
+    mIdleMonitor.stop();
+}
+
 float ARobotBase::clip(const float value)
 {
     return fmaxf(-1.0f, fminf(1.0f, value));
@@ -113,5 +696,6 @@ float ARobotBase::clip(const float value)
 
 bool ARobotBase::checkValue(const float newValue, const float oldValue)
 {
-    return std::signbit(newValue) != std::signbit(oldValue) && std::abs(newValue) > std::numeric_limits<float>::epsilon();
+    return !MotionProfiler::isDispatching() && std::signbit(newValue) != std::signbit(oldValue) &&
+           std::abs(newValue) > std::numeric_limits<float>::epsilon();
 }
\ No newline at end of file
@@ -22,14 +22,65 @@
 
 #pragma once
 
+#include <atomic>
+#include <limits>
 #include <generic_listener.h>
 #include <i2c.h>
+#include "command_submitter.h"
 #include "drive_commands.h"
+#include "motion_profiler.h"
+#include "rate_governor.h"
+#include "trajectory_executor.h"
+#include "watchdog.h"
+#include "worker_thread.h"
+#include "auxiliary/auxiliary_bus.h"
+#include "motor_controller/bus_supervisor.h"
 #include "motor_controller/pca9685.h"
 
 #define PCA9685_ADDRESS_1    0x40
 #define PCA9685_ADDRESS_2    0x60
 
+/**
+ * Input-to-actuation age statistics of drive commands, in nanoseconds. Only commands with known
+ * timestamps are included.
+ */
+struct CommandAgeStatistics
+{
+    /** The number of applied commands with known timestamps. */
+    uint64_t mApplied;
+    /** The number of commands dropped because they were older than the age budget. */
+    uint64_t mStale;
+    /** Age of the last applied command. */
+    int64_t mLastAge;
+    /** The maximum age of an applied command. */
+    int64_t mMaxAge;
+    /** The sum of ages of all applied commands. */
+    int64_t mTotalAge;
+};
+
+/**
+ * Statistics of the idle power-down mode. Time values are in nanoseconds.
+ */
+struct IdleStatistics
+{
+    /** The number of times the robot went idle. */
+    uint64_t mEntries;
+    /** The number of times the robot woke up on a command. */
+    uint64_t mWakeups;
+    /** The number of zero commands which were not written because the robot was idle. */
+    uint64_t mSkippedCommands;
+    /** Estimated number of bus transactions saved by the skipped commands. */
+    uint64_t mSavedTransactions;
+    /** Time from receiving the last waking command to the boards running again. */
+    int64_t mLastWakeLatency;
+    /** The longest wake-up latency. */
+    int64_t mMaxWakeLatency;
+    /** The total time spent idle. */
+    int64_t mIdleTime;
+    /** Estimated process CPU time saved while idle, compared to the average rate while active. */
+    int64_t mSavedCpuTime;
+};
+
 class ARobotBase : public GenericListener<DriveCommands>
 {
 public:
@@ -82,6 +133,13 @@ public:
      */
     virtual void setThrottle(const float throttle) = 0;
 
+    /**
+     * Stops the drive motors immediately by writing precomputed stop values, bypassing command processing.
+     * Steering is left as it is, unless it drives the motors.
+     *  @return true if the stop was written successfully.
+     */
+    virtual bool applyStop() = 0;
+
     /**
      *  @return steering gain
      */
@@ -112,7 +170,301 @@ public:
      */
     void setThrottleGain(const float throttleGain);
 
+    /**
+     * Uploads a pre-planned trajectory which is executed by a dedicated timer thread with absolute
+     * deadlines. Any trajectory which is currently executed is replaced.
+     *  @param samples an array of samples sorted by their time offsets.
+     *  @param count the number of samples in @p samples.
+     *  @param interpolate if true, commands are interpolated between samples.
+     *  @return true if the trajectory was accepted.
+     */
+    bool executeTrajectory(const TrajectorySample* samples, const size_t count, const bool interpolate = true);
+
+    /**
+     * Cancels the currently executed trajectory. The last applied command stays in effect.
+     */
+    void cancelTrajectory();
+
+    /**
+     *  @return true if a trajectory is currently executed.
+     */
+    bool isTrajectoryRunning() const;
+
+    /**
+     *  @return deadline statistics of the current (or last) trajectory.
+     */
+    TrajectoryStatistics getTrajectoryStatistics() const;
+
+    /**
+     *  @return the trajectory executor for tuning its tick period and deadline tolerance, or reading per-sample lateness.
+     */
+    inline TrajectoryExecutor& getTrajectoryExecutor()
+    {
+        return mTrajectoryExecutor;
+    }
+
+    /**
+     * Configures an opt-in real-time profile for the threads of this robot which write to the I2C bus.
+     * Memory is locked and prefaulted immediately, and the scheduling and CPU affinity of running threads
+     * change at once, while threads started later apply the profile themselves. A profile without memory
+     * locking unlocks memory locked by a previous one, and the default profile reverts to SCHED_OTHER on
+     * all CPUs. Threads owned by the application (e.g. a gamepad thread) can apply the same profile with
+     * RealtimeProfile::applyToCurrentThread.
+     *  @param profile the real-time profile.
+     *  @return true if the memory and all running threads were configured.
+     */
+    bool setRealtimeProfile(const RealtimeProfile& profile);
+
+    /**
+     *  @return the real-time profile configured for this robot.
+     */
+    RealtimeProfile getRealtimeProfile() const;
+
+    /**
+     *  @return measured wake-up jitter of the robot's timer thread since the profile was last applied, which is only
+     *  sampled while trajectories are executed.
+     */
+    WakeupJitter getWakeupJitter() const;
+
+    /**
+     * Measures wake-up jitter on a probe thread with the real-time profile of the robot, independently of the
+     * trajectories. Blocks for @p iterations times @p period.
+     *  @param iterations the number of wake-ups to measure.
+     *  @param period the period between wake-ups in microseconds.
+     *  @return wake-up jitter statistics.
+     */
+    WakeupJitter measureWakeupJitter(const uint32_t iterations = 1000, const uint32_t period = 1000) const;
+
+    /**
+     *  @return I2C error, retry and recovery counters summed over all PCA9685 boards of this robot.
+     */
+    BusStatistics getBusStatistics() const;
+
+    /**
+     * Enables background read-back of the PCA9685 channels, which repairs channels that lost their commanded
+     * values, e.g. after a brownout or a glitch. Read-backs run on the bus supervisor thread while the bus is idle,
+     * and their results are reported in getBusStatistics().
+     *  @param period the period between read-backs of single channels in microseconds, or 0 to disable them.
+     */
+    void setVerificationPeriod(const uint32_t period);
+
+    /**
+     * Sets the age budget of drive commands received through update(). Commands whose input is older than the
+     * budget when they arrive are dropped, so that the robot acts on fresh intent instead of a backlog.
+     *  @param maxAge the maximum age in microseconds, or 0 to accept commands of any age.
+     */
+    void setMaxCommandAge(const uint32_t maxAge);
+
+    /**
+     *  @return the age budget of drive commands in microseconds, 0 if disabled.
+     */
+    uint32_t getMaxCommandAge() const;
+
+    /**
+     *  @return input-to-actuation age statistics of drive commands.
+     */
+    CommandAgeStatistics getCommandAgeStatistics() const;
+
+    /**
+     * Enables adaptive limiting of the command rate. The bus time of every transaction is measured, and the rate
+     * of commands applied through update() is selected so that the bus utilisation stays under @p utilisation.
+     * Commands arriving faster are coalesced and only the latest one is applied.
+     *  @param utilisation the target bus utilisation from 0 to 1, or 0 to disable the limiting.
+     *  @param minRate the lowest rate which can be selected in Hz.
+     *  @param maxRate the highest rate which can be selected in Hz.
+     *  @return true if the limiting is in the requested state.
+     */
+    bool setBusUtilisationTarget(const float utilisation, const float minRate = 20.0f, const float maxRate = 500.0f);
+
+    /**
+     *  @return the selected command rate, the measured bus utilisation and bus time per command.
+     */
+    RateStatistics getRateStatistics() const;
+
+    /**
+     * Sets the quiet period after which a parked robot goes idle. The robot is parked when both its steering and
+     * throttle are zero. When idle, the PCA9685 boards sleep with their outputs off, zero commands are not written
+     * at all, and the first non-zero command wakes the boards up before it is applied.
+     *  @param timeout the quiet period in milliseconds, or 0 to disable the idle mode.
+     *  @return true if the idle monitor is running (or the idle mode is disabled).
+     */
+    bool setIdleTimeout(const uint32_t timeout);
+
+    /**
+     *  @return the quiet period after which a parked robot goes idle in milliseconds, 0 if disabled.
+     */
+    uint32_t getIdleTimeout() const;
+
+    /**
+     *  @return true if the robot is idle.
+     */
+    inline bool isIdle() const
+    {
+        return mIdle.load(std::memory_order_relaxed);
+    }
+
+    /**
+     *  @return statistics of the idle mode.
+     */
+    IdleStatistics getIdleStatistics() const;
+
+    /**
+     * Enables motion profiling, which replaces the immediate stop before a reversal. Commands set the targets of
+     * steering and throttle, and a profiler thread moves the outputs towards them at @p rate, within acceleration
+     * and jerk limits, dwelling at zero before reversing. Outputs without limits follow their targets directly and
+     * may reverse without a stop, so throttle should always be limited. Profiling starts from the current outputs.
+     *  @param throttle limits of throttle, or default limits together with @p steering to disable profiling.
+     *  @param steering limits of steering.
+     *  @param rate the rate at which the outputs are stepped, normally the actuation rate, in Hz.
+     *  @return true if profiling is in the requested state.
+     */
+    bool setMotionProfile(const MotionLimits& throttle, const MotionLimits& steering = MotionLimits(), const float rate = 100.0f);
+
+    /**
+     *  @return the number of profiled steps and reversals.
+     */
+    MotionStatistics getMotionStatistics() const;
+
+    /**
+     * Enables the dead-man watchdog, which stops the robot with applyStop when no command arrives for @p timeout.
+     * Every command re-arms it, so command sources must repeat commands faster than the timeout, e.g. through
+     * the keep-alive of CommandMux.
+     *  @param timeout the time without commands after which the robot is stopped in milliseconds, or 0 to disable it.
+     *  @return true if the watchdog is in the requested state.
+     */
+    bool setWatchdogTimeout(const uint32_t timeout);
+
+    /**
+     *  @return the timeout of the watchdog in milliseconds, 0 if disabled.
+     */
+    uint32_t getWatchdogTimeout() const;
+
+    /**
+     *  @return the number of watchdog stops and the time from a timeout to the stop.
+     */
+    WatchdogStatistics getWatchdogStatistics() const;
+
+    /**
+     * Submits a drive command without waiting for the bus. Commands are applied in order through update() on a
+     * worker thread, which starts on the first submission. The returned handle completes when the command has been
+     * written to the bus or has failed, and reports the time of the write.
+     *  @param driveCommands the command to apply.
+     *  @param callback optional function called on the worker thread when the command completes.
+     *  @param context passed to @p callback.
+     *  @return a handle of the command, invalid if too many commands are pending.
+     */
+    CommandFuture submit(const DriveCommands& driveCommands, const CompletionCallback callback = nullptr, void* context = nullptr);
+
+    /**
+     * Adds a low-priority driver of another peripheral on the bus of the robot, e.g. an OledDisplay.
+     *  @param device the driver, which must outlive the robot.
+     *  @return true if the device was added.
+     */
+    bool addAuxiliaryDevice(AAuxiliaryDevice* device);
+
+    /**
+     * Starts or stops the transactions of auxiliary devices. They run on a thread at idle priority, only while no drive
+     * commands are being written, and within a budget of bus time. Must be called after initialise().
+     *  @param budget the largest fraction of time the devices may use the bus, from 0 to 1, or 0 to stop them.
+     *  @return true if the auxiliary devices are in the requested state.
+     */
+    bool setAuxiliaryBudget(const float budget);
+
+    /**
+     *  @return statistics of the transactions of auxiliary devices.
+     */
+    AuxiliaryStatistics getAuxiliaryStatistics() const;
+
 protected:
+    /** Passed to recordCommand for an output which the command did not write. */
+    static constexpr float UNCHANGED = std::numeric_limits<float>::quiet_NaN();
+
+    /**
+     * Stops all background threads which may call virtual methods of this class. Must be called
+     * at the beginning of the destructor of every derived class.
+     */
+    void stopBackgroundThreads();
+
+    /**
+     * Checks the age of drive commands received through update() against the age budget, and their rate against
+     * the rate governor, and passes them to the motion profiler.
+     *  @param driveCommands received drive commands.
+     *  @return true if the commands should be applied, false if they are stale and were dropped, were held, or
+     *  became the targets of the motion profiler.
+     */
+    bool acceptCommand(const DriveCommands& driveCommands);
+
+    /**
+     * Passes steering received through setSteering() to the motion profiler.
+     *  @param steering the new steering.
+     *  @return true if the steering should be applied, false if it became the target of the motion profiler.
+     */
+    bool acceptSteering(const float steering);
+
+    /**
+     * Passes throttle received through setThrottle() to the motion profiler.
+     *  @param throttle the new throttle.
+     *  @return true if the throttle should be applied, false if it became the target of the motion profiler.
+     */
+    bool acceptThrottle(const float throttle);
+
+    /**
+     * Moves the outputs of the motion profiler and their targets to new values, if profiling was ever enabled.
+     *  @param steering the new steering.
+     *  @param throttle the new throttle.
+     */
+    void resetMotionProfile(const float steering, const float throttle);
+
+    /**
+     * Updates metrics and age statistics after a drive command has been processed. The outputs are passed by the
+     * caller, which holds the mutex guarding them.
+     *  @param applied true if the command was fully written to the bus.
+     *  @param steering the steering written, UNCHANGED if the command did not write it.
+     *  @param throttle the throttle written, UNCHANGED if the command did not write it.
+     *  @param timestamp time of the input which produced the command, 0 if unknown.
+     */
+    inline void recordCommand(const bool applied, const float steering, const float throttle, const int64_t timestamp = 0)
+    {
+        recordCommand(applied ? COMMAND_WRITTEN : COMMAND_FAILED, steering, throttle, timestamp);
+    }
+
+    /**
+     * Updates metrics and age statistics after a drive command has been processed. Only written commands are
+     * counted as applied, deferred ones are written later, e.g. by an output scheduler.
+     *  @param status COMMAND_WRITTEN, COMMAND_FAILED, COMMAND_DEFERRED or COMMAND_SKIPPED.
+     *  @param steering the steering written, UNCHANGED if the command did not write it.
+     *  @param throttle the throttle written, UNCHANGED if the command did not write it.
+     *  @param timestamp time of the input which produced the command, 0 if unknown.
+     */
+    void recordCommand(const CommandStatus status, const float steering, const float throttle, const int64_t timestamp = 0);
+
+    /**
+     * Tracks activity for the idle mode and re-arms the watchdog, must be called before a command is applied and
+     * without any mutex locked. Wakes the robot up if it is idle and the command is non-zero.
+     *  @param steering the commanded steering, 0 if the command does not change it.
+     *  @param throttle the commanded throttle, 0 if the command does not change it.
+     *  @param timestamp time of the input which produced the command, 0 if unknown.
+     *  @return false if the robot is idle and the command is zero, in which case it was recorded and must not be written.
+     */
+    bool handleIdle(const float steering, const float throttle, const int64_t timestamp = 0);
+
+    /**
+     * Puts the boards of the robot to sleep, or wakes them up. Called with mMutex locked. Derived classes with more
+     * boards extend it.
+     *  @param asleep true to put the boards to sleep, false to wake them up.
+     *  @return false if the robot is not parked when going to sleep, in which case nothing is written, or if the
+     *  boards could not be woken up.
+     */
+    virtual bool setOutputsAsleep(const bool asleep);
+
+    /**
+     * Applies a new real-time profile to the running threads of the robot, called without any mutex locked.
+     * Derived classes with threads of their own extend it.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied to all threads.
+     */
+    virtual bool applyRealtimeProfile(const RealtimeProfile& profile);
+
     /**
      *  @return clipped @p value so that it is from within -1 and 1.
      */
@@ -120,11 +472,47 @@ protected:
 
     /**
      * Checks if the @p newValue is of the opposite sign than the @p oldValue, and whether @p newValue is non-zero.
+     * Always false for steps of the motion profiler, which reverse only after dwelling at zero.
      *  @param newValue
      *  @param oldValue
      */
     static bool checkValue(const float newValue, const float oldValue);
 
+    /**
+     * Re-arms the watchdog, if it was ever enabled.
+     *  @param now time of the command in nanoseconds.
+     */
+    inline void feedWatchdog(const int64_t now)
+    {
+        Watchdog* watchdog = mWatchdog.load(std::memory_order_acquire);
+        if (nullptr != watchdog)
+        {
+            watchdog->feed(now);
+        }
+    }
+
+    /**
+     * Puts a parked robot to sleep, unless a command arrived in the meantime.
+     */
+    void enterIdle();
+
+    /**
+     * Wakes an idle robot up.
+     *  @param start time at which the waking command was received.
+     */
+    void wakeUp(const int64_t start);
+
+    /**
+     * Entry point of the idle monitor thread.
+     *  @param robot pointer to this class.
+     */
+    static void idleThreadBody(void* robot);
+
+    /**
+     * The main loop of the idle monitor thread, which sleeps until the quiet period of the last activity elapses.
+     */
+    void runIdleMonitor();
+
     /** The name of the robot. */
     const char* mName;
     /** Steering control for the racer, value from -1 to 1. */
@@ -137,10 +525,56 @@ protected:
     float mSteeringOffset;
     /** Throttle gain for throttle control. */
     float mThrottleGain;
+    /** Supervisor performing bus recovery of PCA9685 boards, declared first so that it outlives them. */
+    BusSupervisor mBusSupervisor;
     /** Object for I2C communication. */
     I2C mI2C;
     /** PCA9685 board which controls drive motors. */
     PCA9685 mThrottlePCA;
     /** Mutex for accessing values. */
     mutable pthread_mutex_t mMutex;
+    /** The age budget of drive commands in nanoseconds, 0 if disabled. */
+    std::atomic<int64_t> mMaxCommandAge;
+    /** Counters of the command age statistics. */
+    std::atomic<uint64_t> mAppliedCommands;
+    std::atomic<uint64_t> mStaleCommands;
+    std::atomic<int64_t> mLastCommandAge;
+    std::atomic<int64_t> mMaxAppliedAge;
+    std::atomic<int64_t> mTotalCommandAge;
+    /** The quiet period after which a parked robot goes idle in nanoseconds, 0 if disabled. */
+    std::atomic<int64_t> mIdleTimeout;
+    /** Time of the last non-zero command. */
+    std::atomic<int64_t> mLastActivity;
+    /** True if the robot is idle. */
+    std::atomic<bool> mIdle;
+    /** Time and process CPU time at which the robot was created and at which it last went idle. */
+    int64_t mCreated;
+    int64_t mCreatedCpuTime;
+    int64_t mIdleSince;
+    int64_t mIdleCpuSince;
+    /** Counters of the idle statistics. */
+    std::atomic<uint64_t> mIdleEntries;
+    std::atomic<uint64_t> mWakeups;
+    std::atomic<uint64_t> mSkippedCommands;
+    std::atomic<uint64_t> mWrittenCommands;
+    std::atomic<int64_t> mLastWakeLatency;
+    std::atomic<int64_t> mMaxWakeLatency;
+    std::atomic<int64_t> mIdleTime;
+    std::atomic<int64_t> mIdleCpuTime;
+    /** The idle monitor thread. */
+    WorkerThread mIdleMonitor;
+    /** Real-time profile of the threads writing to the I2C bus. */
+    RealtimeProfile mRealtimeProfile;
+    /** Executor of pre-planned trajectories. */
+    TrajectoryExecutor mTrajectoryExecutor;
+    /** Governor of the command rate, created when the rate is first limited. */
+    std::atomic<RateGovernor*> mRateGovernor;
+    /** Watchdog stopping the robot when commands go silent, created when it is first enabled. */
+    std::atomic<Watchdog*> mWatchdog;
+    /** Profiler of steering and throttle, created when profiling is first enabled. */
+    std::atomic<MotionProfiler*> mMotionProfiler;
+    /** Worker applying asynchronously submitted commands, created on the first submission. */
+    std::atomic<CommandSubmitter*> mCommandSubmitter;
+    /** Scheduler of auxiliary devices sharing the bus, created when the first device is added. */
+    std::atomic<AuxiliaryBus*> mAuxiliaryBus;
 };
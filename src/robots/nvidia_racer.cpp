@@ -20,24 +20,36 @@
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include "metrics.h"
 #include "nvidia_racer.h"
+#include "profiler.h"
+#include "trace.h"
 
 
 NvidiaRacer::NvidiaRacer(const float steeringGain, const float steeringOffset, const float throttleGain)
 : ARobotBase("NvidiaRacer", steeringGain, steeringOffset, throttleGain),
 #ifdef JETRACER_PRO
   mThrottleMotor(&mThrottlePCA, 1),
+  mStopDutyCycle(0),
   mSteeringMotor(&mThrottlePCA, 0)
 #else
   mSteeringPCA(&mI2C, PCA9685_ADDRESS_1),
-  mSteeringMotor(&mSteeringPCA, 0)
+  mSteeringMotor(&mSteeringPCA, 0),
+  mSteeringScheduler(&mSteeringPCA, &mSteeringMutex)
 #endif
 {
     pthread_mutex_init(&mSteeringMutex, nullptr);
+#ifndef JETRACER_PRO
+    mBusSupervisor.addDevice(&mSteeringPCA);
+#endif
 }
 
 NvidiaRacer::~NvidiaRacer()
 {
+    stopBackgroundThreads();
+#ifndef JETRACER_PRO
+    mSteeringScheduler.stop();
+#endif
     setSteering(0.0f);
     setThrottle(0.0f);
     pthread_mutex_destroy(&mSteeringMutex);
@@ -51,8 +63,9 @@ bool NvidiaRacer::initialise(const char* devicePath)
     if (flag)
     {
 #ifdef JETRACER_PRO
-        mPCA.reset();
+        // both motors are on the throttle board, which keeps the 1.6 kHz set up by the base class
         mThrottleMotor.initialise();
+        mStopDutyCycle = mThrottleMotor.toDutyCycle(0.0f);
 #else
         mSteeringPCA.reset();
         mSteeringPCA.setFrequency(50);
@@ -64,51 +77,205 @@ bool NvidiaRacer::initialise(const char* devicePath)
 
 void NvidiaRacer::setSteering(const float steering)
 {
-    ScopedLock lock(mSteeringMutex);
-    mSteering = clip(steering);
-    mSteeringMotor.setThrottle(mSteering * mSteeringGain + mSteeringOffset);
+    TRACE_SPAN("NvidiaRacer::setSteering");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptSteering(steering) || !handleIdle(steering, 0.0f))
+    {
+        return;
+    }
+    TRACE_LOCK(lock, mSteeringMutex);
+    // the throttle is guarded by the other mutex, and this command does not change it
+    recordCommand(applySteering(steering), mSteering, UNCHANGED);
 }
 
 void NvidiaRacer::setThrottle(const float throttle)
+{
+    TRACE_SPAN("NvidiaRacer::setThrottle");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptThrottle(throttle) || !handleIdle(0.0f, throttle))
+    {
+        return;
+    }
+    TRACE_LOCK(lock, mMutex);
+    recordCommand(applyThrottle(throttle), UNCHANGED, mThrottle);
+}
+
+void NvidiaRacer::update(const DriveCommands& driveCommands)
+{
+    TRACE_SPAN("NvidiaRacer::update");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptCommand(driveCommands) ||
+        !handleIdle(driveCommands.mSteering, driveCommands.mThrottle, driveCommands.mTimestamp))
+    {
+        return;
+    }
+
+    // both outputs change in one critical section, so they are never observed inconsistent
+    TRACE_LOCK(lock1, mMutex);
+    TRACE_LOCK(lock2, mSteeringMutex);
+#ifdef JETRACER_PRO
+    recordCommand(applyCommands(driveCommands.mSteering, driveCommands.mThrottle), mSteering, mThrottle,
+                  driveCommands.mTimestamp);
+#else
+    CommandStatus status = applySteering(driveCommands.mSteering);
+    status = applyThrottle(driveCommands.mThrottle) ? status : COMMAND_FAILED;
+    recordCommand(status, mSteering, mThrottle, driveCommands.mTimestamp);
+#endif
+}
+
+bool NvidiaRacer::applyStop()
 {
     ScopedLock lock(mMutex);
+    mThrottle = 0.0f;
+    resetMotionProfile(mSteering, 0.0f);
+#ifdef JETRACER_PRO
+    return mThrottlePCA.setDutyCycle(mThrottleMotor.getChannel(), mStopDutyCycle);
+#else
+    // zero duty cycles of both bridges stop the motors in either direction
+    bool flag = mThrottlePCA.setDutyCycle(0, 0);
+    flag &= mThrottlePCA.setDutyCycle(3, 0);
+    flag &= mThrottlePCA.setDutyCycle(4, 0);
+    flag &= mThrottlePCA.setDutyCycle(7, 0);
+    return flag;
+#endif
+}
+
+bool NvidiaRacer::setOutputsAsleep(const bool asleep)
+{
+    ScopedLock lock(mSteeringMutex);
+    bool flag = ARobotBase::setOutputsAsleep(asleep);
+#ifndef JETRACER_PRO
+    if (!asleep)
+    {
+        flag &= mSteeringPCA.wake();
+    }
+    else if (flag)
+    {
+        mSteeringPCA.sleep();
+    }
+#endif
+    return flag;
+}
+
+bool NvidiaRacer::setOutputScheduling(const bool enabled, const uint32_t lead)
+{
+#ifdef JETRACER_PRO
+    (void) lead;
+    return !enabled;
+#else
+    bool flag = true;
+    if (enabled)
+    {
+        flag = mSteeringScheduler.start(lead, getRealtimeProfile());
+    }
+    else
+    {
+        mSteeringScheduler.stop();
+        // the last scheduled value might have been discarded, so write the current steering directly
+        ScopedLock lock(mSteeringMutex);
+        flag = (COMMAND_WRITTEN == applySteering(mSteering));
+    }
+    return flag;
+#endif
+}
+
+bool NvidiaRacer::applyRealtimeProfile(const RealtimeProfile& profile)
+{
+    bool flag = ARobotBase::applyRealtimeProfile(profile);
+#ifndef JETRACER_PRO
+    flag &= mSteeringScheduler.setRealtimeProfile(profile);
+#endif
+    return flag;
+}
+
+OutputSchedulerStatistics NvidiaRacer::getOutputSchedulerStatistics() const
+{
+#ifdef JETRACER_PRO
+    return OutputSchedulerStatistics();
+#else
+    return mSteeringScheduler.getStatistics();
+#endif
+}
+
+CommandStatus NvidiaRacer::applySteering(const float steering)
+{
+    mSteering = clip(steering);
+#ifndef JETRACER_PRO
+    if (mSteeringScheduler.isRunning())
+    {
+        // written by the scheduler just before the next PWM period
+        mSteeringScheduler.setDutyCycle(mSteeringMotor.getChannel(),
+                mSteeringMotor.toDutyCycle(mSteering * mSteeringGain + mSteeringOffset));
+        return COMMAND_DEFERRED;
+    }
+#endif
+    return mSteeringMotor.setThrottle(mSteering * mSteeringGain + mSteeringOffset) ? COMMAND_WRITTEN : COMMAND_FAILED;
+}
+
+#ifdef JETRACER_PRO
+bool NvidiaRacer::applyCommands(const float steering, const float throttle)
+{
+    bool flag = true;
+    uint16_t dutyCycles[2];
+
+    // steering and throttle are on channels 0 and 1, so a single frame of both channels updates them together
+    mSteering = clip(steering);
+    dutyCycles[0] = mSteeringMotor.toDutyCycle(mSteering * mSteeringGain + mSteeringOffset);
     if (checkValue(throttle, mThrottle))
     {
+        TRACE_SPAN("stop before reverse");
+        // the new steering goes out together with the stop, followed by the new throttle alone
+        dutyCycles[1] = mStopDutyCycle;
+        flag &= mThrottlePCA.setDutyCycles(mSteeringMotor.getChannel(), dutyCycles, 2);
+        mThrottle = clip(throttle) * mThrottleGain;
+        dutyCycles[1] = mThrottleMotor.toDutyCycle(mThrottle);
+        return flag & mThrottlePCA.setDutyCycles(mThrottleMotor.getChannel(), &dutyCycles[1], 1);
+    }
+    mThrottle = clip(throttle) * mThrottleGain;
+    dutyCycles[1] = mThrottleMotor.toDutyCycle(mThrottle);
+    return mThrottlePCA.setDutyCycles(mSteeringMotor.getChannel(), dutyCycles, 2);
+}
+#endif
+
+bool NvidiaRacer::applyThrottle(const float throttle)
+{
+    bool flag = true;
+    if (checkValue(throttle, mThrottle))
+    {
+        TRACE_SPAN("stop before reverse");
         // we want to avoid going from positive to negative direction, and vice versa, without a stop.
-        setThrottle(0); // it is ok to make a recursive call, because mMutex was configured as recursive mutex
+        flag &= applyThrottle(0);
     }
 
     mThrottle = clip(throttle) * mThrottleGain;
 #ifdef JETRACER_PRO
-    mThrottleMotor.setThrottle(mThrottle);
+    flag &= mThrottleMotor.setThrottle(mThrottle);
 #else
     if (mThrottle > 0)
     {
-        mThrottlePCA.setDutyCycle(0, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO(1, true);
-        mThrottlePCA.setGPIO(2, false);
-        mThrottlePCA.setGPIO(3, false);
-        mThrottlePCA.setDutyCycle(4, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO(5, false);
-        mThrottlePCA.setGPIO(6, true);
-        mThrottlePCA.setDutyCycle(7, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setDutyCycle(0, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(1, true);
+        flag &= mThrottlePCA.setGPIO(2, false);
+        flag &= mThrottlePCA.setGPIO(3, false);
+        flag &= mThrottlePCA.setDutyCycle(4, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(5, false);
+        flag &= mThrottlePCA.setGPIO(6, true);
+        flag &= mThrottlePCA.setDutyCycle(7, static_cast<uint16_t>(mThrottle *  0x0FFF + 0.5f));
     }
     else
     {
-        mThrottlePCA.setDutyCycle(0, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO(1, false);
-        mThrottlePCA.setGPIO(2, true);
-        mThrottlePCA.setDutyCycle(3, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO(4, false);
-        mThrottlePCA.setGPIO(5, true);
-        mThrottlePCA.setGPIO(6, false);
-        mThrottlePCA.setDutyCycle(7, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setDutyCycle(0, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(1, false);
+        flag &= mThrottlePCA.setGPIO(2, true);
+        flag &= mThrottlePCA.setDutyCycle(3, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(4, false);
+        flag &= mThrottlePCA.setGPIO(5, true);
+        flag &= mThrottlePCA.setGPIO(6, false);
+        flag &= mThrottlePCA.setDutyCycle(7, static_cast<uint16_t>(mThrottle * -0x0FFF + 0.5f));
     }
 #endif
-}
-
-void NvidiaRacer::update(const DriveCommands& driveCommands)
-{
-    setSteering(driveCommands.mSteering);
-    setThrottle(driveCommands.mThrottle);
+    return flag;
 }
@@ -24,6 +24,7 @@
 
 #include "abstract_robot_base.h"
 #include "motor_controller/continuous_servo.h"
+#include "motor_controller/output_scheduler.h"
 
 class NvidiaRacer : public ARobotBase
 {
@@ -45,11 +46,60 @@ public:
     void setSteering(const float steering) override;
     void setThrottle(const float throttle) override;
     void update(const DriveCommands& driveCommands) override;
+    bool applyStop() override;
+
+    /**
+     * Enables or disables scheduling of steering writes to the PWM period of the 50 Hz steering board. When
+     * enabled, steering updates are written at most once per period, shortly before the next pulse. Only
+     * available with the separate steering board; on JetRacer Pro steering shares the fast throttle board.
+     *  @param enabled true to enable the scheduling.
+     *  @param lead how long before the next PWM period the steering is written, in microseconds.
+     *  @return true if the scheduling is in the requested state.
+     */
+    bool setOutputScheduling(const bool enabled, const uint32_t lead = 1500);
+
+    /**
+     *  @return statistics of the steering output scheduler.
+     */
+    OutputSchedulerStatistics getOutputSchedulerStatistics() const;
+
+protected:
+    bool setOutputsAsleep(const bool asleep) override;
+    bool applyRealtimeProfile(const RealtimeProfile& profile) override;
 
 private:
+    /**
+     * Writes new steering to the steering motor, or queues it on the output scheduler. Must be called with
+     * mSteeringMutex locked.
+     *  @param steering new steering value.
+     *  @return COMMAND_WRITTEN or COMMAND_FAILED, COMMAND_DEFERRED if the steering was queued.
+     */
+    CommandStatus applySteering(const float steering);
+
+#ifdef JETRACER_PRO
+    /**
+     * Writes new steering and throttle to the servos in a single transaction, stopping the throttle first if the
+     * direction changes. Must be called with mMutex and mSteeringMutex locked.
+     *  @param steering new steering value.
+     *  @param throttle new throttle value.
+     *  @return true if both were written successfully.
+     */
+    bool applyCommands(const float steering, const float throttle);
+#endif
+
+    /**
+     * Writes new throttle to the drive motors, stopping them first if the direction changes. Must be
+     * called with mMutex locked.
+     *  @param throttle new throttle value.
+     *  @return true if the throttle was written successfully.
+     */
+    bool applyThrottle(const float throttle);
+
 #ifdef JETRACER_PRO
     /** Object for controlling throttle motor. */
     ContinuousServo mThrottleMotor;
+    /** The duty cycle of the throttle motor at zero throttle, computed once initialised. */
+    uint16_t mStopDutyCycle;
 #else
     /** PCA9685 board which controls steering motor. */
     PCA9685 mSteeringPCA;
@@ -58,4 +108,8 @@ private:
     ContinuousServo mSteeringMotor;
     /** Mutex for accessing steering. */
     mutable pthread_mutex_t mSteeringMutex;
+#ifndef JETRACER_PRO
+    /** Scheduler of steering writes, used only when enabled. */
+    OutputScheduler mSteeringScheduler;
+#endif
 };
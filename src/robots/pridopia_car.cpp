@@ -21,7 +21,10 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <cmath>
+#include "metrics.h"
 #include "pridopia_car.h"
+#include "profiler.h"
+#include "trace.h"
 
 
 PridopiaCar::PridopiaCar(const float steeringGain, const float steeringOffset, const float throttleGain)
@@ -31,6 +34,7 @@ PridopiaCar::PridopiaCar(const float steeringGain, const float steeringOffset, c
 
 PridopiaCar::~PridopiaCar()
 {
+    stopBackgroundThreads();
     setSteering(0.0f);
     setThrottle(0.0f);
     mThrottlePCA.setGPIO(2, false);
@@ -43,94 +47,147 @@ bool PridopiaCar::initialise(const char* devicePath)
     bool flag = ARobotBase::initialise(devicePath);
     if (flag)
     {
-        mThrottlePCA.setGPIO(2, true);
-        mThrottlePCA.setGPIO(8, true);
+        flag &= mThrottlePCA.setGPIO(2, true);
+        flag &= mThrottlePCA.setGPIO(8, true);
     }
     return flag;
 }
 
 void PridopiaCar::setSteering(const float steering)
 {
-    ScopedLock lock(mMutex);
+    TRACE_SPAN("PridopiaCar::setSteering");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptSteering(steering) || !handleIdle(steering, 0.0f))
+    {
+        return;
+    }
+    TRACE_LOCK(lock, mMutex);
+    bool flag = true;
     if (checkValue(steering * mSteeringGain, mSteering))
     {
-        commandWheels(0.0, 0.0);
+        TRACE_SPAN("stop before reverse");
+        flag &= commandWheels(0.0, 0.0);
     }
 
     mSteering = clip(steering) * mSteeringGain;
-    commandWheels(mThrottle, mSteering);
+    flag &= commandWheels(mThrottle, mSteering);
+    recordCommand(flag, mSteering, mThrottle);
 }
 
 void PridopiaCar::setThrottle(const float throttle)
 {
-    ScopedLock lock(mMutex);
+    TRACE_SPAN("PridopiaCar::setThrottle");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptThrottle(throttle) || !handleIdle(0.0f, throttle))
+    {
+        return;
+    }
+    TRACE_LOCK(lock, mMutex);
+    bool flag = true;
     if (checkValue(throttle * mThrottleGain, mThrottle))
     {
-        commandWheels(0.0, 0.0);
+        TRACE_SPAN("stop before reverse");
+        flag &= commandWheels(0.0, 0.0);
     }
 
     mThrottle = clip(throttle) * mThrottleGain;
-    commandWheels(mThrottle, mSteering);
+    flag &= commandWheels(mThrottle, mSteering);
+    recordCommand(flag, mSteering, mThrottle);
 }
 
 void PridopiaCar::update(const DriveCommands& driveCommands)
 {
-    ScopedLock lock(mMutex);
+    TRACE_SPAN("PridopiaCar::update");
+    PROFILE_STAGE(STAGE_COMMAND_APPLY);
+    Metrics::getInstance().commandReceived();
+    if (!acceptCommand(driveCommands) ||
+        !handleIdle(driveCommands.mSteering, driveCommands.mThrottle, driveCommands.mTimestamp))
+    {
+        return;
+    }
+
+    TRACE_LOCK(lock, mMutex);
+    bool flag = true;
     if (checkValue(driveCommands.mThrottle * mThrottleGain, mThrottle) ||
         checkValue(driveCommands.mSteering * mSteeringGain, mSteering))
     {
-        commandWheels(0.0, 0.0);
+        TRACE_SPAN("stop before reverse");
+        flag &= commandWheels(0.0, 0.0);
     }
     mSteering = clip(driveCommands.mSteering) * mSteeringGain;
     mThrottle = clip(driveCommands.mThrottle) * mThrottleGain;
-    commandWheels(mThrottle, mSteering);
+    flag &= commandWheels(mThrottle, mSteering);
+    recordCommand(flag, mSteering, mThrottle, driveCommands.mTimestamp);
 }
 
-void PridopiaCar::commandWheels(const float throttle, const float steering) const
+bool PridopiaCar::applyStop()
 {
-    float angle = std::atan2(steering, throttle) + mSteeringOffset;
-    float magnitude = clip(std::sqrt(throttle * throttle + steering * steering));
-    float left  = magnitude * std::cos(angle - M_PI / 4);
-    float right = magnitude * std::cos(angle + M_PI / 4);
-    float maxVal = std::max(std::abs(left), std::abs(right));
+    ScopedLock lock(mMutex);
+    // steering drives the wheels too, so both are stopped, with the writes of commandWheels(0, 0)
+    mSteering = 0.0f;
+    mThrottle = 0.0f;
+    resetMotionProfile(0.0f, 0.0f);
+    bool flag = mThrottlePCA.setGPIO( 9, false);
+    flag &= mThrottlePCA.setGPIO(10, false);
+    flag &= mThrottlePCA.setGPIO( 3, false);
+    flag &= mThrottlePCA.setGPIO( 4, false);
+    return flag;
+}
 
-    if (maxVal > 1.0f)
+bool PridopiaCar::commandWheels(const float throttle, const float steering) const
+{
+    bool flag = true;
+    float left;
+    float right;
     {
-        left /= maxVal;
-        right /= maxVal;
+        PROFILE_STAGE(STAGE_MIXING);
+        float angle = std::atan2(steering, throttle) + mSteeringOffset;
+        float magnitude = clip(std::sqrt(throttle * throttle + steering * steering));
+        left  = magnitude * std::cos(angle - M_PI / 4);
+        right = magnitude * std::cos(angle + M_PI / 4);
+        float maxVal = std::max(std::abs(left), std::abs(right));
+
+        if (maxVal > 1.0f)
+        {
+            left /= maxVal;
+            right /= maxVal;
+        }
     }
 
     // motor 1 (8, 9, 10)
     if (left > 0)
     {
-        mThrottlePCA.setDutyCycle( 9, static_cast<uint16_t>(left *  0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO(10, false);
+        flag &= mThrottlePCA.setDutyCycle( 9, static_cast<uint16_t>(left *  0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(10, false);
     }
     else if (left < 0)
     {
-        mThrottlePCA.setGPIO(9, false);
-        mThrottlePCA.setDutyCycle(10, static_cast<uint16_t>(left * -0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(9, false);
+        flag &= mThrottlePCA.setDutyCycle(10, static_cast<uint16_t>(left * -0x0FFF + 0.5f));
     }
     else
     {
-        mThrottlePCA.setGPIO( 9, false);
-        mThrottlePCA.setGPIO(10, false);
+        flag &= mThrottlePCA.setGPIO( 9, false);
+        flag &= mThrottlePCA.setGPIO(10, false);
     }
 
     // motor 3 (2, 3, 4)
     if (right > 0)
     {
-        mThrottlePCA.setDutyCycle( 3, static_cast<uint16_t>(right *  0x0FFF + 0.5f));
-        mThrottlePCA.setGPIO( 4, false);
+        flag &= mThrottlePCA.setDutyCycle( 3, static_cast<uint16_t>(right *  0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO( 4, false);
     }
     else if (right < 0)
     {
-        mThrottlePCA.setGPIO(3, false);
-        mThrottlePCA.setDutyCycle( 4, static_cast<uint16_t>(right * -0x0FFF + 0.5f));
+        flag &= mThrottlePCA.setGPIO(3, false);
+        flag &= mThrottlePCA.setDutyCycle( 4, static_cast<uint16_t>(right * -0x0FFF + 0.5f));
     }
     else
     {
-        mThrottlePCA.setGPIO( 3, false);
-        mThrottlePCA.setGPIO( 4, false);
+        flag &= mThrottlePCA.setGPIO( 3, false);
+        flag &= mThrottlePCA.setGPIO( 4, false);
     }
+    return flag;
 }
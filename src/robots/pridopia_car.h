@@ -44,12 +44,14 @@ public:
     void setSteering(const float steering) override;
     void setThrottle(const float throttle) override;
     void update(const DriveCommands& driveCommands) override;
+    bool applyStop() override;
 
 private:
     /**
      * Commands the wheels by conveting @p throttle and @p steering to individual wheel commands.
      *  @param throttle
      *  @param steering
+     *  @return true if all wheel commands were written successfully.
      */
-    void commandWheels(const float throttle, const float steering) const;
+    bool commandWheels(const float throttle, const float steering) const;
 };
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+
+class VirtualBus;
+
+/**
+ * Drop-in replacement of the I2C class used when the library is built for simulation. It has the same
+ * interface as the hardware implementation, but transfers go to a VirtualBus registered under the device
+ * path passed to openSerialPort instead of a Linux I2C device.
+ */
+class I2C
+{
+public:
+    /**
+     * Basic constructor, the object is not connected to any bus.
+     */
+    I2C();
+
+    /**
+     * Basic destructor.
+     */
+    virtual ~I2C();
+
+    /**
+     * Connects to the virtual bus registered under @p devicePath.
+     *  @param devicePath the name of the virtual bus, e.g. "sim0".
+     *  @return true if such a bus exists.
+     */
+    bool openSerialPort(const char* devicePath);
+
+    /**
+     * Reads a single register of a device.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to read.
+     *  @return the value of the register, 0 if not connected.
+     */
+    uint8_t readByte(const uint8_t deviceAddress, const uint8_t registerAddress) const;
+
+    /**
+     * Writes a single register of a device.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to write.
+     *  @param data the new value of the register.
+     *  @return true if the write succeeded.
+     */
+    bool writeByte(const uint8_t deviceAddress, const uint8_t registerAddress, const uint8_t data) const;
+
+private:
+    /** The bus this object is connected to. */
+    VirtualBus* mBus;
+};
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <generic_listener.h>
+#include <i2c.h>
+#include "simulated_power_monitor.h"
+
+/** The voltage of the least significant bit of the bus voltage register in volts. */
+static constexpr float BUS_VOLTAGE_LSB = 0.004f;
+
+
+SimulatedPowerMonitor::SimulatedPowerMonitor(const uint8_t address, const uint32_t period, const float shuntResistance,
+                                             const float maxCurrent)
+: AAuxiliaryDevice("INA219", address),
+  mPeriod(static_cast<int64_t>(period) * 1000000),
+  mCalibration(0),
+  mCurrentLsb(maxCurrent / 32768.0f),
+  mStep(WRITE_CALIBRATION_HIGH),
+  mNextSample(0),
+  mVoltageRaw(0),
+  mCurrentRaw(0),
+  mReading()
+{
+    // the calibration equation of the INA219 data sheet
+    mCalibration = static_cast<uint16_t>(0.04096f / (mCurrentLsb * shuntResistance));
+    pthread_mutex_init(&mMutex, nullptr);
+}
+
+SimulatedPowerMonitor::~SimulatedPowerMonitor()
+{
+    pthread_mutex_destroy(&mMutex);
+}
+
+PowerReading SimulatedPowerMonitor::getReading() const
+{
+    ScopedLock lock(mMutex);
+    return mReading;
+}
+
+int64_t SimulatedPowerMonitor::getNextDue() const
+{
+    ScopedLock lock(mMutex);
+    // a started sample is finished as soon as possible, so that its bytes are read close together
+    return (READ_VOLTAGE_HIGH == mStep) ? mNextSample : 0;
+}
+
+bool SimulatedPowerMonitor::transfer(const I2C& bus, const int64_t now)
+{
+    ScopedLock lock(mMutex);
+    bool flag = true;
+    const uint8_t address = getAddress();
+
+    switch (mStep)
+    {
+    case WRITE_CALIBRATION_HIGH:
+        flag = bus.writeByte(address, 2 * REGISTER_CALIBRATION, static_cast<uint8_t>(mCalibration >> 8));
+        break;
+    case WRITE_CALIBRATION_LOW:
+        flag = bus.writeByte(address, 2 * REGISTER_CALIBRATION + 1, static_cast<uint8_t>(mCalibration & 0xFF));
+        break;
+    case READ_VOLTAGE_HIGH:
+        mVoltageRaw = static_cast<uint16_t>(bus.readByte(address, 2 * REGISTER_BUS_VOLTAGE) << 8);
+        break;
+    case READ_VOLTAGE_LOW:
+        mVoltageRaw |= bus.readByte(address, 2 * REGISTER_BUS_VOLTAGE + 1);
+        break;
+    case READ_CURRENT_HIGH:
+        mCurrentRaw = static_cast<uint16_t>(bus.readByte(address, 2 * REGISTER_CURRENT) << 8);
+        break;
+    case READ_CURRENT_LOW:
+        mCurrentRaw |= bus.readByte(address, 2 * REGISTER_CURRENT + 1);
+        // the voltage is in the upper 13 bits, and the current is signed
+        mReading.mVoltage   = static_cast<float>(mVoltageRaw >> 3) * BUS_VOLTAGE_LSB;
+        mReading.mCurrent   = static_cast<float>(static_cast<int16_t>(mCurrentRaw)) * mCurrentLsb;
+        mReading.mPower     = mReading.mVoltage * mReading.mCurrent;
+        mReading.mTimestamp = now;
+        mNextSample = mNextSample + mPeriod > now ? mNextSample + mPeriod : now + mPeriod;
+        mStep = READ_VOLTAGE_HIGH;
+        return true;
+    }
+    if (flag)
+    {
+        mStep = static_cast<Step>(mStep + 1);
+    }
+    return flag;
+}
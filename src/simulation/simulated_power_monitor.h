@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <pthread.h>
+#include "auxiliary/auxiliary_device.h"
+
+/**
+ * A reading of a power monitor.
+ */
+struct PowerReading
+{
+    /** The bus voltage in volts. */
+    float mVoltage;
+    /** The current in amperes. */
+    float mCurrent;
+    /** The power in watts. */
+    float mPower;
+    /** Time of the reading in nanoseconds, 0 before the first reading. */
+    int64_t mTimestamp;
+};
+
+/**
+ * Simulation-only stand-in of an INA219 power monitor on an auxiliary bus, built only into the simulation variants of
+ * the library. The I2C class transfers single registers of a byte, while the INA219 only has 16-bit registers which
+ * are read and written in one transaction each, so this is not a driver of a real monitor. Instead, it exercises the
+ * auxiliary bus against a VirtualBus which holds the registers of the INA219 as pairs of byte registers, most
+ * significant byte first, at twice the register address of the INA219. It calibrates the monitor once, and then
+ * samples the bus voltage and the current every period, one byte per transaction.
+ */
+class SimulatedPowerMonitor : public AAuxiliaryDevice
+{
+public:
+    /**
+     * Basic constructor.
+     *  @param address the address of the monitor.
+     *  @param period the sampling period in milliseconds.
+     *  @param shuntResistance the resistance of the shunt in ohms.
+     *  @param maxCurrent the largest expected current in amperes, which sets the resolution of the current.
+     */
+    SimulatedPowerMonitor(const uint8_t address = 0x41, const uint32_t period = 100, const float shuntResistance = 0.1f,
+                 const float maxCurrent = 3.2f);
+
+    /**
+     * Basic destructor.
+     */
+    virtual ~SimulatedPowerMonitor();
+
+    /**
+     *  @return the latest complete reading.
+     */
+    PowerReading getReading() const;
+
+    int64_t getNextDue() const override;
+
+    bool transfer(const I2C& bus, const int64_t now) override;
+
+    /** Addresses of the 16-bit registers of the INA219. */
+    static constexpr uint8_t REGISTER_BUS_VOLTAGE = 0x02;
+    static constexpr uint8_t REGISTER_CURRENT     = 0x04;
+    static constexpr uint8_t REGISTER_CALIBRATION = 0x05;
+
+private:
+    /** Steps of the transfer sequence, the calibration is written only once. */
+    enum Step : uint8_t
+    {
+        WRITE_CALIBRATION_HIGH,
+        WRITE_CALIBRATION_LOW,
+        READ_VOLTAGE_HIGH,
+        READ_VOLTAGE_LOW,
+        READ_CURRENT_HIGH,
+        READ_CURRENT_LOW
+    };
+
+    /** The sampling period in nanoseconds. */
+    const int64_t mPeriod;
+    /** The value of the calibration register. */
+    uint16_t mCalibration;
+    /** The current of the least significant bit of the current register in amperes. */
+    float mCurrentLsb;
+    /** The next step of the transfer sequence. */
+    Step mStep;
+    /** Time at which the next sample starts. */
+    int64_t mNextSample;
+    /** Raw registers of the sample being read. */
+    uint16_t mVoltageRaw;
+    uint16_t mCurrentRaw;
+    /** The latest complete reading. */
+    PowerReading mReading;
+    /** Mutex for accessing the reading and the state of the sequence. */
+    mutable pthread_mutex_t mMutex;
+};
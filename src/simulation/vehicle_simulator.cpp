@@ -0,0 +1,178 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "vehicle_simulator.h"
+#include "virtual_bus.h"
+
+/** Register addresses of PCA9685 used for decoding. */
+static constexpr uint8_t LED0_ON_L = 0x06;
+static constexpr uint8_t PRESCALE  = 0xFE;
+/** Addresses of the PCA9685 boards, as used by the robot classes. */
+static constexpr uint8_t STEERING_BOARD = 0x40;
+static constexpr uint8_t THROTTLE_BOARD = 0x60;
+/** Scaled reference clock of PCA9685, the same as used by the PCA9685 class. */
+static constexpr float REFERENCE_CLK_SPEED_SCALED = static_cast<float>(25000000.0 / 4096.0);
+/** Conversion from microseconds to duty counts per Hz, the same as used by ContinuousServo. */
+static constexpr float OFFSET = 0x0FFF / 1000000.0f;
+/** Default pulse range of ContinuousServo in microseconds. */
+static constexpr float MIN_PULSE = 750.0f;
+static constexpr float MAX_PULSE = 2250.0f;
+
+
+VehicleSimulator::VehicleSimulator() : mTime(0.0)
+{
+}
+
+VehicleSimulator::~VehicleSimulator()
+{
+}
+
+size_t VehicleSimulator::addVehicle(const VehicleModel model, const VirtualBus* bus, const VehicleParameters& parameters,
+                                    const VehicleState& initial)
+{
+    mModel.push_back(model);
+    mBus.push_back(bus);
+    mInputA.push_back(0.0f);
+    mInputB.push_back(0.0f);
+    mSpeedA.push_back(initial.mSpeed);
+    mSpeedB.push_back(initial.mSpeed);
+    mX.push_back(initial.mX);
+    mY.push_back(initial.mY);
+    mHeading.push_back(initial.mHeading);
+    mMaxSpeed.push_back(parameters.mMaxSpeed);
+    mTimeConstant.push_back(parameters.mTimeConstant);
+    mWheelbase.push_back(parameters.mWheelbase);
+    mMaxSteeringAngle.push_back(parameters.mMaxSteeringAngle);
+    mTrack.push_back(parameters.mTrack);
+    return mModel.size() - 1;
+}
+
+void VehicleSimulator::step(const float dt)
+{
+    const size_t count = mModel.size();
+    float response;
+    float speed;
+    float yawRate;
+
+    decodeInputs();
+    for (size_t i = 0; i < count; ++i)
+    {
+        response = dt / (mTimeConstant[i] + dt);
+        if (VEHICLE_PRIDOPIA == mModel[i])
+        {
+            mSpeedA[i] += (mInputA[i] * mMaxSpeed[i] - mSpeedA[i]) * response;
+            mSpeedB[i] += (mInputB[i] * mMaxSpeed[i] - mSpeedB[i]) * response;
+            speed   = 0.5f * (mSpeedA[i] + mSpeedB[i]);
+            yawRate = (mSpeedB[i] - mSpeedA[i]) / mTrack[i];
+        }
+        else
+        {
+            mSpeedA[i] += (mInputB[i] * mMaxSpeed[i] - mSpeedA[i]) * response;
+            speed   = mSpeedA[i];
+            yawRate = speed / mWheelbase[i] * std::tan(mInputA[i] * mMaxSteeringAngle[i]);
+        }
+        mHeading[i] += yawRate * dt;
+        mX[i] += speed * std::cos(mHeading[i]) * dt;
+        mY[i] += speed * std::sin(mHeading[i]) * dt;
+    }
+    mTime += dt;
+}
+
+void VehicleSimulator::run(const double duration, const float dt)
+{
+    const double end = mTime + duration;
+    while (mTime + 0.5 * dt < end)
+    {
+        step(dt);
+    }
+}
+
+VehicleState VehicleSimulator::getState(const size_t index) const
+{
+    VehicleState state;
+    state.mX       = mX[index];
+    state.mY       = mY[index];
+    state.mHeading = mHeading[index];
+    state.mSpeed   = (VEHICLE_PRIDOPIA == mModel[index]) ? 0.5f * (mSpeedA[index] + mSpeedB[index]) : mSpeedA[index];
+    return state;
+}
+
+float VehicleSimulator::decodeDuty(const VirtualBus* bus, const uint8_t deviceAddress, const uint8_t channel)
+{
+    uint8_t base = LED0_ON_L + 4 * channel;
+    uint16_t on  = bus->peek(deviceAddress, base)     | (bus->peek(deviceAddress, base + 1) << 8);
+    uint16_t off = bus->peek(deviceAddress, base + 2) | (bus->peek(deviceAddress, base + 3) << 8);
+    if (on & 0x1000)
+    {
+        return 1.0f;
+    }
+    if (off & 0x1000)
+    {
+        return 0.0f;
+    }
+    return static_cast<float>((off - on) & 0x0FFF) / static_cast<float>(0x0FFF);
+}
+
+float VehicleSimulator::decodeServo(const VirtualBus* bus, const uint8_t deviceAddress, const uint8_t channel)
+{
+    uint8_t prescale = bus->peek(deviceAddress, PRESCALE);
+    if (0 == prescale)
+    {
+        return 0.0f;
+    }
+    float frequency = REFERENCE_CLK_SPEED_SCALED / static_cast<float>(prescale);
+    float minDuty   = MIN_PULSE * frequency * OFFSET;
+    float dutyRange = (MAX_PULSE - MIN_PULSE) * frequency * OFFSET;
+    float fraction  = (decodeDuty(bus, deviceAddress, channel) * 0x0FFF - minDuty) / dutyRange;
+    return fmaxf(-1.0f, fminf(1.0f, fraction * 2.0f - 1.0f));
+}
+
+void VehicleSimulator::decodeInputs()
+{
+    const size_t count = mModel.size();
+    const VirtualBus* bus;
+    float duty;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        bus = mBus[i];
+        switch (mModel[i])
+        {
+            case VEHICLE_JETRACER:
+                // the direction is selected by channels 1 and 2 of the throttle board, see NvidiaRacer::setThrottle
+                duty = decodeDuty(bus, THROTTLE_BOARD, 0);
+                mInputA[i] = decodeServo(bus, STEERING_BOARD, 0);
+                mInputB[i] = (decodeDuty(bus, THROTTLE_BOARD, 1) > 0.5f) ? duty : (decodeDuty(bus, THROTTLE_BOARD, 2) > 0.5f) ? -duty : 0.0f;
+                break;
+            case VEHICLE_JETRACER_PRO:
+                mInputA[i] = decodeServo(bus, THROTTLE_BOARD, 0);
+                mInputB[i] = decodeServo(bus, THROTTLE_BOARD, 1);
+                break;
+            case VEHICLE_PRIDOPIA:
+                // left motor on channels 9 and 10, right motor on channels 3 and 4, see PridopiaCar::commandWheels
+                mInputA[i] = decodeDuty(bus, THROTTLE_BOARD,  9) - decodeDuty(bus, THROTTLE_BOARD, 10);
+                mInputB[i] = decodeDuty(bus, THROTTLE_BOARD,  3) - decodeDuty(bus, THROTTLE_BOARD,  4);
+                break;
+        }
+    }
+}
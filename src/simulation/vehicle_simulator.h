@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class VirtualBus;
+
+/**
+ * Vehicle layouts which can be simulated, matching the register layouts written by the robot classes.
+ */
+enum VehicleModel
+{
+    /** NvidiaRacer with a separate steering board, bicycle (Ackermann) kinematics. */
+    VEHICLE_JETRACER,
+    /** NvidiaRacer built with JETRACER_PRO, steering and throttle servos on one board. */
+    VEHICLE_JETRACER_PRO,
+    /** PridopiaCar, differential drive kinematics. */
+    VEHICLE_PRIDOPIA
+};
+
+/**
+ * Physical parameters of a simulated vehicle.
+ */
+struct VehicleParameters
+{
+    /** Speed at full throttle in m/s. */
+    float mMaxSpeed;
+    /** Time constant of the first-order speed response in seconds. */
+    float mTimeConstant;
+    /** Distance between the axles in metres (bicycle model). */
+    float mWheelbase;
+    /** Steering angle at full steering in radians (bicycle model). */
+    float mMaxSteeringAngle;
+    /** Distance between the wheels in metres (differential model). */
+    float mTrack;
+
+    /**
+     * Basic constructor with values of a typical 1:18 JetRacer.
+     */
+    VehicleParameters(const float maxSpeed = 3.0f, const float timeConstant = 0.2f, const float wheelbase = 0.15f,
+                      const float maxSteeringAngle = 0.5f, const float track = 0.14f)
+      : mMaxSpeed(maxSpeed), mTimeConstant(timeConstant), mWheelbase(wheelbase),
+        mMaxSteeringAngle(maxSteeringAngle), mTrack(track) {};
+};
+
+/**
+ * Pose and speed of a simulated vehicle.
+ */
+struct VehicleState
+{
+    /** Position along the x axis in metres. */
+    float mX;
+    /** Position along the y axis in metres. */
+    float mY;
+    /** Heading in radians. */
+    float mHeading;
+    /** Forward speed in m/s. */
+    float mSpeed;
+};
+
+/**
+ * Headless simulator of many vehicles driven by the real robot classes through virtual buses. On every
+ * step it decodes the PWM registers which the robots wrote, and integrates vehicle kinematics with a virtual
+ * clock, so it runs as fast as the CPU allows. Vehicle state is kept in a structure-of-arrays layout and
+ * all vehicles are updated together in batched passes.
+ */
+class VehicleSimulator
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     */
+    VehicleSimulator();
+
+    /**
+     * Class destructor.
+     */
+    virtual ~VehicleSimulator();
+
+    /**
+     * Adds a vehicle whose robot writes to @p bus.
+     *  @param model the layout of the vehicle.
+     *  @param bus the virtual bus of the vehicle's robot.
+     *  @param parameters physical parameters of the vehicle.
+     *  @param initial the initial state of the vehicle.
+     *  @return index of the new vehicle.
+     */
+    size_t addVehicle(const VehicleModel model, const VirtualBus* bus, const VehicleParameters& parameters = VehicleParameters(),
+                      const VehicleState& initial = VehicleState());
+
+    /**
+     * Advances the virtual clock by @p dt and updates all vehicles.
+     *  @param dt the time step in seconds.
+     */
+    void step(const float dt);
+
+    /**
+     * Advances the virtual clock by @p duration in steps of @p dt.
+     *  @param duration the simulated time in seconds.
+     *  @param dt the time step in seconds.
+     */
+    void run(const double duration, const float dt);
+
+    /**
+     *  @param index index of the vehicle.
+     *  @return the current state of the vehicle.
+     */
+    VehicleState getState(const size_t index) const;
+
+    /**
+     *  @return the number of vehicles.
+     */
+    inline size_t getVehicleCount() const
+    {
+        return mModel.size();
+    }
+
+    /**
+     *  @return the virtual time in seconds.
+     */
+    inline double getTime() const
+    {
+        return mTime;
+    }
+
+    /**
+     * Decodes the output of a PCA9685 channel as a fraction of the PWM period.
+     *  @param bus the virtual bus.
+     *  @param deviceAddress the address of the PCA9685.
+     *  @param channel the channel to decode.
+     *  @return the fraction of the period during which the output is high, from 0 to 1.
+     */
+    static float decodeDuty(const VirtualBus* bus, const uint8_t deviceAddress, const uint8_t channel);
+
+    /**
+     * Decodes the output of a servo channel as a value from -1 to 1, as set with ContinuousServo::setThrottle.
+     *  @param bus the virtual bus.
+     *  @param deviceAddress the address of the PCA9685.
+     *  @param channel the channel to decode.
+     *  @return the servo value, 0 if the board has not been configured.
+     */
+    static float decodeServo(const VirtualBus* bus, const uint8_t deviceAddress, const uint8_t channel);
+
+private:
+    /**
+     * Decodes inputs of all vehicles from their buses into mInputA and mInputB.
+     */
+    void decodeInputs();
+
+    /** The virtual time in seconds. */
+    double mTime;
+    /** Layouts of vehicles. */
+    std::vector<VehicleModel> mModel;
+    /** Buses of vehicles. */
+    std::vector<const VirtualBus*> mBus;
+    /** Steering (bicycle) or left wheel (differential) input from -1 to 1. */
+    std::vector<float> mInputA;
+    /** Throttle (bicycle) or right wheel (differential) input from -1 to 1. */
+    std::vector<float> mInputB;
+    /** Speed (bicycle) or left wheel speed (differential) in m/s. */
+    std::vector<float> mSpeedA;
+    /** Unused (bicycle) or right wheel speed (differential) in m/s. */
+    std::vector<float> mSpeedB;
+    /** Positions along the x axis. */
+    std::vector<float> mX;
+    /** Positions along the y axis. */
+    std::vector<float> mY;
+    /** Headings. */
+    std::vector<float> mHeading;
+    /** Parameters of vehicles. */
+    std::vector<float> mMaxSpeed;
+    std::vector<float> mTimeConstant;
+    std::vector<float> mWheelbase;
+    std::vector<float> mMaxSteeringAngle;
+    std::vector<float> mTrack;
+};
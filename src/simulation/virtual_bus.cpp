@@ -0,0 +1,196 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include "i2c.h"
+#include "time_utils.h"
+#include "virtual_bus.h"
+
+namespace
+{
+
+/** The maximum number of virtual buses which can exist at the same time. */
+constexpr int MAX_BUSES = 64;
+/** Registered buses. */
+VirtualBus* gBuses[MAX_BUSES] = {};
+/** Names of registered buses. */
+const char* gNames[MAX_BUSES] = {};
+/** Mutex protecting the registry. */
+pthread_mutex_t gRegistryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+} // namespace
+
+
+I2C::I2C() : mBus(nullptr)
+{
+}
+
+I2C::~I2C()
+{
+}
+
+bool I2C::openSerialPort(const char* devicePath)
+{
+    mBus = VirtualBus::find(devicePath);
+    return nullptr != mBus;
+}
+
+uint8_t I2C::readByte(const uint8_t deviceAddress, const uint8_t registerAddress) const
+{
+    return (nullptr != mBus) ? mBus->read(deviceAddress, registerAddress) : 0;
+}
+
+bool I2C::writeByte(const uint8_t deviceAddress, const uint8_t registerAddress, const uint8_t data) const
+{
+    return (nullptr != mBus) && mBus->write(deviceAddress, registerAddress, data);
+}
+
+VirtualBus::VirtualBus(const char* name)
+: mName(name),
+  mRegisters(),
+  mRecording(false),
+  mFailures(0),
+  mWrites(0),
+  mAccessTime(0)
+{
+    pthread_mutex_init(&mMutex, nullptr);
+    pthread_mutex_lock(&gRegistryMutex);
+    for (int i = 0; i < MAX_BUSES; ++i)
+    {
+        if (nullptr == gBuses[i])
+        {
+            gBuses[i] = this;
+            gNames[i] = name;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gRegistryMutex);
+}
+
+VirtualBus::~VirtualBus()
+{
+    pthread_mutex_lock(&gRegistryMutex);
+    for (int i = 0; i < MAX_BUSES; ++i)
+    {
+        if (this == gBuses[i])
+        {
+            gBuses[i] = nullptr;
+            gNames[i] = nullptr;
+        }
+    }
+    pthread_mutex_unlock(&gRegistryMutex);
+    pthread_mutex_destroy(&mMutex);
+}
+
+VirtualBus* VirtualBus::find(const char* name)
+{
+    VirtualBus* bus = nullptr;
+    pthread_mutex_lock(&gRegistryMutex);
+    for (int i = 0; nullptr == bus && i < MAX_BUSES; ++i)
+    {
+        if (nullptr != gBuses[i] && 0 == strcmp(gNames[i], name))
+        {
+            bus = gBuses[i];
+        }
+    }
+    pthread_mutex_unlock(&gRegistryMutex);
+    return bus;
+}
+
+uint8_t VirtualBus::read(const uint8_t deviceAddress, const uint8_t registerAddress)
+{
+    pthread_mutex_lock(&mMutex);
+    occupy();
+    uint8_t value = mRegisters[deviceAddress & (ADDRESSES - 1)][registerAddress];
+    if (mRecording)
+    {
+        mRecord.push_back({deviceAddress, registerAddress, value, false});
+    }
+    pthread_mutex_unlock(&mMutex);
+    return value;
+}
+
+bool VirtualBus::write(const uint8_t deviceAddress, const uint8_t registerAddress, const uint8_t value)
+{
+    bool flag = true;
+    pthread_mutex_lock(&mMutex);
+    occupy();
+    if (mFailures > 0)
+    {
+        --mFailures;
+        flag = false;
+    }
+    else
+    {
+        mRegisters[deviceAddress & (ADDRESSES - 1)][registerAddress] = value;
+        ++mWrites;
+        if (mRecording)
+        {
+            mRecord.push_back({deviceAddress, registerAddress, value, true});
+        }
+    }
+    pthread_mutex_unlock(&mMutex);
+    return flag;
+}
+
+void VirtualBus::failWrites(const uint32_t count)
+{
+    pthread_mutex_lock(&mMutex);
+    mFailures = count;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void VirtualBus::setAccessTime(const uint32_t accessTime)
+{
+    pthread_mutex_lock(&mMutex);
+    mAccessTime = accessTime;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void VirtualBus::occupy() const
+{
+    if (mAccessTime > 0)
+    {
+        // spin rather than sleep, a real transfer keeps the calling thread busy for its whole duration
+        int64_t end = getMonotonicTime() + mAccessTime;
+        while (getMonotonicTime() < end)
+        {
+            ;
+        }
+    }
+}
+
+void VirtualBus::setRecording(const bool record)
+{
+    pthread_mutex_lock(&mMutex);
+    mRecording = record;
+    mRecord.clear();
+    pthread_mutex_unlock(&mMutex);
+}
+
+void VirtualBus::takeRecord(std::vector<BusAccess>& accesses)
+{
+    pthread_mutex_lock(&mMutex);
+    accesses.swap(mRecord);
+    mRecord.clear();
+    pthread_mutex_unlock(&mMutex);
+}
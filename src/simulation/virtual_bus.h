@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstdint>
+#include <pthread.h>
+#include <vector>
+
+
+/**
+ * A single register access recorded by a virtual bus.
+ */
+struct BusAccess
+{
+    /** The address of the device. */
+    uint8_t mDeviceAddress;
+    /** The register which was accessed. */
+    uint8_t mRegister;
+    /** The value which was written or read. */
+    uint8_t mValue;
+    /** True for writes, false for reads. */
+    bool mWrite;
+};
+
+/**
+ * An in-process I2C bus with register-mapped devices at all addresses. Simulated I2C objects connect to it by
+ * its name. Register contents can be inspected to decode what the robots wrote, accesses can be recorded, and
+ * write failures can be injected.
+ */
+class VirtualBus
+{
+public:
+    /** The number of 7-bit addresses on the bus. */
+    static constexpr uint8_t ADDRESSES = 128;
+
+    /**
+     * Class constructor, registers the bus under @p name.
+     *  @param name the name under which I2C objects find this bus, must outlive the bus.
+     */
+    VirtualBus(const char* name);
+
+    /**
+     * Class destructor, unregisters the bus.
+     */
+    virtual ~VirtualBus();
+
+    /**
+     * Finds a bus by its name.
+     *  @param name the name of the bus.
+     *  @return the bus, or nullptr if not found.
+     */
+    static VirtualBus* find(const char* name);
+
+    /**
+     * Reads a register and records the access if recording is enabled.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to read.
+     *  @return the value of the register.
+     */
+    uint8_t read(const uint8_t deviceAddress, const uint8_t registerAddress);
+
+    /**
+     * Writes a register and records the access if recording is enabled.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to write.
+     *  @param value the new value of the register.
+     *  @return false if the write failed due to an injected fault.
+     */
+    bool write(const uint8_t deviceAddress, const uint8_t registerAddress, const uint8_t value);
+
+    /**
+     * Returns the value of a register without recording the access.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to peek.
+     *  @return the value of the register.
+     */
+    inline uint8_t peek(const uint8_t deviceAddress, const uint8_t registerAddress) const
+    {
+        return mRegisters[deviceAddress & (ADDRESSES - 1)][registerAddress];
+    }
+
+    /**
+     * Sets the value of a register without recording the access, e.g. to simulate a board reset.
+     *  @param deviceAddress the address of the device.
+     *  @param registerAddress the register to poke.
+     *  @param value the new value of the register.
+     */
+    inline void poke(const uint8_t deviceAddress, const uint8_t registerAddress, const uint8_t value)
+    {
+        mRegisters[deviceAddress & (ADDRESSES - 1)][registerAddress] = value;
+    }
+
+    /**
+     * Makes the next @p count writes fail without changing any register.
+     *  @param count the number of writes which should fail.
+     */
+    void failWrites(const uint32_t count);
+
+    /**
+     * Sets the time each access occupies the bus, to simulate a slower bus. For reference, a single register
+     * write at 100 kHz takes about 300 us, and at 400 kHz about 75 us.
+     *  @param accessTime the time of an access in nanoseconds, 0 for instant accesses.
+     */
+    void setAccessTime(const uint32_t accessTime);
+
+    /**
+     * Enables or disables recording of accesses. Enabling clears previous records.
+     *  @param record true to record accesses.
+     */
+    void setRecording(const bool record);
+
+    /**
+     * Moves recorded accesses to @p accesses and clears the records.
+     *  @param[out] accesses recorded accesses in order.
+     */
+    void takeRecord(std::vector<BusAccess>& accesses);
+
+    /**
+     *  @return the number of writes since the bus was created.
+     */
+    inline uint64_t getWriteCount() const
+    {
+        return mWrites;
+    }
+
+private:
+    /**
+     * Occupies the bus for the access time, must be called with mMutex locked.
+     */
+    void occupy() const;
+
+    /** The name of the bus. */
+    const char* mName;
+    /** Register files of all devices. */
+    uint8_t mRegisters[ADDRESSES][256];
+    /** Recorded accesses. */
+    std::vector<BusAccess> mRecord;
+    /** Flag indicating if accesses are recorded. */
+    bool mRecording;
+    /** The number of writes which should fail. */
+    uint32_t mFailures;
+    /** The number of writes. */
+    uint64_t mWrites;
+    /** The time each access occupies the bus in nanoseconds. */
+    int64_t mAccessTime;
+    /** Mutex serialising accesses, like the kernel does for a real bus. */
+    pthread_mutex_t mMutex;
+};
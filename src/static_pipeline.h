@@ -0,0 +1,538 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+/**
+ * A header-only drive pipeline composed at compile time, as an alternative to GamepadDriveAdapter and ARobotBase for
+ * applications which need the shortest path from an input event to the PWM registers. The event source, the axis
+ * conditioning, the robot model and the PWM backend are template parameters, and robot models derive from
+ * StaticRobotModel through CRTP, so the compiler can inline the whole chain into a single function per robot type.
+ * The pipeline applies commands on the calling thread only, without the age budget, rate governor, idle mode,
+ * watchdog, motion profiling or metrics of ARobotBase. Register writes are identical to those of NvidiaRacer.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <gamepad_event_data.h>
+#include "motor_controller/pca9685.h"
+
+/**
+ * Conditioning which normalises raw axis values linearly to -1 to 1.
+ */
+struct LinearConditioning
+{
+    /**
+     *  @param raw the raw value of an axis.
+     *  @return the normalised value.
+     */
+    static inline float condition(const int16_t raw)
+    {
+        // the same rounding as the scale of GamepadDriveAdapter
+        return static_cast<float>(raw) * (1.0f / 32767.0f);
+    }
+};
+
+/**
+ * Conditioning with a dead zone around the centre, given in thousandths of full scale, and linear outside of it.
+ */
+template <int Deadband>
+struct DeadbandConditioning
+{
+    static_assert(Deadband >= 0 && Deadband < 1000, "the deadband must be from 0 to 999 thousandths");
+
+    /**
+     *  @param raw the raw value of an axis.
+     *  @return the normalised value.
+     */
+    static inline float condition(const int16_t raw)
+    {
+        const float value = LinearConditioning::condition(raw);
+        const float deadband = Deadband / 1000.0f;
+        return (std::fabs(value) <= deadband) ? 0.0f : std::copysign((std::fabs(value) - deadband) / (1.0f - deadband), value);
+    }
+};
+
+/**
+ * A source which replays an array of events, e.g. a recorded session.
+ */
+class ArrayEventSource
+{
+public:
+    /**
+     * Basic constructor.
+     *  @param events the events, which must outlive the source.
+     *  @param count the number of events.
+     */
+    ArrayEventSource(const GamepadEventData* events, const size_t count)
+      : mEvents(events), mCount(count), mNext(0) {};
+
+    /**
+     * Takes the next event.
+     *  @param[out] event the next event.
+     *  @return false if there are no more events.
+     */
+    inline bool next(GamepadEventData& event)
+    {
+        if (mNext >= mCount)
+        {
+            return false;
+        }
+        event = mEvents[mNext++];
+        return true;
+    }
+
+    /**
+     * Replays the events from the beginning.
+     */
+    inline void rewind()
+    {
+        mNext = 0;
+    }
+
+private:
+    /** The events. */
+    const GamepadEventData* mEvents;
+    /** The number of events. */
+    size_t mCount;
+    /** The next event. */
+    size_t mNext;
+};
+
+/**
+ * A PWM backend which writes through PCA9685 objects, and so keeps their retries, recovery and verification.
+ * Boards are indexed in the order given to the constructor.
+ */
+class PCA9685Backend
+{
+public:
+    /**
+     * Basic constructor.
+     *  @param throttleBoard the board with index 0.
+     *  @param steeringBoard the board with index 1, if any.
+     */
+    PCA9685Backend(const PCA9685* throttleBoard, const PCA9685* steeringBoard = nullptr)
+      : mBoards{throttleBoard, steeringBoard} {};
+
+    inline bool setDutyCycle(const uint8_t board, const uint8_t channel, const uint16_t value)
+    {
+        return mBoards[board]->setDutyCycle(channel, value);
+    }
+
+    inline bool setDutyCycles(const uint8_t board, const uint8_t channel, const uint16_t* values, const uint8_t count)
+    {
+        return mBoards[board]->setDutyCycles(channel, values, count);
+    }
+
+    inline bool setGPIO(const uint8_t board, const uint8_t channel, const bool on)
+    {
+        return mBoards[board]->setGPIO(channel, on);
+    }
+
+private:
+    /** The boards. */
+    const PCA9685* mBoards[2];
+};
+
+/**
+ * A PWM backend which encodes the channel registers itself and writes them directly to the bus, without retries,
+ * recovery or statistics. The boards must be initialised, e.g. with PCA9685::reset and PCA9685::setFrequency.
+ */
+template <typename Bus>
+class DirectPwmBackend
+{
+public:
+    /** The first channel register of a PCA9685. */
+    static constexpr uint8_t LED0_REGISTER = 0x06;
+
+    /**
+     * Basic constructor.
+     *  @param bus the bus of the boards.
+     *  @param throttleAddress the address of the board with index 0.
+     *  @param steeringAddress the address of the board with index 1.
+     */
+    DirectPwmBackend(const Bus* bus, const uint8_t throttleAddress, const uint8_t steeringAddress = 0)
+      : mBus(bus), mAddresses{throttleAddress, steeringAddress} {};
+
+    inline bool setDutyCycle(const uint8_t board, const uint8_t channel, const uint16_t value)
+    {
+        return setPWM(board, channel, 0, value & 0x0FFF);
+    }
+
+    inline bool setDutyCycles(const uint8_t board, const uint8_t channel, const uint16_t* values, const uint8_t count)
+    {
+        bool flag = true;
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            flag &= setPWM(board, channel + i, 0, values[i] & 0x0FFF);
+        }
+        return flag;
+    }
+
+    inline bool setGPIO(const uint8_t board, const uint8_t channel, const bool on)
+    {
+        return setPWM(board, channel, 0x1000 * on, 0x1000 * !on);
+    }
+
+private:
+    /**
+     * Writes the ON and OFF registers of a channel, low bytes first.
+     *  @return true if all registers were written.
+     */
+    inline bool setPWM(const uint8_t board, const uint8_t channel, const uint16_t on, const uint16_t off)
+    {
+        const uint8_t reg = LED0_REGISTER + 4 * channel;
+        bool flag = mBus->writeByte(mAddresses[board], reg, static_cast<uint8_t>(on & 0xFF));
+        flag &= mBus->writeByte(mAddresses[board], reg + 1, static_cast<uint8_t>(on >> 8));
+        flag &= mBus->writeByte(mAddresses[board], reg + 2, static_cast<uint8_t>(off & 0xFF));
+        flag &= mBus->writeByte(mAddresses[board], reg + 3, static_cast<uint8_t>(off >> 8));
+        return flag;
+    }
+
+    /** The bus of the boards. */
+    const Bus* mBus;
+    /** Addresses of the boards. */
+    uint8_t mAddresses[2];
+};
+
+/**
+ * A PWM backend which only folds the written values into a checksum, to measure the pipeline without a bus.
+ */
+class NullPwmBackend
+{
+public:
+    /** A checksum of all written values, which keeps the compiler from discarding them. */
+    uint32_t mChecksum = 0;
+
+    inline bool setDutyCycle(const uint8_t board, const uint8_t channel, const uint16_t value)
+    {
+        mChecksum = mChecksum * 31 + ((board << 20) | (channel << 16) | value);
+        return true;
+    }
+
+    inline bool setDutyCycles(const uint8_t board, const uint8_t channel, const uint16_t* values, const uint8_t count)
+    {
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            setDutyCycle(board, channel + i, values[i]);
+        }
+        return true;
+    }
+
+    inline bool setGPIO(const uint8_t board, const uint8_t channel, const bool on)
+    {
+        return setDutyCycle(board, channel, on ? 0x1000 : 0);
+    }
+};
+
+/**
+ * The conversion of ContinuousServo from a value of -1 to 1 to a duty cycle.
+ */
+class StaticServo
+{
+public:
+    /**
+     * Sets the range of pulses, like ContinuousServo::initialise.
+     *  @param frequency the PWM frequency of the board, as returned by PCA9685::getFrequency.
+     *  @param minPulse the minimum pulse width of the servo in microseconds.
+     *  @param maxPulse the maximum pulse width of the servo in microseconds.
+     */
+    void initialise(const float frequency, const int minPulse = 750, const int maxPulse = 2250)
+    {
+        const float offset = 0x0FFF / 1000000.0f;
+        float maxDuty = static_cast<float>(maxPulse) * frequency * offset;
+        mMinDuty = static_cast<float>(minPulse) * frequency * offset;
+        mDutyRange = maxDuty - mMinDuty;
+    }
+
+    /**
+     *  @param value a value from -1 to 1.
+     *  @return the 12-bit duty cycle.
+     */
+    inline uint16_t toDutyCycle(const float value) const
+    {
+        return static_cast<uint16_t>(mMinDuty + (value + 1) / 2 * mDutyRange + 0.5f);
+    }
+
+private:
+    /** The duty cycle of the minimum pulse. */
+    float mMinDuty = 0.0f;
+    /** The duty cycles between the minimum and the maximum pulse. */
+    float mDutyRange = 0.0f;
+};
+
+/**
+ * Base of robot models, which keeps gains and outputs and stops the throttle before reversing. The derived model
+ * implements writeOutputs(backend, steering, throttle, reversing) for its wiring, where the steering includes gain
+ * and offset and the throttle includes gain.
+ */
+template <typename Derived>
+class StaticRobotModel
+{
+public:
+    /**
+     * Basic constructor, with the defaults of NvidiaRacer.
+     *  @param steeringGain steering gain.
+     *  @param steeringOffset steering offset.
+     *  @param throttleGain throttle gain.
+     */
+    StaticRobotModel(const float steeringGain = -0.65f, const float steeringOffset = 0.0f, const float throttleGain = 0.8f)
+      : mSteering(0.0f), mThrottle(0.0f), mSteeringGain(steeringGain), mSteeringOffset(steeringOffset),
+        mThrottleGain(throttleGain) {};
+
+    /**
+     * Applies steering and throttle.
+     *  @param backend the PWM backend.
+     *  @param steering steering from -1 to 1.
+     *  @param throttle throttle from -1 to 1.
+     *  @return true if all writes succeeded.
+     */
+    template <typename Backend>
+    inline bool apply(Backend& backend, const float steering, const float throttle)
+    {
+        const bool reversing = std::signbit(throttle) != std::signbit(mThrottle) && std::fabs(throttle) > std::numeric_limits<float>::epsilon();
+        mSteering = clip(steering);
+        mThrottle = clip(throttle) * mThrottleGain;
+        return static_cast<Derived*>(this)->writeOutputs(backend, mSteering * mSteeringGain + mSteeringOffset, mThrottle, reversing);
+    }
+
+    /**
+     *  @return the steering value.
+     */
+    inline float getSteering() const
+    {
+        return mSteering;
+    }
+
+    /**
+     *  @return the throttle value, including gain.
+     */
+    inline float getThrottle() const
+    {
+        return mThrottle;
+    }
+
+protected:
+    /**
+     *  @return @p value clipped to -1 to 1.
+     */
+    static inline float clip(const float value)
+    {
+        return fmaxf(-1.0f, fminf(1.0f, value));
+    }
+
+    /** Steering from -1 to 1. */
+    float mSteering;
+    /** Throttle from -1 to 1, including gain. */
+    float mThrottle;
+    /** Steering gain. */
+    float mSteeringGain;
+    /** Steering offset. */
+    float mSteeringOffset;
+    /** Throttle gain. */
+    float mThrottleGain;
+};
+
+/**
+ * The wiring of the JetRacer: a steering servo on channel 0 of the steering board (index 1), and two H-bridges on
+ * the throttle board (index 0), as written by NvidiaRacer.
+ */
+class StaticJetRacer : public StaticRobotModel<StaticJetRacer>
+{
+public:
+    using StaticRobotModel<StaticJetRacer>::StaticRobotModel;
+
+    /**
+     * Sets the range of the steering servo.
+     *  @param frequency the PWM frequency of the steering board.
+     */
+    void initialise(const float frequency)
+    {
+        mSteeringServo.initialise(frequency);
+    }
+
+    template <typename Backend>
+    inline bool writeOutputs(Backend& backend, const float steering, const float throttle, const bool reversing)
+    {
+        bool flag = backend.setDutyCycle(1, 0, mSteeringServo.toDutyCycle(steering));
+        if (reversing)
+        {
+            flag &= writeThrottle(backend, 0.0f);
+        }
+        return flag & writeThrottle(backend, throttle);
+    }
+
+private:
+    /**
+     * Writes the H-bridges of both motors.
+     *  @return true if all writes succeeded.
+     */
+    template <typename Backend>
+    inline bool writeThrottle(Backend& backend, const float throttle)
+    {
+        const bool forward = throttle > 0;
+        const uint16_t duty = static_cast<uint16_t>(throttle * (forward ? 0x0FFF : -0x0FFF) + 0.5f);
+        bool flag = backend.setDutyCycle(0, 0, duty);
+        flag &= backend.setGPIO(0, 1, forward);
+        flag &= backend.setGPIO(0, 2, !forward);
+        if (forward)
+        {
+            flag &= backend.setGPIO(0, 3, false);
+            flag &= backend.setDutyCycle(0, 4, duty);
+        }
+        else
+        {
+            flag &= backend.setDutyCycle(0, 3, duty);
+            flag &= backend.setGPIO(0, 4, false);
+        }
+        flag &= backend.setGPIO(0, 5, !forward);
+        flag &= backend.setGPIO(0, 6, forward);
+        return flag & backend.setDutyCycle(0, 7, duty);
+    }
+
+    /** The steering servo. */
+    StaticServo mSteeringServo;
+};
+
+/**
+ * The wiring of the JetRacer Pro: servo-type inputs for steering on channel 0 and throttle on channel 1 of a single
+ * board (index 0), written together in one frame, as written by NvidiaRacer.
+ */
+class StaticJetRacerPro : public StaticRobotModel<StaticJetRacerPro>
+{
+public:
+    using StaticRobotModel<StaticJetRacerPro>::StaticRobotModel;
+
+    /**
+     * Sets the ranges of both servos.
+     *  @param frequency the PWM frequency of the board.
+     */
+    void initialise(const float frequency)
+    {
+        mSteeringServo.initialise(frequency);
+        mThrottleServo.initialise(frequency);
+        mStopDutyCycle = mThrottleServo.toDutyCycle(0.0f);
+    }
+
+    template <typename Backend>
+    inline bool writeOutputs(Backend& backend, const float steering, const float throttle, const bool reversing)
+    {
+        uint16_t dutyCycles[2] = {mSteeringServo.toDutyCycle(steering), mStopDutyCycle};
+        bool flag = true;
+        if (reversing)
+        {
+            // the new steering goes out together with the stop, followed by the new throttle alone
+            flag &= backend.setDutyCycles(0, 0, dutyCycles, 2);
+            dutyCycles[1] = mThrottleServo.toDutyCycle(throttle);
+            return flag & backend.setDutyCycles(0, 1, &dutyCycles[1], 1);
+        }
+        dutyCycles[1] = mThrottleServo.toDutyCycle(throttle);
+        return backend.setDutyCycles(0, 0, dutyCycles, 2);
+    }
+
+private:
+    /** The steering and throttle servos. */
+    StaticServo mSteeringServo;
+    StaticServo mThrottleServo;
+    /** The duty cycle which stops the throttle. */
+    uint16_t mStopDutyCycle = 0;
+};
+
+/**
+ * The pipeline from gamepad events to PWM writes. Like the default mapping of GamepadDriveAdapter, the steering axis
+ * is inverted. Events which do not change the conditioned value are ignored, as they would only rewrite the same duty
+ * cycles.
+ */
+template <typename Source, typename Conditioning, typename Model, typename Backend>
+class StaticDrivePipeline
+{
+public:
+    /**
+     * Basic constructor.
+     *  @param source the source of events.
+     *  @param model the robot model.
+     *  @param backend the PWM backend.
+     *  @param steeringAxis ID of the gamepad axis controlling steering angle.
+     *  @param throttleAxis ID of the gamepad axis controlling throttle.
+     */
+    StaticDrivePipeline(Source& source, Model& model, Backend& backend, const uint8_t steeringAxis = 2, const uint8_t throttleAxis = 3)
+      : mSource(source), mModel(model), mBackend(backend), mSteeringAxis(steeringAxis), mThrottleAxis(throttleAxis),
+        mSteering(0.0f), mThrottle(0.0f) {};
+
+    /**
+     * Applies a single event.
+     *  @param event the event.
+     *  @return false if writing to the backend failed.
+     */
+    inline bool update(const GamepadEventData& event)
+    {
+        if (!event.mIsAxis)
+        {
+            return true;
+        }
+        const float value = Conditioning::condition(event.mValue);
+        if (event.mNumber == mSteeringAxis && -value != mSteering)
+        {
+            mSteering = -value;
+        }
+        else if (event.mNumber == mThrottleAxis && value != mThrottle)
+        {
+            mThrottle = value;
+        }
+        else
+        {
+            return true;
+        }
+        return mModel.apply(mBackend, mSteering, mThrottle);
+    }
+
+    /**
+     * Applies all events available from the source.
+     *  @return the number of applied events.
+     */
+    inline size_t poll()
+    {
+        GamepadEventData event;
+        size_t count = 0;
+        while (mSource.next(event))
+        {
+            update(event);
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    /** The source of events. */
+    Source& mSource;
+    /** The robot model. */
+    Model& mModel;
+    /** The PWM backend. */
+    Backend& mBackend;
+    /** IDs of the control axes. */
+    uint8_t mSteeringAxis;
+    uint8_t mThrottleAxis;
+    /** The latest conditioned steering and throttle. */
+    float mSteering;
+    float mThrottle;
+};
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef JETRACER_TRACE
+
+#include <cstdio>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+#include "trace.h"
+
+namespace
+{
+
+/**
+ * Ring buffer of spans written only by its owning thread.
+ */
+struct TraceBuffer
+{
+    /** Recorded spans. */
+    TraceEvent mEvents[Trace::BUFFER_SIZE];
+    /** The total number of spans recorded by the thread. */
+    std::atomic<uint32_t> mCount;
+    /** Kernel ID of the owning thread. */
+    long mThreadId;
+    /** Name of the owning thread. */
+    char mThreadName[16];
+};
+
+/** Buffers of all threads which have recorded spans. Buffers are never freed, so spans of finished threads can be exported. */
+std::vector<TraceBuffer*> gBuffers;
+/** Mutex protecting the list of buffers, taken only once per thread and during export. */
+pthread_mutex_t gBuffersMutex = PTHREAD_MUTEX_INITIALIZER;
+/** Buffer of the calling thread. */
+thread_local TraceBuffer* tBuffer = nullptr;
+
+/**
+ *  @return the buffer of the calling thread, allocated on first use.
+ */
+TraceBuffer* getBuffer()
+{
+    if (nullptr == tBuffer)
+    {
+        tBuffer = new TraceBuffer();
+        tBuffer->mCount.store(0);
+        tBuffer->mThreadId = syscall(SYS_gettid);
+        if (0 != pthread_getname_np(pthread_self(), tBuffer->mThreadName, sizeof(tBuffer->mThreadName)))
+        {
+            snprintf(tBuffer->mThreadName, sizeof(tBuffer->mThreadName), "%ld", tBuffer->mThreadId);
+        }
+        pthread_mutex_lock(&gBuffersMutex);
+        gBuffers.push_back(tBuffer);
+        pthread_mutex_unlock(&gBuffersMutex);
+    }
+    return tBuffer;
+}
+
+} // namespace
+
+void Trace::record(const char* name, const int64_t start, const int64_t end)
+{
+    TraceBuffer* buffer = getBuffer();
+    uint32_t count = buffer->mCount.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer->mEvents[count % BUFFER_SIZE];
+    event.mName  = name;
+    event.mStart = start;
+    event.mEnd   = end;
+    buffer->mCount.store(count + 1, std::memory_order_release);
+}
+
+bool Trace::writeChromeTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    bool first = true;
+    uint32_t count;
+    uint32_t begin;
+    pid_t pid = getpid();
+
+    if (nullptr == file)
+    {
+        return false;
+    }
+
+    fputs("{\"traceEvents\":[\n", file);
+    pthread_mutex_lock(&gBuffersMutex);
+    for (TraceBuffer* buffer : gBuffers)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, buffer->mThreadId, buffer->mThreadName);
+        first = false;
+        count = buffer->mCount.load(std::memory_order_acquire);
+        begin = (count > BUFFER_SIZE) ? count - BUFFER_SIZE : 0;
+        for (uint32_t i = begin; i < count; ++i)
+        {
+            const TraceEvent& event = buffer->mEvents[i % BUFFER_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.mName, pid, buffer->mThreadId, static_cast<double>(event.mStart) / 1000.0,
+                    static_cast<double>(event.mEnd - event.mStart) / 1000.0);
+        }
+    }
+    pthread_mutex_unlock(&gBuffersMutex);
+    fputs("\n]}\n", file);
+    return 0 == fclose(file);
+}
+
+void Trace::clear()
+{
+    pthread_mutex_lock(&gBuffersMutex);
+    for (TraceBuffer* buffer : gBuffers)
+    {
+        buffer->mCount.store(0, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&gBuffersMutex);
+}
+
+#endif
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+/**
+ * Optional span instrumentation of the control path, exported as Chrome trace JSON (which can be opened
+ * in chrome://tracing or Perfetto). Enabled by building with -DJETRACER_TRACE=ON, otherwise all macros
+ * expand to nothing (or to a plain ScopedLock) and no tracing code is compiled.
+ *
+ *  TRACE_SPAN(name)         records a span from this point until the end of the enclosing scope.
+ *  TRACE_LOCK(lock, mutex)  declares ScopedLock @p lock on @p mutex and records the time spent waiting for it.
+ *  TRACE_EXPORT(path)       writes all recorded spans to @p path, evaluates to true on success.
+ */
+
+#ifdef JETRACER_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include "time_utils.h"
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_LOCK(lock, mutex) TraceSpan lock##Wait(#mutex " wait"); ScopedLock lock(mutex); lock##Wait.end()
+#define TRACE_EXPORT(path) Trace::writeChromeTrace(path)
+
+
+/**
+ * A single recorded span.
+ */
+struct TraceEvent
+{
+    /** The name of the span, must be a string literal. */
+    const char* mName;
+    /** Start time of the span in nanoseconds. */
+    int64_t mStart;
+    /** End time of the span in nanoseconds. */
+    int64_t mEnd;
+};
+
+/**
+ * Collects spans in per-thread ring buffers, so recording never takes a lock.
+ */
+class Trace
+{
+public:
+    /** The number of spans kept per thread, older spans are overwritten. */
+    static constexpr uint32_t BUFFER_SIZE = 16384;
+
+    /**
+     * Records a span in the buffer of the calling thread.
+     *  @param name the name of the span, must be a string literal.
+     *  @param start start time of the span in nanoseconds.
+     *  @param end end time of the span in nanoseconds.
+     */
+    static void record(const char* name, const int64_t start, const int64_t end);
+
+    /**
+     * Writes spans of all threads as Chrome trace JSON. Spans recorded while writing may be skipped.
+     *  @param path path of the output file.
+     *  @return true if the file was written.
+     */
+    static bool writeChromeTrace(const char* path);
+
+    /**
+     * Discards all recorded spans. Should be called while no spans are being recorded.
+     */
+    static void clear();
+};
+
+/**
+ * Records a span from construction until destruction, or until end() is called.
+ */
+class TraceSpan
+{
+public:
+    /**
+     * Starts the span.
+     *  @param name the name of the span, must be a string literal.
+     */
+    explicit TraceSpan(const char* name) : mName(name), mStart(getMonotonicTime()) {};
+
+    /**
+     * Ends the span if it has not been ended yet.
+     */
+    ~TraceSpan()
+    {
+        end();
+    }
+
+    /**
+     * Ends the span and records it.
+     */
+    inline void end()
+    {
+        if (nullptr != mName)
+        {
+            Trace::record(mName, mStart, getMonotonicTime());
+            mName = nullptr;
+        }
+    }
+
+private:
+    /** The name of the span, nullptr once recorded. */
+    const char* mName;
+    /** Start time of the span in nanoseconds. */
+    int64_t mStart;
+};
+
+#else
+
+#define TRACE_SPAN(name)
+#define TRACE_LOCK(lock, mutex) ScopedLock lock(mutex)
+#define TRACE_EXPORT(path) false
+
+#endif
@@ -0,0 +1,252 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <generic_talker.h>
+#include "logger.h"
+#include "time_utils.h"
+#include "trajectory_executor.h"
+
+/** The execution thread wakes up on the condition variable this long before a deadline and sleeps
+    the rest with the absolute timer, which is more precise than a timed wait. */
+static constexpr int64_t TIMER_SLACK = 1000000LL;
+
+
+TrajectoryExecutor::TrajectoryExecutor(GenericListener<DriveCommands>* target)
+: mTarget(target),
+  mStatistics(),
+  mStartTime(0),
+  mLastOffset(0),
+  mNextSample(0),
+  mGeneration(0),
+  mTickPeriod(10000000LL),
+  mTolerance(1000000LL),
+  mInterpolate(true),
+  mActive(false),
+  mWorker()
+{
+}
+
+TrajectoryExecutor::~TrajectoryExecutor()
+{
+    stop();
+}
+
+bool TrajectoryExecutor::execute(const TrajectorySample* samples, const size_t count, const bool interpolate)
+{
+    if (nullptr == samples || 0 == count || samples[0].mTime < 0.0f)
+    {
+        return false;
+    }
+    for (size_t i = 1; i < count; ++i)
+    {
+        if (samples[i].mTime < samples[i - 1].mTime)
+        {
+            return false;
+        }
+    }
+
+    ScopedLock lock(mWorker.getMutex());
+    if (!mWorker.isRunning())
+    {
+        mJitter = WakeupJitter();
+        if (!mWorker.start(threadBody, this, mProfile))
+        {
+            return false;
+        }
+    }
+
+    mSamples.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        mSamples[i].mOffset   = static_cast<int64_t>(static_cast<double>(samples[i].mTime) * NS_IN_SECOND);
+        mSamples[i].mCommands = samples[i].mCommands;
+    }
+    mLateness.assign(count, -1);
+    mStatistics  = TrajectoryStatistics();
+    mInterpolate = interpolate;
+    mLastOffset  = 0;
+    mNextSample  = 0;
+    mActive      = true;
+    ++mGeneration;
+    mStartTime   = getMonotonicTime();
+    mWorker.notify();
+    return true;
+}
+
+void TrajectoryExecutor::cancel()
+{
+    ScopedLock lock(mWorker.getMutex());
+    mActive = false;
+    ++mGeneration;
+    mWorker.notify();
+}
+
+void TrajectoryExecutor::stop()
+{
+    // a new generation keeps the thread from applying the command it may be sleeping for
+    cancel();
+    mWorker.stop();
+}
+
+bool TrajectoryExecutor::isRunning() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    return mActive;
+}
+
+void TrajectoryExecutor::setTickPeriod(const uint32_t period)
+{
+    ScopedLock lock(mWorker.getMutex());
+    mTickPeriod = (period > 0) ? static_cast<int64_t>(period) * 1000 : mTickPeriod;
+}
+
+void TrajectoryExecutor::setDeadlineTolerance(const uint32_t tolerance)
+{
+    ScopedLock lock(mWorker.getMutex());
+    mTolerance = static_cast<int64_t>(tolerance) * 1000;
+}
+
+TrajectoryStatistics TrajectoryExecutor::getStatistics() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    return mStatistics;
+}
+
+void TrajectoryExecutor::getSampleLateness(std::vector<int64_t>& lateness) const
+{
+    ScopedLock lock(mWorker.getMutex());
+    lateness = mLateness;
+}
+
+bool TrajectoryExecutor::setRealtimeProfile(const RealtimeProfile& profile)
+{
+    {
+        ScopedLock lock(mWorker.getMutex());
+        mProfile = profile;
+        mJitter = WakeupJitter();
+    }
+    return mWorker.setProfile(profile);
+}
+
+WakeupJitter TrajectoryExecutor::getWakeupJitter() const
+{
+    ScopedLock lock(mWorker.getMutex());
+    return mJitter;
+}
+
+void TrajectoryExecutor::threadBody(void* executor)
+{
+    static_cast<TrajectoryExecutor*>(executor)->run();
+}
+
+void TrajectoryExecutor::run()
+{
+    int64_t deadline;
+    int64_t lateness;
+    uint32_t generation;
+    bool isSample;
+    timespec time;
+    DriveCommands commands;
+
+    while (mWorker.isRunning())
+    {
+        if (!mActive)
+        {
+            mWorker.wait();
+            continue;
+        }
+
+        isSample = getNextDeadline(deadline, commands);
+        generation = mGeneration;
+        if (getMonotonicTime() < deadline - TIMER_SLACK)
+        {
+            // wait on the condition variable so that the trajectory can be cancelled or replaced, and re-evaluate afterwards
+            mWorker.waitUntil(deadline - TIMER_SLACK);
+            continue;
+        }
+
+        pthread_mutex_unlock(&mWorker.getMutex());
+        time = toTimespec(deadline);
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr))
+        {
+            ;
+        }
+        lateness = getMonotonicTime() - deadline;
+        pthread_mutex_lock(&mWorker.getMutex());
+        mJitter.add(lateness);
+        if (generation != mGeneration)
+        {
+            continue;
+        }
+
+        // apply commands without holding the mutex so that cancellation never waits for the I2C bus
+        pthread_mutex_unlock(&mWorker.getMutex());
+        commands.mTimestamp = deadline;
+        mTarget->update(commands);
+        pthread_mutex_lock(&mWorker.getMutex());
+        if (generation != mGeneration)
+        {
+            continue;
+        }
+
+        mLastOffset = deadline - mStartTime;
+        if (isSample)
+        {
+            mLateness[mNextSample] = lateness;
+            ++mStatistics.mExecutedSamples;
+            mStatistics.mMissedDeadlines += (lateness > mTolerance) ? 1 : 0;
+            if (lateness > mTolerance)
+            {
+                LOG_DEBUG("Trajectory sample %zu missed its deadline by %lld us", mNextSample, lateness / 1000);
+            }
+            mStatistics.mMaxLateness = (lateness > mStatistics.mMaxLateness) ? lateness : mStatistics.mMaxLateness;
+            mStatistics.mTotalLateness += lateness;
+            ++mNextSample;
+            mActive = (mNextSample < mSamples.size());
+        }
+    }
+}
+
+bool TrajectoryExecutor::getNextDeadline(int64_t& deadline, DriveCommands& commands) const
+{
+    const Sample& next = mSamples[mNextSample];
+    if (mInterpolate && mNextSample > 0)
+    {
+        // skip interpolation ticks which are already in the past, samples themselves are never skipped
+        int64_t offset = std::max(mLastOffset, getMonotonicTime() - mStartTime);
+        int64_t tick = (offset / mTickPeriod + 1) * mTickPeriod;
+        if (tick < next.mOffset)
+        {
+            const Sample& previous = mSamples[mNextSample - 1];
+            float alpha = static_cast<float>(tick - previous.mOffset) / static_cast<float>(next.mOffset - previous.mOffset);
+            commands.mSteering = previous.mCommands.mSteering + alpha * (next.mCommands.mSteering - previous.mCommands.mSteering);
+            commands.mThrottle = previous.mCommands.mThrottle + alpha * (next.mCommands.mThrottle - previous.mCommands.mThrottle);
+            deadline = mStartTime + tick;
+            return false;
+        }
+    }
+    commands = next.mCommands;
+    deadline = mStartTime + next.mOffset;
+    return true;
+}
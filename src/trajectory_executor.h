@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <generic_listener.h>
+#include "drive_commands.h"
+#include "realtime_profile.h"
+#include "worker_thread.h"
+
+
+/**
+ * A single sample of a pre-planned trajectory.
+ */
+struct TrajectorySample
+{
+    /** Time offset of this sample from the start of the trajectory, in seconds. */
+    float mTime;
+    /** Drive commands which should be applied at @p mTime. */
+    DriveCommands mCommands;
+
+    /**
+     * Basic constructor.
+     *  @param time time offset from the start of the trajectory in seconds.
+     *  @param commands drive commands to apply at @p time.
+     */
+    TrajectorySample(const float time = 0.0f, const DriveCommands& commands = DriveCommands())
+      : mTime(time), mCommands(commands) {};
+};
+
+/**
+ * Deadline statistics of the executed trajectory samples. Lateness is expressed in nanoseconds.
+ */
+struct TrajectoryStatistics
+{
+    /** The number of samples which were applied so far. */
+    uint32_t mExecutedSamples;
+    /** The number of samples which were applied later than the deadline tolerance. */
+    uint32_t mMissedDeadlines;
+    /** The maximum lateness of an applied sample. */
+    int64_t mMaxLateness;
+    /** The sum of lateness of all applied samples. */
+    int64_t mTotalLateness;
+};
+
+/**
+ * Executes a buffer of timestamped drive commands on a dedicated thread. Every sample is applied at
+ * its absolute deadline measured from the start of the trajectory, so the timing does not depend on
+ * the scheduling of the thread which uploaded the trajectory. Optionally, commands are linearly
+ * interpolated between samples with a fixed tick period.
+ */
+class TrajectoryExecutor
+{
+public:
+    /**
+     * Class constructor, only initialises variables. The thread is started with the first trajectory.
+     *  @param target the listener which receives drive commands, typically a robot.
+     */
+    TrajectoryExecutor(GenericListener<DriveCommands>* target);
+
+    /**
+     * Class destructor, stops the execution thread.
+     */
+    virtual ~TrajectoryExecutor();
+
+    /**
+     * Uploads a new trajectory and starts executing it immediately. Any trajectory which is currently
+     * executed is replaced and its statistics are reset.
+     *  @param samples an array of samples sorted by their time offsets.
+     *  @param count the number of samples in @p samples.
+     *  @param interpolate if true, commands are interpolated between samples every tick period.
+     *  @return true if the trajectory was accepted.
+     */
+    bool execute(const TrajectorySample* samples, const size_t count, const bool interpolate = true);
+
+    /**
+     * Cancels the currently executed trajectory. The last applied command stays in effect.
+     */
+    void cancel();
+
+    /**
+     * Cancels the trajectory and joins the execution thread. Must be called before the target is destroyed.
+     */
+    void stop();
+
+    /**
+     *  @return true if a trajectory is currently executed.
+     */
+    bool isRunning() const;
+
+    /**
+     *  @param period new interpolation tick period in microseconds.
+     */
+    void setTickPeriod(const uint32_t period);
+
+    /**
+     *  @param tolerance lateness in microseconds after which a sample is counted as a missed deadline.
+     */
+    void setDeadlineTolerance(const uint32_t tolerance);
+
+    /**
+     *  @return deadline statistics of the current (or last) trajectory.
+     */
+    TrajectoryStatistics getStatistics() const;
+
+    /**
+     * Copies the lateness of every sample of the current (or last) trajectory in nanoseconds. Samples
+     * which have not been applied yet have lateness set to -1.
+     *  @param[out] lateness per-sample lateness.
+     */
+    void getSampleLateness(std::vector<int64_t>& lateness) const;
+
+    /**
+     * Sets the real-time profile of the execution thread. It is applied at once if the thread is running, or
+     * when it starts, replacing every setting of the previous profile, and restarts the wake-up jitter.
+     *  @param profile the real-time profile to apply.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    bool setRealtimeProfile(const RealtimeProfile& profile);
+
+    /**
+     *  @return wake-up jitter of the execution thread accumulated since the last profile change.
+     */
+    WakeupJitter getWakeupJitter() const;
+
+private:
+    /** Internal representation of a trajectory sample with absolute time offset. */
+    struct Sample
+    {
+        /** Time offset from the start of the trajectory in nanoseconds. */
+        int64_t mOffset;
+        /** Drive commands to apply. */
+        DriveCommands mCommands;
+    };
+
+    /**
+     * Entry point of the execution thread.
+     *  @param executor pointer to this class.
+     */
+    static void threadBody(void* executor);
+
+    /**
+     * The main loop of the execution thread.
+     */
+    void run();
+
+    /**
+     * Computes the next deadline of the current trajectory and the command which should be applied at it.
+     *  @param[out] deadline absolute time of the next deadline in nanoseconds.
+     *  @param[out] commands drive commands to apply at @p deadline.
+     *  @return true if the deadline corresponds to a sample rather than an interpolation tick.
+     */
+    bool getNextDeadline(int64_t& deadline, DriveCommands& commands) const;
+
+    /** The listener which receives drive commands. */
+    GenericListener<DriveCommands>* mTarget;
+    /** Samples of the current trajectory. */
+    std::vector<Sample> mSamples;
+    /** Lateness of every sample of the current trajectory. */
+    std::vector<int64_t> mLateness;
+    /** Deadline statistics of the current trajectory. */
+    TrajectoryStatistics mStatistics;
+    /** Absolute start time of the current trajectory in nanoseconds. */
+    int64_t mStartTime;
+    /** Time offset of the last applied command in nanoseconds. */
+    int64_t mLastOffset;
+    /** Index of the next sample to apply. */
+    size_t mNextSample;
+    /** Incremented on every upload and cancellation to invalidate pending deadlines. */
+    uint32_t mGeneration;
+    /** Real-time profile of the execution thread. */
+    RealtimeProfile mProfile;
+    /** Wake-up jitter of the execution thread. */
+    WakeupJitter mJitter;
+    /** Interpolation tick period in nanoseconds. */
+    int64_t mTickPeriod;
+    /** Deadline tolerance in nanoseconds. */
+    int64_t mTolerance;
+    /** Flag indicating if commands should be interpolated between samples. */
+    bool mInterpolate;
+    /** Flag indicating if a trajectory is being executed. */
+    bool mActive;
+    /** The execution thread, its mutex guards the trajectory. */
+    WorkerThread mWorker;
+};
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "logger.h"
+#include "watchdog.h"
+#include "robots/abstract_robot_base.h"
+
+
+Watchdog::Watchdog(ARobotBase* robot, pthread_mutex_t* mutex)
+: mRobot(robot),
+  mRobotMutex(mutex),
+  mTimeout(0),
+  mLastFeed(0),
+  mTripped(false),
+  mTrips(0),
+  mLastStopLatency(0),
+  mMaxStopLatency(0),
+  mWorker()
+{
+}
+
+Watchdog::~Watchdog()
+{
+    stop();
+}
+
+bool Watchdog::start(const uint32_t timeout, const RealtimeProfile& profile)
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (0 == timeout)
+    {
+        return false;
+    }
+    mTimeout.store(static_cast<int64_t>(timeout) * 1000000, std::memory_order_relaxed);
+    mLastFeed.store(getMonotonicTime());
+    mWorker.notify();
+    return mWorker.start(threadBody, this, profile);
+}
+
+void Watchdog::stop()
+{
+    mWorker.stop();
+    mTimeout.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Watchdog::getTimeout() const
+{
+    return static_cast<uint32_t>(mTimeout.load(std::memory_order_relaxed) / 1000000);
+}
+
+WatchdogStatistics Watchdog::getStatistics() const
+{
+    WatchdogStatistics statistics;
+    statistics.mTrips           = mTrips.load(std::memory_order_relaxed);
+    statistics.mLastStopLatency = mLastStopLatency.load(std::memory_order_relaxed);
+    statistics.mMaxStopLatency  = mMaxStopLatency.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+void Watchdog::rearm()
+{
+    ScopedLock lock(mWorker.getMutex());
+    if (mTripped.exchange(false))
+    {
+        mWorker.notify();
+    }
+}
+
+void Watchdog::threadBody(void* watchdog)
+{
+    static_cast<Watchdog*>(watchdog)->run();
+}
+
+void Watchdog::run()
+{
+    int64_t lastFeed;
+    int64_t deadline;
+    int64_t latency;
+    int64_t maxLatency;
+
+    while (mWorker.isRunning())
+    {
+        if (mTripped.load())
+        {
+            // the robot is stopped until the next command
+            mWorker.wait();
+            continue;
+        }
+
+        lastFeed = mLastFeed.load();
+        deadline = lastFeed + mTimeout.load(std::memory_order_relaxed);
+        if (getMonotonicTime() < deadline)
+        {
+            mWorker.waitUntil(deadline);
+            continue;
+        }
+
+        // set the trip before checking for a command, feed does the opposite, so one of them sees the other
+        mTripped.store(true);
+        if (mLastFeed.load() != lastFeed)
+        {
+            // a command has just arrived
+            mTripped.store(false);
+            continue;
+        }
+
+        pthread_mutex_unlock(&mWorker.getMutex());
+        // commands write under the mutex of the robot after feeding, so one which arrives now is written after the stop
+        pthread_mutex_lock(mRobotMutex);
+        if (mLastFeed.load() != lastFeed)
+        {
+            // a command arrived before the stop, and re-arms the watchdog itself
+            pthread_mutex_unlock(mRobotMutex);
+            pthread_mutex_lock(&mWorker.getMutex());
+            continue;
+        }
+        mRobot->applyStop();
+        pthread_mutex_unlock(mRobotMutex);
+        latency = getMonotonicTime() - deadline;
+        maxLatency = mMaxStopLatency.load(std::memory_order_relaxed);
+        mTrips.fetch_add(1, std::memory_order_relaxed);
+        mLastStopLatency.store(latency, std::memory_order_relaxed);
+        while (latency > maxLatency && !mMaxStopLatency.compare_exchange_weak(maxLatency, latency, std::memory_order_relaxed))
+        {
+            ;
+        }
+        LOG_WARNING("%s: commands went silent, stopped %lld us after the timeout", mRobot->getName(), latency / 1000);
+        pthread_mutex_lock(&mWorker.getMutex());
+    }
+}
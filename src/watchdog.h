@@ -0,0 +1,146 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include "realtime_profile.h"
+#include "time_utils.h"
+#include "worker_thread.h"
+
+class ARobotBase;
+
+/**
+ * Statistics of a watchdog. Time values are in nanoseconds.
+ */
+struct WatchdogStatistics
+{
+    /** The number of times commands went silent and the robot was stopped. */
+    uint64_t mTrips;
+    /** Time from the last timeout to the stop being written. */
+    int64_t mLastStopLatency;
+    /** The longest time from a timeout to the stop being written. */
+    int64_t mMaxStopLatency;
+};
+
+/**
+ * Stops a robot when its commands go silent for longer than a timeout. Every command re-arms the watchdog with
+ * a single atomic store. A thread sleeps until the deadline of the last command, and applies the pre-encoded stop
+ * of the robot if no command arrived meanwhile. After a stop, it sleeps until the next command re-arms it.
+ */
+class Watchdog
+{
+public:
+    /**
+     * Class constructor, only initialises variables.
+     *  @param robot the robot to stop.
+     *  @param mutex the recursive mutex under which the robot writes its outputs, also locked by its applyStop.
+     */
+    Watchdog(ARobotBase* robot, pthread_mutex_t* mutex);
+
+    /**
+     * Class destructor, stops the watchdog thread.
+     */
+    virtual ~Watchdog();
+
+    /**
+     * Starts the watchdog, or changes its timeout if already started. The timeout counts from now.
+     *  @param timeout the time without commands after which the robot is stopped, in milliseconds.
+     *  @param profile real-time profile of the watchdog thread.
+     *  @return true if the watchdog is running.
+     */
+    bool start(const uint32_t timeout, const RealtimeProfile& profile = RealtimeProfile());
+
+    /**
+     * Stops the watchdog thread.
+     */
+    void stop();
+
+    /**
+     * Applies a new real-time profile to the watchdog thread if it is running.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    inline bool setRealtimeProfile(const RealtimeProfile& profile)
+    {
+        return mWorker.setProfile(profile);
+    }
+
+    /**
+     *  @return the timeout in milliseconds, 0 if the watchdog is not running.
+     */
+    uint32_t getTimeout() const;
+
+    /**
+     * Re-arms the watchdog. Safe to call from the hot path.
+     *  @param now time of the command in nanoseconds.
+     */
+    inline void feed(const int64_t now)
+    {
+        // publish the command before checking for a trip, run does the opposite, so one of them sees the other
+        mLastFeed.store(now);
+        if (mTripped.load())
+        {
+            rearm();
+        }
+    }
+
+    /**
+     *  @return statistics of the watchdog.
+     */
+    WatchdogStatistics getStatistics() const;
+
+private:
+    /**
+     * Clears a trip after a command, and wakes the watchdog thread up. Called at most once per trip.
+     */
+    void rearm();
+
+    /**
+     * Body of the watchdog thread.
+     *  @param watchdog pointer to this class.
+     */
+    static void threadBody(void* watchdog);
+
+    /**
+     * The main loop of the watchdog thread, called with the mutex locked.
+     */
+    void run();
+
+    /** The robot to stop. */
+    ARobotBase* mRobot;
+    /** The mutex under which the robot writes its outputs. */
+    pthread_mutex_t* mRobotMutex;
+    /** The timeout in nanoseconds. */
+    std::atomic<int64_t> mTimeout;
+    /** Time of the last command. */
+    std::atomic<int64_t> mLastFeed;
+    /** True after a stop, until the next command. */
+    std::atomic<bool> mTripped;
+    /** Counters of the statistics. */
+    std::atomic<uint64_t> mTrips;
+    std::atomic<int64_t> mLastStopLatency;
+    std::atomic<int64_t> mMaxStopLatency;
+    /** The watchdog thread. */
+    WorkerThread mWorker;
+};
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "time_utils.h"
+#include "worker_thread.h"
+
+
+WorkerThread::WorkerThread()
+: mBody(nullptr),
+  mOwner(nullptr),
+  mProfile(),
+  mRun(false),
+  mStarted(false),
+  mThread()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mCondition, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&mMutex, nullptr);
+}
+
+WorkerThread::~WorkerThread()
+{
+    stop();
+    pthread_cond_destroy(&mCondition);
+    pthread_mutex_destroy(&mMutex);
+}
+
+bool WorkerThread::start(const Body body, void* owner, const RealtimeProfile& profile)
+{
+    if (!mStarted)
+    {
+        mBody = body;
+        mOwner = owner;
+        mProfile = profile;
+        mRun.store(true);
+        mStarted = (0 == pthread_create(&mThread, nullptr, threadBody, this));
+        mRun.store(mStarted);
+    }
+    return mStarted;
+}
+
+void WorkerThread::stop()
+{
+    pthread_mutex_lock(&mMutex);
+    bool started = mStarted;
+    mRun.store(false);
+    mStarted = false;
+    pthread_cond_signal(&mCondition);
+    pthread_mutex_unlock(&mMutex);
+    if (started)
+    {
+        pthread_join(mThread, nullptr);
+    }
+}
+
+bool WorkerThread::setProfile(const RealtimeProfile& profile)
+{
+    pthread_mutex_lock(&mMutex);
+    mProfile = profile;
+    bool flag = !mStarted || profile.applyToThread(mThread);
+    pthread_mutex_unlock(&mMutex);
+    return flag;
+}
+
+void WorkerThread::waitUntil(const int64_t deadline)
+{
+    timespec time = toTimespec(deadline);
+    pthread_cond_timedwait(&mCondition, &mMutex, &time);
+}
+
+void* WorkerThread::threadBody(void* worker)
+{
+    WorkerThread* thread = static_cast<WorkerThread*>(worker);
+    // under the mutex, so that a profile set meanwhile is either applied here or by setProfile
+    pthread_mutex_lock(&thread->mMutex);
+    thread->mProfile.applyToCurrentThread();
+    thread->mBody(thread->mOwner);
+    pthread_mutex_unlock(&thread->mMutex);
+    return nullptr;
+}
@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include "realtime_profile.h"
+
+/**
+ * A background thread of a component, together with the mutex and the condition variable on which it waits. The
+ * component provides the body of the thread, which is called with the mutex locked and returns once isRunning()
+ * turns false. The mutex is released while the body waits, and should be released while it calls out of the component.
+ */
+class WorkerThread
+{
+public:
+    /** The body of the thread, called with the mutex locked. */
+    typedef void (*Body)(void* owner);
+
+    /**
+     * Class constructor, only initialises the mutex and the condition variable.
+     */
+    WorkerThread();
+
+    /**
+     * Class destructor, stops the thread.
+     */
+    virtual ~WorkerThread();
+
+    /**
+     * Starts the thread, unless it is already running. Must be called with the mutex locked.
+     *  @param body the body of the thread.
+     *  @param owner passed to @p body.
+     *  @param profile real-time profile applied by the thread before it calls @p body.
+     *  @return true if the thread is running.
+     */
+    bool start(const Body body, void* owner, const RealtimeProfile& profile = RealtimeProfile());
+
+    /**
+     * Stops the thread and waits until it finishes. Must be called with the mutex unlocked, and not from the thread.
+     */
+    void stop();
+
+    /**
+     * Applies a new real-time profile to the thread if it is running, e.g. to revert a previous one. Must be called
+     * with the mutex unlocked.
+     *  @param profile the real-time profile.
+     *  @return true if the profile was applied, or the thread is not running.
+     */
+    bool setProfile(const RealtimeProfile& profile);
+
+    /**
+     *  @return true if the thread is running, safe to call without the mutex.
+     */
+    inline bool isRunning() const
+    {
+        return mRun.load(std::memory_order_relaxed);
+    }
+
+    /**
+     *  @return the mutex of the thread.
+     */
+    inline pthread_mutex_t& getMutex() const
+    {
+        return mMutex;
+    }
+
+    /**
+     * Wakes the thread up. Must be called with the mutex locked.
+     */
+    inline void notify()
+    {
+        pthread_cond_signal(&mCondition);
+    }
+
+    /**
+     * Waits until the thread is woken up. Must be called by the thread with the mutex locked.
+     */
+    inline void wait()
+    {
+        pthread_cond_wait(&mCondition, &mMutex);
+    }
+
+    /**
+     * Waits until the thread is woken up or a deadline passes. Must be called by the thread with the mutex locked.
+     *  @param deadline the time until which to wait in nanoseconds of CLOCK_MONOTONIC.
+     */
+    void waitUntil(const int64_t deadline);
+
+    WorkerThread(const WorkerThread&) = delete;
+    WorkerThread& operator=(const WorkerThread&) = delete;
+
+private:
+    /**
+     * Entry point of the thread.
+     *  @param worker pointer to this class.
+     */
+    static void* threadBody(void* worker);
+
+    /** The body of the thread and its owner. */
+    Body mBody;
+    void* mOwner;
+    /** Real-time profile of the thread. */
+    RealtimeProfile mProfile;
+    /** Flag indicating if the thread should run. */
+    std::atomic<bool> mRun;
+    /** Flag indicating if the thread was started. */
+    bool mStarted;
+    /** The thread. */
+    pthread_t mThread;
+    /** Mutex of the thread and its owner, and condition variable on which the thread waits. */
+    mutable pthread_mutex_t mMutex;
+    mutable pthread_cond_t mCondition;
+};
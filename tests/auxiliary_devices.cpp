@@ -0,0 +1,267 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Runs the auxiliary devices next to an NvidiaRacer on a virtual bus. Checks that power readings are decoded, that
+ * the display receives exactly the frame buffer with only the dirty part of a page re-sent, that the devices stay
+ * within their budget of bus time, and that drive commands do not take measurably longer while the devices run.
+ *
+ * Usage: test_auxiliary_devices [budget] [access time in us]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <auxiliary/oled_display.h>
+#include <robots/nvidia_racer.h>
+#include <simulated_power_monitor.h>
+#include <time_utils.h>
+#include <virtual_bus.h>
+
+/**
+ * Decodes the SSD1306 traffic of a display, with horizontal addressing.
+ */
+class DisplayDecoder
+{
+public:
+    /** The decoded display RAM, indexed by [page][column]. */
+    uint8_t mRam[OledDisplay::PAGES][OledDisplay::WIDTH];
+    /** The number of accesses to the display. */
+    size_t mAccesses = 0;
+
+    DisplayDecoder()
+    {
+        memset(mRam, 0xA5, sizeof(mRam));
+    }
+
+    /**
+     * Decodes accesses to a display.
+     *  @param accesses recorded accesses of the bus.
+     *  @param address the address of the display.
+     */
+    void decode(const std::vector<BusAccess>& accesses, const uint8_t address)
+    {
+        for (const BusAccess& access : accesses)
+        {
+            if (access.mDeviceAddress != address || !access.mWrite)
+            {
+                continue;
+            }
+            ++mAccesses;
+            if (OledDisplay::CONTROL_DATA == access.mRegister)
+            {
+                mRam[mPage][mColumn] = access.mValue;
+                mColumn = (mColumn >= mColumnEnd) ? mColumnStart : mColumn + 1;
+            }
+            else if (0 < mArguments)
+            {
+                mParameters[2 - mArguments--] = access.mValue;
+                if (0 == mArguments && 0x21 == mCommand)
+                {
+                    mColumnStart = mColumn = mParameters[0];
+                    mColumnEnd = mParameters[1];
+                }
+                else if (0 == mArguments && 0x22 == mCommand)
+                {
+                    mPage = mParameters[0];
+                }
+            }
+            else
+            {
+                mCommand = access.mValue;
+                mArguments = (0x21 == mCommand || 0x22 == mCommand) ? 2 : (0x20 == mCommand || 0x8D == mCommand) ? 1 : 0;
+            }
+        }
+    }
+
+private:
+    uint8_t mCommand = 0;
+    int mArguments = 0;
+    uint8_t mParameters[2] = {0, 0};
+    uint8_t mPage = 0;
+    uint8_t mColumn = 0;
+    uint8_t mColumnStart = 0;
+    uint8_t mColumnEnd = OledDisplay::WIDTH - 1;
+};
+
+/**
+ * Waits until a condition holds.
+ *  @param condition the condition.
+ *  @return true if the condition holds before the timeout.
+ */
+template <typename Condition>
+static bool waitFor(Condition condition)
+{
+    timespec time = toTimespec(1000000LL);
+    for (int i = 0; i < 5000; ++i)
+    {
+        if (condition())
+        {
+            return true;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &time, nullptr);
+    }
+    return false;
+}
+
+/**
+ * Compares the decoded display RAM with the frame buffer.
+ *  @param decoder the decoder of the display traffic.
+ *  @param display the display.
+ *  @return true if they are equal.
+ */
+static bool compareFrame(const DisplayDecoder& decoder, const OledDisplay& display)
+{
+    for (uint8_t y = 0; y < OledDisplay::HEIGHT; ++y)
+    {
+        for (uint8_t x = 0; x < OledDisplay::WIDTH; ++x)
+        {
+            if (display.getPixel(x, y) != (0 != (decoder.mRam[y / 8][x] & (1 << (y % 8)))))
+            {
+                printf("Display: pixel %u %u differs \n", x, y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Applies drive commands at 100 Hz, while redrawing the display to keep the auxiliary bus busy.
+ *  @param racer the robot.
+ *  @param display the display.
+ *  @param commands the number of commands.
+ *  @return the median duration of a command in nanoseconds.
+ */
+static int64_t measureCommands(NvidiaRacer& racer, OledDisplay& display, const int commands)
+{
+    std::vector<int64_t> durations;
+    DriveCommands command;
+    int64_t deadline = getMonotonicTime();
+    int64_t start;
+    timespec time;
+
+    for (int i = 0; i < commands; ++i)
+    {
+        display.fill(static_cast<uint8_t>(i % 96), 8, 32, 16, 0 != (i & 1));
+        deadline += 10000000LL;
+        time = toTimespec(deadline);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr);
+        command.mTimestamp = 0;
+        command.mSteering = std::sin(i * 0.1f);
+        command.mThrottle = 0.5f;
+        start = getMonotonicTime();
+        racer.update(command);
+        durations.push_back(getMonotonicTime() - start);
+    }
+    std::sort(durations.begin(), durations.end());
+    return durations[durations.size() / 2];
+}
+
+int main(int argc, char** argv)
+{
+    const float budget = (argc > 1) ? static_cast<float>(atof(argv[1])) : 0.2f;
+    const uint32_t accessTime = (argc > 2) ? static_cast<uint32_t>(atoi(argv[2])) * 1000 : 50000;
+    VirtualBus bus("auxiliary");
+    NvidiaRacer racer;
+    SimulatedPowerMonitor monitor;
+    OledDisplay display;
+    DisplayDecoder decoder;
+    std::vector<BusAccess> accesses;
+    bool flag = true;
+
+    if (!racer.initialise("auxiliary"))
+    {
+        puts("Failed to initialise the robot");
+        return 2;
+    }
+    bus.setAccessTime(accessTime);
+
+    // 7.4 V and 1.5 A in the registers of the monitor, the bus voltage in the upper 13 bits
+    const uint16_t voltage = static_cast<uint16_t>((7400 / 4) << 3);
+    const uint16_t current = static_cast<uint16_t>(1.5f / (3.2f / 32768.0f));
+    bus.poke(monitor.getAddress(), 2 * SimulatedPowerMonitor::REGISTER_BUS_VOLTAGE, voltage >> 8);
+    bus.poke(monitor.getAddress(), 2 * SimulatedPowerMonitor::REGISTER_BUS_VOLTAGE + 1, voltage & 0xFF);
+    bus.poke(monitor.getAddress(), 2 * SimulatedPowerMonitor::REGISTER_CURRENT, current >> 8);
+    bus.poke(monitor.getAddress(), 2 * SimulatedPowerMonitor::REGISTER_CURRENT + 1, current & 0xFF);
+
+    for (uint8_t i = 0; i < OledDisplay::HEIGHT; ++i)
+    {
+        display.setPixel(i * 2, i, true);
+    }
+    display.fill(100, 40, 20, 20, true);
+
+    const int64_t baseline = measureCommands(racer, display, 100);
+    bus.setRecording(true);
+    racer.addAuxiliaryDevice(&monitor);
+    racer.addAuxiliaryDevice(&display);
+    racer.setAuxiliaryBudget(budget);
+
+    // the initial frame and a power reading
+    flag &= waitFor([&]() { return display.isSynchronised() && monitor.getReading().mTimestamp > 0; });
+    bus.takeRecord(accesses);
+    decoder.decode(accesses, display.getAddress());
+    const PowerReading reading = monitor.getReading();
+    const uint8_t calibrationRegister = 2 * SimulatedPowerMonitor::REGISTER_CALIBRATION;
+    const uint16_t calibration = static_cast<uint16_t>((bus.peek(monitor.getAddress(), calibrationRegister) << 8) |
+                                                       bus.peek(monitor.getAddress(), calibrationRegister + 1));
+    printf("Power: %.3f V %.3f A %.3f W, calibration %u \n", reading.mVoltage, reading.mCurrent, reading.mPower, calibration);
+    flag &= std::fabs(reading.mVoltage - 7.4f) < 0.01f && std::fabs(reading.mCurrent - 1.5f) < 0.01f && 4194 == calibration;
+    flag &= compareFrame(decoder, display);
+
+    // a single pixel costs the addressing of its page and a single byte
+    decoder.mAccesses = 0;
+    display.setPixel(5, 50, true);
+    flag &= waitFor([&]() { return display.isSynchronised(); });
+    bus.takeRecord(accesses);
+    decoder.decode(accesses, display.getAddress());
+    printf("Display: a single pixel took %zu transactions \n", decoder.mAccesses);
+    flag &= (7 == decoder.mAccesses) && compareFrame(decoder, display);
+
+    // drive commands while the display is redrawn continuously
+    const int64_t loaded = measureCommands(racer, display, 100);
+    bus.takeRecord(accesses);
+    decoder.decode(accesses, display.getAddress());
+    flag &= waitFor([&]() { return display.isSynchronised(); });
+    bus.takeRecord(accesses);
+    decoder.decode(accesses, display.getAddress());
+    bus.setRecording(false);
+    flag &= compareFrame(decoder, display);
+
+    const AuxiliaryStatistics statistics = racer.getAuxiliaryStatistics();
+    printf("Auxiliary bus: %llu transactions, %llu deferrals, %.1f%% of the bus with a budget of %.1f%% \n",
+           static_cast<unsigned long long>(statistics.mTransactions), static_cast<unsigned long long>(statistics.mDeferrals),
+           100.0f * statistics.mUtilisation, 100.0f * budget);
+    flag &= statistics.mUtilisation <= budget * 1.1f && 0 == statistics.mFailures;
+
+    // a command may wait for a single auxiliary transaction, but the median must not change measurably
+    printf("Median command time: %lld us without and %lld us with auxiliary devices \n",
+           static_cast<long long>(baseline / 1000), static_cast<long long>(loaded / 1000));
+    flag &= loaded - baseline < static_cast<int64_t>(accessTime);
+
+    racer.setAuxiliaryBudget(0.0f);
+    puts(flag ? "PASS" : "FAIL");
+    return flag ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Audits the steady-state hot path for heap allocations and system calls. Heap functions and libc system call
+ * wrappers are interposed, and counted only on the thread which drives gamepad events through GamepadDriveAdapter
+ * into the robots on virtual buses. The test fails if the number per command exceeds the budget.
+ *
+ * Usage: test_hot_path_audit [commands] [allocation budget per command] [syscall budget per command]
+ */
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <new>
+#include <poll.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <gamepad_drive_adapter.h>
+#include <robots/nvidia_racer.h>
+#include <robots/pridopia_car.h>
+#include <virtual_bus.h>
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+namespace
+{
+
+/** True on the thread which is audited, while the audit is running. */
+thread_local bool tAuditing = false;
+/** The number of heap allocations on the audited thread. */
+thread_local unsigned long tAllocations = 0;
+/** The number of system calls on the audited thread. */
+thread_local unsigned long tSyscalls = 0;
+
+/**
+ * Counts an allocation if the calling thread is audited.
+ */
+inline void countAllocation()
+{
+    tAllocations += tAuditing ? 1 : 0;
+}
+
+/**
+ * Counts a system call if the calling thread is audited.
+ */
+inline void countSyscall()
+{
+    tSyscalls += tAuditing ? 1 : 0;
+}
+
+/**
+ * Looks the next definition of a libc function up.
+ *  @param name the name of the function.
+ *  @return the function.
+ */
+template <typename Function>
+Function next(const char* name)
+{
+    return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+} // namespace
+
+// heap functions, forwarded to glibc directly because dlsym itself may allocate
+extern "C" void* malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+    countAllocation();
+    *pointer = __libc_memalign(alignment, size);
+    return (nullptr == *pointer) ? ENOMEM : 0;
+}
+
+void* operator new(size_t size)
+{
+    // counted by malloc
+    void* pointer = malloc(size);
+    if (nullptr == pointer)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+// system call wrappers which the control path could reach
+extern "C" ssize_t write(int fd, const void* buffer, size_t count)
+{
+    countSyscall();
+    return next<ssize_t (*)(int, const void*, size_t)>("write")(fd, buffer, count);
+}
+
+extern "C" ssize_t read(int fd, void* buffer, size_t count)
+{
+    countSyscall();
+    return next<ssize_t (*)(int, void*, size_t)>("read")(fd, buffer, count);
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    va_start(args, request);
+    void* argument = va_arg(args, void*);
+    va_end(args);
+    countSyscall();
+    return next<int (*)(int, unsigned long, void*)>("ioctl")(fd, request, argument);
+}
+
+extern "C" int poll(pollfd* fds, nfds_t count, int timeout)
+{
+    countSyscall();
+    return next<int (*)(pollfd*, nfds_t, int)>("poll")(fds, count, timeout);
+}
+
+extern "C" int usleep(useconds_t time)
+{
+    countSyscall();
+    return next<int (*)(useconds_t)>("usleep")(time);
+}
+
+extern "C" int nanosleep(const timespec* time, timespec* remaining)
+{
+    countSyscall();
+    return next<int (*)(const timespec*, timespec*)>("nanosleep")(time, remaining);
+}
+
+extern "C" int clock_nanosleep(clockid_t clock, int flags, const timespec* time, timespec* remaining)
+{
+    countSyscall();
+    return next<int (*)(clockid_t, int, const timespec*, timespec*)>("clock_nanosleep")(clock, flags, time, remaining);
+}
+
+extern "C" int sched_yield()
+{
+    countSyscall();
+    return next<int (*)()>("sched_yield")();
+}
+
+extern "C" int sem_post(sem_t* semaphore)
+{
+    // only a system call if there are waiters, counted conservatively
+    countSyscall();
+    return next<int (*)(sem_t*)>("sem_post")(semaphore);
+}
+
+/**
+ * Drives gamepad events into a robot and reports heap allocations and system calls per command.
+ *  @param robot the robot, initialised on a virtual bus.
+ *  @param commands the number of audited commands.
+ *  @param allocationBudget the allowed number of allocations per command.
+ *  @param syscallBudget the allowed number of system calls per command.
+ *  @return true if the robot is within the budgets.
+ */
+static bool audit(ARobotBase* robot, const int commands, const double allocationBudget, const double syscallBudget)
+{
+    GamepadDriveAdapter adapter;
+    GamepadEventData event;
+    rusage before;
+    rusage after;
+
+    static_cast<GenericTalker<DriveCommands>&>(adapter).registerTo(robot);
+    event.mIsAxis = true;
+    for (int i = -1000; i < commands; ++i)
+    {
+        if (0 == i)
+        {
+            // the first commands warm up lazily allocated per-thread state, e.g. trace and log buffers
+            tAllocations = 0;
+            tSyscalls = 0;
+            getrusage(RUSAGE_THREAD, &before);
+            tAuditing = true;
+        }
+        // alternate steering and throttle, and sweep through both directions to exercise stop-before-reverse
+        event.mNumber = static_cast<uint8_t>(2 + (i & 1));
+        event.mValue  = static_cast<int16_t>(((i * 97) % 65535) - 32767);
+        adapter.update(event);
+    }
+    tAuditing = false;
+    getrusage(RUSAGE_THREAD, &after);
+
+    double allocations = static_cast<double>(tAllocations) / commands;
+    double syscalls = static_cast<double>(tSyscalls) / commands;
+    bool flag = allocations <= allocationBudget && syscalls <= syscallBudget;
+    printf("%-12s %d commands: %.3f allocations/command, %.3f syscalls/command, %ld voluntary context switches: %s \n",
+           robot->getName(), commands, allocations, syscalls, after.ru_nvcsw - before.ru_nvcsw, flag ? "PASS" : "FAIL");
+    return flag;
+}
+
+int main(int argc, char** argv)
+{
+    const int commands = (argc > 1) ? atoi(argv[1]) : 10000;
+    const double allocationBudget = (argc > 2) ? atof(argv[2]) : 0.0;
+    const double syscallBudget = (argc > 3) ? atof(argv[3]) : 0.0;
+    VirtualBus racerBus("audit_racer");
+    VirtualBus pridopiaBus("audit_pridopia");
+    NvidiaRacer racer;
+    PridopiaCar pridopia;
+    bool flag = true;
+
+    if (commands <= 0 || !racer.initialise("audit_racer") || !pridopia.initialise("audit_pridopia"))
+    {
+        puts("Failed to initialise robots");
+        return 2;
+    }
+
+    printf("Budget per command: %.3f allocations, %.3f syscalls \n", allocationBudget, syscallBudget);
+    flag &= audit(&racer, commands, allocationBudget, syscallBudget);
+    flag &= audit(&pridopia, commands, allocationBudget, syscallBudget);
+    return flag ? 0 : 1;
+}
@@ -47,6 +47,22 @@ int main()
             racer.setSteering(steering);
             sleep(1);
         }
+
+        puts("Testing trajectory executor");
+        TrajectorySample trajectory[] = {{0.0f, DriveCommands( 0.0f, 0.0f)},
+                                         {1.0f, DriveCommands( 0.5f, 0.5f)},
+                                         {2.0f, DriveCommands(-0.5f, 0.5f)},
+                                         {3.0f, DriveCommands( 0.0f, 0.0f)}};
+        if (racer.executeTrajectory(trajectory, sizeof(trajectory) / sizeof(trajectory[0])))
+        {
+            while (racer.isTrajectoryRunning())
+            {
+                usleep(10000);
+            }
+            TrajectoryStatistics statistics = racer.getTrajectoryStatistics();
+            printf("Executed %u samples, missed %u deadlines, max lateness %.3f ms \n", statistics.mExecutedSamples,
+                    statistics.mMissedDeadlines, static_cast<double>(statistics.mMaxLateness) / 1000000.0);
+        }
     }
     else
     {
@@ -26,8 +26,12 @@
 #include <unistd.h>
 #include <gamepad.h>
 #include <gamepad_drive_adapter.h>
+#include <logger.h>
+#include <metrics_server.h>
+#include <profiler.h>
 #include <robots/nvidia_racer.h>
 #include <robots/pridopia_car.h>
+#include <trace.h>
 
 
 constexpr float MAX_SHORT = 32767.0f;
@@ -89,11 +93,20 @@ int main(int argc, char** argv)
         return 2;
     }
 
+    if (LOG_START(stderr))
+    {
+        puts("Logging to stderr");
+    }
     printf("Initialising %s \n", robot->getName());
     if (robot->initialise())
     {
         Gamepad gamepad;
         GamepadDriveAdapter adapter;
+        MetricsServer metricsServer;
+        if (metricsServer.start())
+        {
+            puts("Serving metrics on http://127.0.0.1:9105/metrics");
+        }
         robot->setThrottleGain(atof(argv[2]));
         robot->setSteeringOffset(atof(argv[3]));
         static_cast<GenericTalker<DriveCommands>&>(adapter).registerTo(robot);
@@ -122,6 +135,15 @@ int main(int argc, char** argv)
     {
         printf("Failed to initialise %s \n", robot->getName());
     }
+    if (TRACE_EXPORT("jetracer_trace.json"))
+    {
+        puts("Control path trace written to jetracer_trace.json");
+    }
+    if (PROFILE_DUMP(stdout))
+    {
+        puts("Control path profile written above");
+    }
+    LOG_STOP();
     puts("Finished");
     return 0;
 }
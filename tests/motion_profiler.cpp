@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Runs the motion profiler of an NvidiaRacer on a virtual bus. Checks that the first move from rest is neither
+ * delayed nor counted as a reversal, that the watchdog stops a ramp when commands go silent instead of being fed by
+ * the steps of the profiler, that the stop resets the ramp so that the next command in the opposite direction
+ * dwells at zero, and that re-enabling the profiler ramps from the current outputs.
+ *
+ * Usage: test_motion_profiler
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <robots/nvidia_racer.h>
+#include <time_utils.h>
+#include <virtual_bus.h>
+
+/**
+ * Waits until a condition holds.
+ *  @param condition the condition.
+ *  @param timeout the timeout in milliseconds.
+ *  @return true if the condition holds before the timeout.
+ */
+template <typename Condition>
+static bool waitFor(Condition condition, const int timeout)
+{
+    timespec time = toTimespec(1000000LL);
+    for (int i = 0; i < timeout; ++i)
+    {
+        if (condition())
+        {
+            return true;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &time, nullptr);
+    }
+    return condition();
+}
+
+/**
+ * Repeats a command every 10 ms.
+ *  @param racer the robot.
+ *  @param throttle the throttle to command.
+ *  @param duration the duration in milliseconds.
+ */
+static void repeat(NvidiaRacer& racer, const float throttle, const int duration)
+{
+    timespec time = toTimespec(10000000LL);
+    for (int i = 0; i < duration; i += 10)
+    {
+        racer.update(DriveCommands(0.0f, throttle));
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &time, nullptr);
+    }
+}
+
+int main()
+{
+    VirtualBus bus("profiler");
+    NvidiaRacer racer;
+    bool flag = true;
+    bool result;
+
+    if (!racer.initialise("profiler"))
+    {
+        puts("Failed to initialise the robot");
+        return 2;
+    }
+    const float gain = racer.getThrottleGain();
+
+    // reversing throttle takes 2 s from full scale and dwells 500 ms at zero, steering is not profiled
+    flag &= racer.setMotionProfile(MotionLimits(0.5f, 0.0f, 500));
+    flag &= racer.setWatchdogTimeout(100);
+
+    // the first move from rest has no direction to reverse
+    racer.update(DriveCommands(0.0f, -1.0f));
+    int64_t start = getMonotonicTime();
+    result = waitFor([&]() { return racer.getThrottle() < 0.0f; }, 50);
+    printf("First move: %.3f after %lld ms, %llu reversals \n", racer.getThrottle() / gain,
+           static_cast<long long>((getMonotonicTime() - start) / 1000000),
+           static_cast<unsigned long long>(racer.getMotionStatistics().mReversals));
+    flag &= result && 0 == racer.getMotionStatistics().mReversals;
+
+    // the steps of the ramp are no sign of life, so the watchdog stops the robot long before the ramp ends
+    result = waitFor([&]() { return 0 < racer.getWatchdogStatistics().mTrips; }, 1000);
+    const int64_t tripped = getMonotonicTime() - start;
+    printf("Watchdog: tripped after %lld ms \n", static_cast<long long>(tripped / 1000000));
+    flag &= result && tripped < 400000000LL;
+    result = waitFor([]() { return false; }, 100);
+    printf("Stopped throttle: %.3f \n", racer.getThrottle() / gain);
+    flag &= 0.0f == racer.getThrottle();
+
+    // the stop left the throttle at zero in the negative direction, so going forward dwells from the stop first
+    repeat(racer, 0.3f, 200);
+    printf("Reversal: %.3f while dwelling \n", racer.getThrottle() / gain);
+    flag &= 0.0f == racer.getThrottle();
+    repeat(racer, 0.3f, 400);
+    printf("Reversal: %.3f after dwelling, %llu reversals \n", racer.getThrottle() / gain,
+           static_cast<unsigned long long>(racer.getMotionStatistics().mReversals));
+    flag &= racer.getThrottle() > 0.0f && 1 == racer.getMotionStatistics().mReversals;
+
+    // with profiling re-enabled, the ramps start from where the outputs were left instead of from rest
+    flag &= racer.setWatchdogTimeout(0);
+    flag &= racer.setMotionProfile(MotionLimits());
+    racer.setThrottle(0.5f);
+    flag &= racer.setMotionProfile(MotionLimits(0.5f, 0.0f, 500));
+    repeat(racer, 0.5f, 50);
+    printf("Seeded: %.3f \n", racer.getThrottle() / gain);
+    flag &= std::fabs(racer.getThrottle() / gain - 0.5f) < 0.01f;
+
+    racer.setMotionProfile(MotionLimits());
+    puts(flag ? "PASS" : "FAIL");
+    return flag ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Replays a gamepad session through GamepadDriveAdapter with and without prediction, and measures how well the
+ * steering command anticipates the stick. The error of a command is its difference from the unpredicted command one
+ * latency later, i.e. from what the motors should be doing by the time the command takes effect. Without a session
+ * file a synthetic session is replayed, and the test fails unless prediction reduces the error. It then also fails
+ * unless the command comes to rest with a stick released to centre.
+ *
+ * A session is a text file with one axis event per line: <time in microseconds> <axis> <raw value>.
+ *
+ * Usage: test_prediction_replay [session file] [axis] [lookahead ms] [latency ms] [max lead]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <gamepad_drive_adapter.h>
+#include <time_utils.h>
+
+/**
+ * A recorded axis event.
+ */
+struct RecordedEvent
+{
+    /** Time of the event in nanoseconds. */
+    int64_t mTime;
+    /** The axis. */
+    uint8_t mAxis;
+    /** The raw value. */
+    int16_t mValue;
+};
+
+/**
+ * Keeps the latest steering command.
+ */
+class SteeringProbe : public GenericListener<DriveCommands>
+{
+public:
+    /** The latest steering command. */
+    float mSteering = 0.0f;
+
+    void update(const DriveCommands& command) override
+    {
+        mSteering = command.mSteering;
+    }
+};
+
+/**
+ * Loads a recorded session.
+ *  @param path the session file.
+ *  @param events the loaded events.
+ *  @return true if the session was loaded.
+ */
+static bool loadSession(const char* path, std::vector<RecordedEvent>& events)
+{
+    FILE* file = fopen(path, "r");
+    long long time;
+    int axis;
+    int value;
+
+    if (nullptr == file)
+    {
+        return false;
+    }
+    while (3 == fscanf(file, "%lld %d %d", &time, &axis, &value))
+    {
+        events.push_back({time * 1000LL, static_cast<uint8_t>(axis), static_cast<int16_t>(value)});
+    }
+    fclose(file);
+    return !events.empty();
+}
+
+/**
+ * Synthesises a session of a stick swept back and forth with pauses, polled every 8 ms with some sensor noise.
+ *  @param axis the axis of the stick.
+ *  @param events the synthesised events.
+ */
+static void synthesiseSession(const uint8_t axis, std::vector<RecordedEvent>& events)
+{
+    int16_t last = 0;
+    uint32_t seed = 12345;
+
+    for (int64_t time = 0; time < 20 * NS_IN_SECOND; time += 8000000LL)
+    {
+        const double seconds = static_cast<double>(time) / NS_IN_SECOND;
+        // hold the stick still for half a second out of every three
+        const double phase = std::fmod(seconds, 3.0) < 2.5 ? seconds : std::floor(seconds / 3.0) * 3.0 + 2.5;
+        seed = seed * 1103515245u + 12345u;
+        const double noise = static_cast<double>((seed >> 16) % 101) - 50.0;
+        const double value = 20000.0 * std::sin(2.0 * M_PI * 0.7 * phase) + 8000.0 * std::sin(2.0 * M_PI * 1.9 * phase);
+        const int16_t raw = static_cast<int16_t>(std::max(-32767.0, std::min(32767.0, value + noise)));
+        if (raw != last)
+        {
+            events.push_back({time, axis, raw});
+            last = raw;
+        }
+    }
+}
+
+/**
+ * Replays a session and samples the steering command every millisecond, settling the adapter as its thread would.
+ *  @param events the session.
+ *  @param axis the steering axis.
+ *  @param conditioning the conditioning of the steering axis.
+ *  @param samples the sampled steering commands.
+ *  @param hold how long to keep sampling after the last event in nanoseconds.
+ */
+static void replay(const std::vector<RecordedEvent>& events, const uint8_t axis, const AxisConditioning& conditioning,
+                   std::vector<float>& samples, const int64_t hold = 0)
+{
+    GamepadDriveAdapter adapter(axis, axis == 3 ? 2 : 3);
+    SteeringProbe probe;
+    GamepadEventData event;
+    size_t next = 0;
+
+    adapter.setConditioning(axis, conditioning);
+    adapter.applyMappings();
+    static_cast<GenericTalker<DriveCommands>&>(adapter).registerTo(&probe);
+    event.mIsAxis = true;
+    for (int64_t time = events.front().mTime; time <= events.back().mTime + hold; time += 1000000LL)
+    {
+        for (; next < events.size() && events[next].mTime <= time; ++next)
+        {
+            event.mNumber = events[next].mAxis;
+            event.mValue  = events[next].mValue;
+            adapter.update(event, events[next].mTime);
+        }
+        adapter.settle(time);
+        samples.push_back(probe.mSteering);
+    }
+}
+
+/**
+ * Calculates the root mean square error of commands against the reference one latency later.
+ *  @param commands the sampled commands.
+ *  @param reference the sampled reference commands.
+ *  @param latency the latency in samples.
+ *  @return the error.
+ */
+static double calculateError(const std::vector<float>& commands, const std::vector<float>& reference, const size_t latency)
+{
+    double sum = 0.0;
+    size_t count = 0;
+
+    for (size_t i = 0; i + latency < reference.size(); ++i, ++count)
+    {
+        const double error = commands[i] - reference[i + latency];
+        sum += error * error;
+    }
+    return count > 0 ? std::sqrt(sum / count) : 0.0;
+}
+
+/**
+ * Replays a stick ramped from full scale to centre and held there, and checks that the command comes to rest at centre.
+ *  @param axis the steering axis.
+ *  @param conditioning the conditioning of the steering axis.
+ *  @return true if the last command is at centre.
+ */
+static bool checkRelease(const uint8_t axis, const AxisConditioning& conditioning)
+{
+    std::vector<RecordedEvent> events;
+    std::vector<float> samples;
+
+    for (int step = 0; step <= 10; ++step)
+    {
+        events.push_back({step * 8000000LL, axis, static_cast<int16_t>(32767 - step * 32767 / 10)});
+    }
+    replay(events, axis, conditioning, samples, NS_IN_SECOND / 2);
+    printf("Stick released to centre: last command %.4f \n", samples.back());
+    return 0.0f == samples.back();
+}
+
+int main(int argc, char** argv)
+{
+    const bool synthetic = argc < 2;
+    const uint8_t axis = static_cast<uint8_t>((argc > 2) ? atoi(argv[2]) : 2);
+    const float lookahead = (argc > 3) ? static_cast<float>(atof(argv[3])) : 30.0f;
+    const int latency = (argc > 4) ? atoi(argv[4]) : static_cast<int>(lookahead);
+    const float maxLead = (argc > 5) ? static_cast<float>(atof(argv[5])) : 0.2f;
+    std::vector<RecordedEvent> events;
+    std::vector<float> reference;
+    std::vector<float> predicted;
+
+    if (synthetic)
+    {
+        synthesiseSession(axis, events);
+    }
+    else if (!loadSession(argv[1], events))
+    {
+        printf("Failed to load session %s \n", argv[1]);
+        return 2;
+    }
+
+    replay(events, axis, AxisConditioning(), reference);
+    replay(events, axis, AxisConditioning(0.0f, 0.0f, 1.0f, 0.0f, lookahead, maxLead), predicted);
+    const double baseline = calculateError(reference, reference, latency);
+    const double error = calculateError(predicted, reference, latency);
+    printf("%zu events, %d ms latency: RMS error %.4f without prediction, %.4f with %.0f ms lookahead \n",
+           events.size(), latency, baseline, error, lookahead);
+    if (!synthetic)
+    {
+        return 0;
+    }
+    return (error < baseline && checkRelease(axis, AxisConditioning(0.0f, 0.0f, 0.3f, 0.0f)) &&
+            checkRelease(axis, AxisConditioning(0.0f, 0.0f, 1.0f, 0.0f, lookahead, maxLead))) ? 0 : 1;
+}
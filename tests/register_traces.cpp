@@ -0,0 +1,329 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Runs scripted command sequences against recording virtual buses, compares the register traces with golden
+ * traces, and enforces a budget of bus bytes and transactions per command. Built once for the JetRacer layout
+ * (with PridopiaCar and ContinuousServo), and once for the JetRacer Pro layout.
+ *
+ * Usage: test_register_traces <golden directory> [--update]
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <i2c.h>
+#include <motor_controller/continuous_servo.h>
+#include <robots/nvidia_racer.h>
+#include <robots/pridopia_car.h>
+#include <virtual_bus.h>
+
+/**
+ * A scripted command.
+ */
+struct Step
+{
+    /** Kinds of commands. */
+    enum Kind
+    {
+        UPDATE,
+        STEERING,
+        THROTTLE
+    };
+
+    /** The kind of the command. */
+    Kind mKind;
+    /** Steering, or the servo throttle for ContinuousServo. */
+    float mSteering;
+    /** Throttle. */
+    float mThrottle;
+};
+
+/**
+ * The maximum bus traffic of a single command.
+ */
+struct Budget
+{
+    /** The maximum number of register bytes read or written. */
+    size_t mBytes;
+    /** The maximum number of transactions. */
+    uint32_t mTransactions;
+};
+
+/** Commands for robots: forward, steering sweeps, reversing (which stops first), and the separate setters. */
+static const Step ROBOT_SCRIPT[] = {
+    {Step::UPDATE,    0.0f,  0.0f},
+    {Step::UPDATE,    0.5f,  0.3f},
+    {Step::UPDATE,   -0.5f,  0.6f},
+    {Step::UPDATE,    0.0f, -0.4f},
+    {Step::UPDATE,    1.0f, -1.0f},
+    {Step::UPDATE,    0.0f,  0.0f},
+    {Step::STEERING, -1.0f,  0.0f},
+    {Step::THROTTLE,  0.0f,  0.7f},
+    {Step::THROTTLE,  0.0f, -0.7f},
+    {Step::STEERING,  0.25f, 0.0f},
+    {Step::UPDATE,    0.0f,  0.0f}};
+
+/** Throttle values for ContinuousServo. */
+static const Step SERVO_SCRIPT[] = {
+    {Step::UPDATE,  0.0f, 0.0f},
+    {Step::UPDATE,  1.0f, 0.0f},
+    {Step::UPDATE, -1.0f, 0.0f},
+    {Step::UPDATE,  0.5f, 0.0f},
+    {Step::UPDATE, -0.25f, 0.0f}};
+
+/**
+ * Appends recorded accesses to a trace.
+ *  @param bus the recording bus.
+ *  @param[out] trace the trace.
+ *  @return the number of accesses.
+ */
+static size_t appendAccesses(VirtualBus& bus, std::string& trace)
+{
+    std::vector<BusAccess> accesses;
+    char line[32];
+    bus.takeRecord(accesses);
+    for (const BusAccess& access : accesses)
+    {
+        snprintf(line, sizeof(line), "%c %02x %02x %02x\n", access.mWrite ? 'W' : 'R', access.mDeviceAddress,
+                 access.mRegister, access.mValue);
+        trace += line;
+    }
+    return accesses.size();
+}
+
+/**
+ * Appends the header of a command to a trace.
+ *  @param step the command.
+ *  @param[out] trace the trace.
+ */
+static void appendStep(const Step& step, std::string& trace)
+{
+    static const char* const names[] = {"update", "setSteering", "setThrottle"};
+    char line[64];
+    snprintf(line, sizeof(line), "> %s %.2f %.2f\n", names[step.mKind], step.mSteering, step.mThrottle);
+    trace += line;
+}
+
+/**
+ * Checks the traffic of a command against the budget.
+ *  @param name the name of the scenario.
+ *  @param index the index of the command.
+ *  @param bytes the number of bytes of the command.
+ *  @param transactions the number of transactions of the command.
+ *  @param budget the budget.
+ *  @return true if the command is within the budget.
+ */
+static bool checkBudget(const char* name, const size_t index, const size_t bytes, const uint32_t transactions, const Budget& budget)
+{
+    if (bytes > budget.mBytes || transactions > budget.mTransactions)
+    {
+        printf("%s: command %zu used %zu bytes and %u transactions, the budget is %zu bytes and %u transactions \n",
+               name, index, bytes, transactions, budget.mBytes, budget.mTransactions);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Runs the robot script.
+ *  @param robot the robot, not initialised.
+ *  @param busName the name of the bus of the robot.
+ *  @param budget the budget per command.
+ *  @param[out] trace the recorded trace.
+ *  @return true if all commands are within the budget.
+ */
+static bool runRobot(ARobotBase& robot, const char* busName, const Budget& budget, std::string& trace)
+{
+    VirtualBus* bus = VirtualBus::find(busName);
+    bool flag = true;
+    size_t bytes;
+    uint32_t transactions;
+
+    bus->setRecording(true);
+    trace += "> initialise\n";
+    flag &= robot.initialise(busName);
+    appendAccesses(*bus, trace);
+    for (size_t i = 0; i < sizeof(ROBOT_SCRIPT) / sizeof(ROBOT_SCRIPT[0]); ++i)
+    {
+        const Step& step = ROBOT_SCRIPT[i];
+        transactions = robot.getBusStatistics().mTransactions;
+        appendStep(step, trace);
+        switch (step.mKind)
+        {
+            case Step::UPDATE:
+                robot.update(DriveCommands(step.mSteering, step.mThrottle));
+                break;
+            case Step::STEERING:
+                robot.setSteering(step.mSteering);
+                break;
+            case Step::THROTTLE:
+                robot.setThrottle(step.mThrottle);
+                break;
+        }
+        bytes = appendAccesses(*bus, trace);
+        transactions = robot.getBusStatistics().mTransactions - transactions;
+        flag &= checkBudget(robot.getName(), i, bytes, transactions, budget);
+    }
+    bus->setRecording(false);
+    return flag;
+}
+
+#ifndef JETRACER_PRO
+/**
+ * Runs the servo script on a dedicated board.
+ *  @param budget the budget per command.
+ *  @param[out] trace the recorded trace.
+ *  @return true if all commands are within the budget.
+ */
+static bool runServo(const Budget& budget, std::string& trace)
+{
+    VirtualBus bus("golden_servo");
+    I2C i2c;
+    PCA9685 pca(&i2c, 0x40);
+    ContinuousServo servo(&pca, 3);
+    bool flag = i2c.openSerialPort("golden_servo");
+    size_t bytes;
+    uint32_t transactions;
+
+    bus.setRecording(true);
+    trace += "> initialise\n";
+    flag &= pca.reset();
+    flag &= pca.setFrequency(50);
+    servo.initialise();
+    appendAccesses(bus, trace);
+    for (size_t i = 0; i < sizeof(SERVO_SCRIPT) / sizeof(SERVO_SCRIPT[0]); ++i)
+    {
+        transactions = pca.getStatistics().mTransactions;
+        appendStep(SERVO_SCRIPT[i], trace);
+        flag &= servo.setThrottle(SERVO_SCRIPT[i].mSteering);
+        bytes = appendAccesses(bus, trace);
+        transactions = pca.getStatistics().mTransactions - transactions;
+        flag &= checkBudget("ContinuousServo", i, bytes, transactions, budget);
+    }
+    bus.setRecording(false);
+    return flag;
+}
+#endif
+
+/**
+ * Compares a trace with its golden file, or writes the golden file.
+ *  @param directory the directory of golden files.
+ *  @param name the name of the golden file.
+ *  @param trace the recorded trace.
+ *  @param update true to write the golden file instead of comparing.
+ *  @return true if the trace matches, or the golden file was written.
+ */
+static bool compare(const char* directory, const char* name, const std::string& trace, const bool update)
+{
+    std::string path = std::string(directory) + "/" + name;
+    std::string golden;
+    char buffer[4096];
+    size_t length;
+    FILE* file = fopen(path.c_str(), update ? "w" : "r");
+
+    if (nullptr == file)
+    {
+        printf("%s: cannot open %s \n", name, path.c_str());
+        return false;
+    }
+    if (update)
+    {
+        length = fwrite(trace.data(), 1, trace.size(), file);
+        fclose(file);
+        printf("%s: written %zu bytes \n", name, length);
+        return length == trace.size();
+    }
+
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        golden.append(buffer, length);
+    }
+    fclose(file);
+    if (golden == trace)
+    {
+        printf("%s: PASS \n", name);
+        return true;
+    }
+
+    // report the first line which differs
+    size_t line = 1;
+    size_t position = 0;
+    while (position < golden.size() && position < trace.size() && golden[position] == trace[position])
+    {
+        line += ('\n' == golden[position++]) ? 1 : 0;
+    }
+    size_t goldenEnd = golden.find('\n', position);
+    size_t traceEnd = trace.find('\n', position);
+    size_t start = golden.rfind('\n', (position > 0) ? position - 1 : 0);
+    start = (std::string::npos == start || 0 == position) ? 0 : start + 1;
+    printf("%s: FAIL at line %zu \n  golden:   %s \n  recorded: %s \n", name, line,
+           golden.substr(start, goldenEnd - start).c_str(), trace.substr(start, traceEnd - start).c_str());
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    bool update = (argc > 2) && (0 == strcmp(argv[2], "--update"));
+    bool flag = true;
+
+    if (argc < 2)
+    {
+        printf("Usage: %s <golden directory> [--update] \n", argv[0]);
+        return 2;
+    }
+
+    {
+        VirtualBus bus("golden_racer");
+        std::string trace = "# NvidiaRacer register trace\n";
+        NvidiaRacer racer;
+#ifdef JETRACER_PRO
+        // a frame of both servos, followed by the throttle alone when reversing stops first
+        flag &= runRobot(racer, "golden_racer", {12, 2}, trace);
+        flag &= compare(argv[1], "nvidia_racer_pro.trace", trace, update);
+#else
+        // a steering frame and eight throttle frames, doubled when reversing stops first
+        flag &= runRobot(racer, "golden_racer", {68, 17}, trace);
+        flag &= compare(argv[1], "nvidia_racer.trace", trace, update);
+#endif
+    }
+
+#ifndef JETRACER_PRO
+    {
+        VirtualBus bus("golden_pridopia");
+        std::string trace = "# PridopiaCar register trace\n";
+        PridopiaCar pridopia;
+        // four wheel frames, doubled when reversing stops first
+        flag &= runRobot(pridopia, "golden_pridopia", {32, 8}, trace);
+        flag &= compare(argv[1], "pridopia_car.trace", trace, update);
+    }
+
+    {
+        std::string trace = "# ContinuousServo register trace\n";
+        // a single frame
+        flag &= runServo({4, 1}, trace);
+        flag &= compare(argv[1], "continuous_servo.trace", trace, update);
+    }
+#endif
+    return flag ? 0 : 1;
+}
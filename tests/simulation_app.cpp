@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <robots/nvidia_racer.h>
+#include <robots/pridopia_car.h>
+#include <vehicle_simulator.h>
+#include <virtual_bus.h>
+#include <time_utils.h>
+
+int main(int argc, char** argv)
+{
+    const size_t pairs = (argc > 1) ? static_cast<size_t>(atoi(argv[1])) : 8;
+    const double duration = (argc > 2) ? atof(argv[2]) : 60.0;
+    const float dt = 0.001f;
+    const int commandDivider = 20; // 50 Hz commands
+#ifdef JETRACER_PRO
+    const VehicleModel racerModel = VEHICLE_JETRACER_PRO;
+#else
+    const VehicleModel racerModel = VEHICLE_JETRACER;
+#endif
+    std::vector<std::string> names(2 * pairs);
+    std::vector<VirtualBus*> buses;
+    std::vector<ARobotBase*> robots;
+    VehicleSimulator simulator;
+
+    printf("Simulating %zu NvidiaRacer and %zu PridopiaCar vehicles for %.1f s \n", pairs, pairs, duration);
+    for (size_t i = 0; i < 2 * pairs; ++i)
+    {
+        names[i] = "sim" + std::to_string(i);
+        buses.push_back(new VirtualBus(names[i].c_str()));
+        robots.push_back((i < pairs) ? static_cast<ARobotBase*>(new NvidiaRacer()) : static_cast<ARobotBase*>(new PridopiaCar()));
+        if (!robots.back()->initialise(names[i].c_str()))
+        {
+            printf("Failed to initialise %s on %s \n", robots.back()->getName(), names[i].c_str());
+            return 1;
+        }
+        simulator.addVehicle((i < pairs) ? racerModel : VEHICLE_PRIDOPIA, buses.back());
+    }
+
+    int64_t start = getMonotonicTime();
+    for (long step = 0; simulator.getTime() < duration; ++step)
+    {
+        if (0 == step % commandDivider)
+        {
+            // a slalom, every vehicle with a different phase
+            for (size_t i = 0; i < robots.size(); ++i)
+            {
+                robots[i]->update(DriveCommands(std::sin(simulator.getTime() + i), 0.5f));
+            }
+        }
+        simulator.step(dt);
+    }
+    double wallTime = static_cast<double>(getMonotonicTime() - start) / NS_IN_SECOND;
+
+    for (size_t i = 0; i < robots.size(); ++i)
+    {
+        VehicleState state = simulator.getState(i);
+        printf("%-12s x %7.2f m, y %7.2f m, heading %6.2f rad, speed %5.2f m/s \n", robots[i]->getName(),
+                state.mX, state.mY, state.mHeading, state.mSpeed);
+    }
+    printf("Simulated %.1f s in %.3f s, %.0fx faster than real time \n", duration, wallTime, duration / wallTime);
+
+    for (size_t i = 0; i < robots.size(); ++i)
+    {
+        delete robots[i];
+        delete buses[i];
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2023 Mateusz Malinowski
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Benchmarks the static pipeline against the virtual path of GamepadDriveAdapter and NvidiaRacer. The same gamepad
+ * events are applied through the virtual path and through the static pipeline with each PWM backend, each on its own
+ * virtual bus. The test fails unless all paths write the same registers in the same order for the first events, and
+ * end up with the same channel registers. Built once for the
+ * JetRacer layout, and once for the JetRacer Pro layout.
+ *
+ * Usage: test_static_pipeline [events]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <gamepad_drive_adapter.h>
+#include <i2c.h>
+#include <robots/nvidia_racer.h>
+#include <static_pipeline.h>
+#include <time_utils.h>
+#include <virtual_bus.h>
+
+#ifdef JETRACER_PRO
+typedef StaticJetRacerPro Model;
+#else
+typedef StaticJetRacer Model;
+#endif
+
+/**
+ * Boards of the static pipeline on their own virtual bus, initialised like those of NvidiaRacer.
+ */
+class StaticBoards
+{
+public:
+    /**
+     * Initialises the boards.
+     *  @param name the name of the virtual bus.
+     */
+    StaticBoards(const char* name)
+      : mBus(name), mI2C(), mThrottleBoard(&mI2C, PCA9685_ADDRESS_2), mSteeringBoard(&mI2C, PCA9685_ADDRESS_1), mModel()
+    {
+        mI2C.openSerialPort(name);
+        mThrottleBoard.reset();
+#ifdef JETRACER_PRO
+        mThrottleBoard.setFrequency(1600);
+        mModel.initialise(mThrottleBoard.getFrequency());
+#else
+        mThrottleBoard.setFrequency(1600);
+        mSteeringBoard.reset();
+        mSteeringBoard.setFrequency(50);
+        mModel.initialise(mSteeringBoard.getFrequency());
+#endif
+    }
+
+    VirtualBus mBus;
+    I2C mI2C;
+    PCA9685 mThrottleBoard;
+    PCA9685 mSteeringBoard;
+    Model mModel;
+};
+
+/**
+ * Runs events through the virtual path.
+ *  @param events the events.
+ *  @param count the number of events to run.
+ *  @param adapter the adapter, registered to the robot.
+ *  @return the time per event in nanoseconds.
+ */
+static double runVirtual(const GamepadEventData* events, const size_t count, GamepadDriveAdapter& adapter)
+{
+    int64_t start = getMonotonicTime();
+    for (size_t i = 0; i < count; ++i)
+    {
+        adapter.update(events[i]);
+    }
+    return static_cast<double>(getMonotonicTime() - start) / count;
+}
+
+/**
+ * Runs events through a static pipeline.
+ *  @param events the events.
+ *  @param count the number of events to run.
+ *  @param model the robot model.
+ *  @param backend the PWM backend.
+ *  @return the time per event in nanoseconds.
+ */
+template <typename Backend>
+static double runStatic(const GamepadEventData* events, const size_t count, Model& model, Backend& backend)
+{
+    ArrayEventSource source(events, count);
+    StaticDrivePipeline<ArrayEventSource, LinearConditioning, Model, Backend> pipeline(source, model, backend);
+    int64_t start = getMonotonicTime();
+    pipeline.poll();
+    return static_cast<double>(getMonotonicTime() - start) / count;
+}
+
+/**
+ * Compares the writes recorded by two virtual buses.
+ *  @param first the first bus.
+ *  @param second the second bus.
+ *  @param name the name of the second path.
+ *  @return true if the same registers were written with the same values in the same order.
+ */
+static bool compareWrites(VirtualBus& first, VirtualBus& second, const char* name)
+{
+    std::vector<BusAccess> accesses[2];
+    std::vector<BusAccess> writes[2];
+    first.takeRecord(accesses[0]);
+    second.takeRecord(accesses[1]);
+    for (int i = 0; i < 2; ++i)
+    {
+        for (const BusAccess& access : accesses[i])
+        {
+            if (access.mWrite)
+            {
+                writes[i].push_back(access);
+            }
+        }
+    }
+    for (size_t i = 0; i < writes[0].size() || i < writes[1].size(); ++i)
+    {
+        if (i >= writes[0].size() || i >= writes[1].size() || writes[0][i].mDeviceAddress != writes[1][i].mDeviceAddress ||
+            writes[0][i].mRegister != writes[1][i].mRegister || writes[0][i].mValue != writes[1][i].mValue)
+        {
+            printf("%s: write %zu of %zu differs from the virtual path with %zu writes \n", name, i, writes[1].size(), writes[0].size());
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Compares the channel registers of two virtual buses.
+ *  @param first the first bus.
+ *  @param second the second bus.
+ *  @param name the name of the second path.
+ *  @return true if all channel registers are equal.
+ */
+static bool compareRegisters(const VirtualBus& first, const VirtualBus& second, const char* name)
+{
+    const uint8_t addresses[] = {PCA9685_ADDRESS_1, PCA9685_ADDRESS_2};
+    for (uint8_t address : addresses)
+    {
+        for (uint16_t reg = 0x06; reg < 0x06 + 4 * PCA9685_CHANNELS; ++reg)
+        {
+            if (first.peek(address, static_cast<uint8_t>(reg)) != second.peek(address, static_cast<uint8_t>(reg)))
+            {
+                printf("%s: register %02x of board %02x is %02x instead of %02x \n", name, reg, address,
+                       second.peek(address, static_cast<uint8_t>(reg)), first.peek(address, static_cast<uint8_t>(reg)));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const int count = (argc > 1) ? atoi(argv[1]) : 100000;
+    std::vector<GamepadEventData> events(count > 0 ? count : 0);
+    VirtualBus virtualBus("virtual_path");
+    NvidiaRacer racer;
+    GamepadDriveAdapter adapter;
+    StaticBoards pcaBoards("static_pca9685");
+    StaticBoards directBoards("static_direct");
+    Model nullModel;
+    NullPwmBackend nullBackend;
+    bool flag = true;
+
+    if (count <= 0 || !racer.initialise("virtual_path"))
+    {
+        puts("Failed to initialise the robot");
+        return 2;
+    }
+    nullModel.initialise(50.0f);
+
+    // alternate steering and throttle, and sweep through both directions to exercise stop-before-reverse
+    for (int i = 0; i < count; ++i)
+    {
+        events[i].mIsAxis = true;
+        events[i].mNumber = static_cast<uint8_t>(2 + (i & 1));
+        events[i].mValue  = static_cast<int16_t>(((i * 97) % 65535) - 32767);
+    }
+
+    static_cast<GenericTalker<DriveCommands>&>(adapter).registerTo(&racer);
+    PCA9685Backend pcaBackend(&pcaBoards.mThrottleBoard, &pcaBoards.mSteeringBoard);
+    DirectPwmBackend<I2C> directBackend(&directBoards.mI2C, PCA9685_ADDRESS_2, PCA9685_ADDRESS_1);
+
+    // the first events are recorded, and every path must write the same registers in the same order
+    const size_t recorded = std::min<size_t>(count, 2000);
+    virtualBus.setRecording(true);
+    pcaBoards.mBus.setRecording(true);
+    directBoards.mBus.setRecording(true);
+    runVirtual(events.data(), recorded, adapter);
+    runStatic(events.data(), recorded, pcaBoards.mModel, pcaBackend);
+    runStatic(events.data(), recorded, directBoards.mModel, directBackend);
+    virtualBus.setRecording(false);
+    pcaBoards.mBus.setRecording(false);
+    directBoards.mBus.setRecording(false);
+    flag &= compareWrites(virtualBus, pcaBoards.mBus, "PCA9685 backend");
+    flag &= compareWrites(virtualBus, directBoards.mBus, "direct register backend");
+
+    const double virtualTime = runVirtual(events.data(), events.size(), adapter);
+    const double pcaTime = runStatic(events.data(), events.size(), pcaBoards.mModel, pcaBackend);
+    const double directTime = runStatic(events.data(), events.size(), directBoards.mModel, directBackend);
+    const double nullTime = runStatic(events.data(), events.size(), nullModel, nullBackend);
+
+    printf("%d events, time per event: \n", count);
+    printf("  virtual path (GamepadDriveAdapter, NvidiaRacer)  %8.1f ns \n", virtualTime);
+    printf("  static pipeline, PCA9685 backend                 %8.1f ns \n", pcaTime);
+    printf("  static pipeline, direct register backend         %8.1f ns \n", directTime);
+    printf("  static pipeline, no bus (checksum %08x)        %8.1f ns \n", nullBackend.mChecksum, nullTime);
+
+    flag &= compareRegisters(virtualBus, pcaBoards.mBus, "PCA9685 backend");
+    flag &= compareRegisters(virtualBus, directBoards.mBus, "direct register backend");
+    puts(flag ? "Writes and registers match: PASS" : "FAIL");
+    return flag ? 0 : 1;
+}